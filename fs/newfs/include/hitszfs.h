@@ -9,8 +9,11 @@
 #include "string.h"
 #include "fuse.h"
 #include <stddef.h>
+#include <limits.h>
 #include "ddriver.h"
 #include "errno.h"
+#include <pthread.h>
+#include <time.h>
 #include "types.h"
 
 #define HITSZFS_MAGIC           0x52415453       /* TODO: Define by yourself */
@@ -18,31 +21,61 @@
 
 extern struct hitszfs_super      hitszfs_super; 
 extern struct custom_options     hitszfs_options;
+extern struct hitszfs_stats      hitszfs_stats;
 
 /******************************************************************************
 * SECTION: macro debug
 *******************************************************************************/
+/* 只在定义HITSZFS_DEBUG时输出(CMake Debug构建)，否则编译掉，不进入创建等热路径 */
+#ifdef HITSZFS_DEBUG
 #define HITSZFS_DBG(fmt, ...) do { printf("HITSZFS_DBG: " fmt, ##__VA_ARGS__); } while(0) 
+#else
+#define HITSZFS_DBG(fmt, ...) do { } while(0)
+#endif
 /******************************************************************************
 * SECTION: hitszfs_utils.c
 *******************************************************************************/
 char* 			   		hitszfs_get_fname(const char* path);
 int 			   		hitszfs_calc_lvl(const char * path);
-int 			   		hitszfs_driver_read(int offset, uint8_t *out_content, int size);
-int 			   		hitszfs_driver_write(int offset, uint8_t *in_content, int size);
+int 			   		hitszfs_driver_read(off_t offset, uint8_t *out_content, int size);
+int 			   		hitszfs_driver_write(off_t offset, uint8_t *in_content, int size);
 
 
 int 			   		hitszfs_mount(struct custom_options options);
 int						hitszfs_umount();
 
 int 			   		hitszfs_alloc_dentry(struct hitszfs_inode * inode, struct hitszfs_dentry * dentry);
+int 			   		hitszfs_alloc_data_blk();
+int 			   		hitszfs_alloc_data_blks(int cnt);
+void 			   		hitszfs_free_data_blk(int blk);
+void 			   		hitszfs_defer_free(struct hitszfs_inode* owner, int no, boolean is_ino);
+boolean 		   		hitszfs_reclaim_frees(boolean is_ino);
+int 			   		hitszfs_reserve_data(struct hitszfs_inode * inode, int size);
 struct hitszfs_inode*	hitszfs_alloc_inode(struct hitszfs_dentry * dentry);
+void 			   		hitszfs_mark_inode_dirty(struct hitszfs_inode * inode, flag16 flags);
+void 			   		hitszfs_drop_inode(struct hitszfs_inode * inode);
 int 			   		hitszfs_sync_inode(struct hitszfs_inode * inode);
+int 			   		hitszfs_sync_dirty();
+int 			   		hitszfs_writeback(time_t expire, int max_cnt);
+
+void 			   		hitszfs_batch_init(struct hitszfs_io_batch* batch);
+int 			   		hitszfs_batch_add(struct hitszfs_io_batch* batch, off_t offset, uint8_t* content, int size);
+int 			   		hitszfs_batch_submit(struct hitszfs_io_batch* batch, struct hitszfs_io_batch* data);
+int 			   		hitszfs_batch_write(struct hitszfs_io_batch* batch);
+void 			   		hitszfs_batch_free(struct hitszfs_io_batch* batch);
 
 struct hitszfs_inode*	hitszfs_read_inode(struct hitszfs_dentry * dentry, int ino);
+struct hitszfs_inode*	hitszfs_dentry_inode(struct hitszfs_dentry * dentry);
+mode_t 			   		hitszfs_ftype_mode(HITSZFS_FILE_TYPE ftype);
+void 			   		hitszfs_fill_stat(struct hitszfs_inode * inode, struct stat * st);
+void 			   		hitszfs_fill_statfs(struct statvfs * st);
+void 			   		hitszfs_conn_init(struct fuse_conn_info * conn);
 struct hitszfs_dentry* 	hitszfs_get_dentry(struct hitszfs_inode * inode, int dir);
 
 struct hitszfs_dentry* 	hitszfs_lookup(const char * path, boolean * is_find, boolean* is_root);
+struct hitszfs_dentry* 	hitszfs_lookup_parent(const char * path, boolean * is_find);
+void 			   		hitszfs_group_sum_init();
+void 			   		hitszfs_group_dirty_all();
 
 /******************************************************************************
 * SECTION: hitszfs.c
@@ -51,13 +84,20 @@ void* 			   hitszfs_init(struct fuse_conn_info *);
 void  			   hitszfs_destroy(void *);
 int   			   hitszfs_mkdir(const char *, mode_t);
 int   			   hitszfs_getattr(const char *, struct stat *);
+int   			   hitszfs_statfs(const char *, struct statvfs *);
 int   			   hitszfs_readdir(const char *, void *, fuse_fill_dir_t, off_t,
 						                struct fuse_file_info *);
 int   			   hitszfs_mknod(const char *, mode_t, dev_t);
+int   			   hitszfs_symlink(const char *, const char *);
+int   			   hitszfs_readlink(const char *, char *, size_t);
 int   			   hitszfs_write(const char *, const char *, size_t, off_t,
 					                  struct fuse_file_info *);
 int   			   hitszfs_read(const char *, char *, size_t, off_t,
 					                 struct fuse_file_info *);
+int   			   hitszfs_write_buf(const char *, struct fuse_bufvec *, off_t,
+					                 struct fuse_file_info *);
+int   			   hitszfs_read_buf(const char *, struct fuse_bufvec **, size_t, off_t,
+					                 struct fuse_file_info *);
 int   			   hitszfs_access(const char *, int);
 int   			   hitszfs_unlink(const char *);
 int   			   hitszfs_rmdir(const char *);
@@ -66,10 +106,136 @@ int   			   hitszfs_utimens(const char *, const struct timespec tv[2]);
 int   			   hitszfs_truncate(const char *, off_t);
 			
 int   			   hitszfs_open(const char *, struct fuse_file_info *);
+int   			   hitszfs_release(const char *, struct fuse_file_info *);
 int   			   hitszfs_opendir(const char *, struct fuse_file_info *);
+int   			   hitszfs_releasedir(const char *, struct fuse_file_info *);
+int   			   hitszfs_ioctl(const char *, int, void *, struct fuse_file_info *, 
+						                unsigned int, void *);
+int   			   hitszfs_flush(const char *, struct fuse_file_info *);
+int   			   hitszfs_fsync(const char *, int, struct fuse_file_info *);
+
+/******************************************************************************
+* SECTION: hitszfs_layout.c
+*******************************************************************************/
+int 			   	   hitszfs_plan_layout(off_t sz_disk, int sz_io, int sz_blk, int bytes_per_inode,
+										   int journal_blks, struct hitszfs_super_d* super_d);
+
+/******************************************************************************
+* SECTION: hitszfs_journal.c
+*******************************************************************************/
+int 			   	   hitszfs_journal_format(struct hitszfs_super_d* super_d);
+int 			   	   hitszfs_journal_load(struct hitszfs_super_d* super_d);
+int 			   	   hitszfs_journal_commit(struct hitszfs_io_batch* batch);
+int 			   	   hitszfs_journal_checkpoint();
+boolean 			   hitszfs_journal_need_checkpoint();
+void 			   	   hitszfs_journal_overlay(off_t offset, uint8_t* buf, int size);
+boolean 			   hitszfs_journal_pinned(off_t offset, int size);
+void 			   	   hitszfs_journal_destroy();
+
+/******************************************************************************
+* SECTION: hitszfs_itable.c
+*******************************************************************************/
+int 			   	   hitszfs_itable_read(int ino, struct hitszfs_inode_d* inode_d);
+int 			   	   hitszfs_itable_readahead(int* inos, int cnt);
+void 			   	   hitszfs_itable_update(struct hitszfs_inode_d* inode_d);
+void 			   	   hitszfs_itable_destroy();
+
+/******************************************************************************
+* SECTION: hitszfs_slab.c
+*******************************************************************************/
+void 			   	   hitszfs_slab_init(struct hitszfs_slab* slab, const char* name, int obj_sz, uint64_t* live);
+void* 			   	   hitszfs_slab_alloc(struct hitszfs_slab* slab);
+void 			   	   hitszfs_slab_free(struct hitszfs_slab* slab, void* obj);
+void 			   	   hitszfs_slab_destroy(struct hitszfs_slab* slab);
+struct hitszfs_dentry* new_dentry(char * fname, HITSZFS_FILE_TYPE ftype);
+void 			   	   hitszfs_dentry_set_fname(struct hitszfs_dentry* dentry, const char* fname);
+void 			   	   hitszfs_free_dentry(struct hitszfs_dentry* dentry);
+struct hitszfs_inode*  hitszfs_new_inode();
+void 			   	   hitszfs_free_inode(struct hitszfs_inode* inode);
+
+/******************************************************************************
+* SECTION: hitszfs_icache.c
+*******************************************************************************/
+void 			   	   hitszfs_icache_add(struct hitszfs_inode* inode);
+void 			   	   hitszfs_icache_del(struct hitszfs_inode* inode);
+void 			   	   hitszfs_icache_touch(struct hitszfs_inode* inode);
+void 			   	   hitszfs_icache_shrink();
+void 			   	   hitszfs_icache_balance();
+void 			   	   hitszfs_icache_put(struct hitszfs_inode* inode);
+void 			   	   hitszfs_icache_detach(struct hitszfs_dentry* dentry);
+void 			   	   hitszfs_icache_unref(struct hitszfs_inode* inode, int* cnt, int n);
+
+/******************************************************************************
+* SECTION: hitszfs_dir.c
+*******************************************************************************/
+uint32_t 			   hitszfs_name_hash(const char* fname);
+void 			   	   hitszfs_dindex_insert(struct hitszfs_inode* dir, struct hitszfs_dentry* dentry);
+void 			   	   hitszfs_dindex_place(struct hitszfs_inode* dir, struct hitszfs_dentry* dentry);
+void 			   	   hitszfs_dindex_remove(struct hitszfs_inode* dir, struct hitszfs_dentry* dentry);
+struct hitszfs_dentry* hitszfs_dindex_find(struct hitszfs_inode* dir, const char* fname);
+struct hitszfs_dentry* hitszfs_dindex_at(struct hitszfs_inode* dir, int slot);
+int 			   	   hitszfs_dir_load(struct hitszfs_inode* dir);
+struct hitszfs_dentry* hitszfs_dir_lookup(struct hitszfs_inode* dir, const char* fname);
+int 			   	   hitszfs_dir_remove(struct hitszfs_inode* dir, struct hitszfs_dentry* dentry);
+int 			   	   hitszfs_dir_rename(struct hitszfs_dentry* src, struct hitszfs_inode* new_dir, 
+										  const char* fname, struct hitszfs_dentry* dst);
+int 			   	   hitszfs_dx_stage(struct hitszfs_inode* dir, struct hitszfs_io_batch* batch);
+struct hitszfs_dir_handle* hitszfs_dir_open(struct hitszfs_inode* dir);
+int 			   	   hitszfs_dir_snapshot(struct hitszfs_dir_handle* dh);
+void 			   	   hitszfs_dir_close(struct hitszfs_dir_handle* dh);
+void 			   	   hitszfs_dirent_init_blk(struct hitszfs_inode* dir, int blk_idx);
+int 			   	   hitszfs_dirent_load(struct hitszfs_inode* dir);
+struct hitszfs_dentry* hitszfs_dirent_read(struct hitszfs_inode* dir, int pos, const char* fname);
+int 			   	   hitszfs_dirent_insert(struct hitszfs_inode* dir, struct hitszfs_dentry* dentry);
+void 			   	   hitszfs_dirent_remove(struct hitszfs_inode* dir, struct hitszfs_dentry* dentry);
+
+/******************************************************************************
+* SECTION: hitszfs_file.c
+*******************************************************************************/
+int 			   	   hitszfs_file_fill(struct hitszfs_inode* inode, int first, int last, boolean ra);
+int 			   	   hitszfs_file_ra_start();
+void 			   	   hitszfs_file_ra_stop();
+struct hitszfs_file_handle* hitszfs_file_open(struct hitszfs_inode* inode);
+void 			   	   hitszfs_file_close(struct hitszfs_file_handle* fh);
+int 			   	   hitszfs_file_read_buf(struct hitszfs_file_handle* fh, struct fuse_bufvec** bufp, 
+											 size_t size, off_t offset, boolean held);
+int 			   	   hitszfs_file_read(struct hitszfs_file_handle* fh, char* buf, size_t size, off_t offset);
+int 			   	   hitszfs_file_write(struct hitszfs_inode* inode, struct fuse_bufvec* src, off_t offset);
+int 			   	   hitszfs_file_truncate(struct hitszfs_inode* inode, off_t size);
+
+/******************************************************************************
+* SECTION: hitszfs_defrag.c
+*******************************************************************************/
+int 			   	   hitszfs_defrag_inode(struct hitszfs_inode* inode, struct hitszfs_defrag_report* rep);
+int 			   	   hitszfs_defrag_tree(struct hitszfs_inode* inode, struct hitszfs_defrag_report* rep);
+
+/******************************************************************************
+* SECTION: hitszfs_fsck.c
+*******************************************************************************/
+int 			   	   hitszfs_fsck(int jobs, boolean repair, struct hitszfs_fsck_report* rep);
+
+/******************************************************************************
+* SECTION: hitszfs_dcache.c
+*******************************************************************************/
+void 			   	   hitszfs_dcache_init();
+struct hitszfs_dentry* hitszfs_dcache_lookup(const char* path, boolean* is_find, boolean* is_root);
+void 			   	   hitszfs_dcache_insert(const char* path, struct hitszfs_dentry* dentry, 
+											 boolean is_find, boolean is_root);
+void 			   	   hitszfs_dcache_invalidate_neg();
+void 			   	   hitszfs_dcache_invalidate_all();
+void 			   	   hitszfs_dcache_destroy();
+
+/******************************************************************************
+* SECTION: hitszfs_flush.c
+*******************************************************************************/
+int 			   hitszfs_flusher_start();
+void 			   hitszfs_flusher_stop();
+void 			   hitszfs_flusher_kick();
 
 /******************************************************************************
 * SECTION: newfs_debug.c
 *******************************************************************************/
 void 			   hitszfs_dump_map(int option);
+void 			   hitszfs_dump_stats();
+void 			   hitszfs_dump_layout();
 #endif  /* _hitszfs_H_ */
\ No newline at end of file
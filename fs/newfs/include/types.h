@@ -37,18 +37,80 @@ typedef enum hitszfs_file_type {
 #define HITSZFS_ERROR_UNSUPPORTED   ENXIO
 #define HITSZFS_ERROR_IO            EIO     /* Error Input/Output */
 #define HITSZFS_ERROR_INVAL         EINVAL  /* Invalid Args */
+#define HITSZFS_ERROR_NAMETOOLONG   ENAMETOOLONG
+#define HITSZFS_ERROR_NOTDIR        ENOTDIR
+#define HITSZFS_ERROR_NOTEMPTY      ENOTEMPTY
+#define HITSZFS_ERROR_BUSY          EBUSY
+#define HITSZFS_ERROR_FBIG          EFBIG
 
 #define MAX_NAME_LEN                128    
 #define HITSZFS_MAX_FILE_NAME       128
 #define HITSZFS_INODE_PER_FILE      1
 #define HITSZFS_DATA_PER_FILE       6       // 文件最大为6*1024kB
+#define HITSZFS_INLINE_SZ           56      // 不超过此大小的文件与符号链接内容存放在inode中
+#define HITSZFS_DATA_ALL            ((1 << HITSZFS_DATA_PER_FILE) - 1) // inode->data_valid: 全部块已读入
 #define HITSZFS_DEFAULT_PERM        0777    // 全部权限
 
+#define HITSZFS_DEFAULT_BLK_SZ      1024    // 默认块大小，可选1024/4096
+#define HITSZFS_DEFAULT_BPI         8192    // 默认每8KiB空间分配一个inode
+#define HITSZFS_DEFAULT_INODE_CACHE 1024    // 默认最多缓存1024个内存inode
+#define HITSZFS_DEFAULT_DIRTY_AGE   5       // 默认脏inode最长驻留5秒
+#define HITSZFS_DEFAULT_DIRTY_RATIO 20      // 默认脏inode超过20%时立即回写
+#define HITSZFS_JOURNAL_AUTO        (-1)    // 日志区块数按磁盘大小确定
+#define HITSZFS_DEFAULT_JOURNAL_BLKS HITSZFS_JOURNAL_AUTO // 默认日志区块数，0为不带日志
+#define HITSZFS_JOURNAL_MIN_BLKS    128     // 按磁盘大小确定时日志区的最少块数
+#define HITSZFS_JOURNAL_DISK_RATIO  64      // 按磁盘大小确定时日志区约占磁盘的1/64
+#define HITSZFS_MAX_BLKS            INT_MAX // 块号、位图下标均为int，磁盘块数不能超过
+#define HITSZFS_DEFAULT_READAHEAD   32      // 默认数据块顺序预读窗口上限(块)
+#define HITSZFS_RA_INIT             4       // 一次打开中检测到顺序读后的首个预读窗口(块)
+#define HITSZFS_DEFAULT_TIMEOUT     10      // 内核默认缓存目录项和属性10秒(修改都经由本挂载点)
+#define HITSZFS_MAX_IO              (128 * 1024) // 内核单个读写请求与预读窗口的上限
+#define HITSZFS_WB_INTERVAL         1       // 后台回写线程唤醒周期(秒)
+#define HITSZFS_WB_CHUNK            64      // 每次持锁最多回写的inode数
+
 #define HITSZFS_IOC_MAGIC           'S'
 #define HITSZFS_IOC_SEEK            _IO(HITSZFS_IOC_MAGIC, 0)
+#define HITSZFS_IOC_STATS           _IOR(HITSZFS_IOC_MAGIC, 1, struct hitszfs_stats)
+#define HITSZFS_IOC_DEFRAG          _IOR(HITSZFS_IOC_MAGIC, 2, struct hitszfs_defrag_report)
+
+#define HITSZFS_ITABLE_RA           4       // inode表块预读窗口(块)
+
+#define HITSZFS_DNAME_INLINE_LEN    32      // 短于此长度的文件名直接存放在dentry内
+#define HITSZFS_SLAB_CHUNK_SZ       (64 * 1024) // slab每次向系统申请的内存
+#define HITSZFS_SLAB_ALIGN          16      // slab对象对齐
+
+#define HITSZFS_DCACHE_BUCKETS      4096    // dcache哈希桶数(2的幂)
+#define HITSZFS_DCACHE_CHAIN_MAX    4       // 每个桶最多缓存的路径数
+#define HITSZFS_DCACHE_PATH_LEN     128     // dcache只缓存短于此长度的路径
+#define HITSZFS_DCACHE_RETRY        4       // 无锁查找遇到并发插入时的重试次数
 
 #define HITSZFS_FLAG_BUF_DIRTY      0x1
 #define HITSZFS_FLAG_BUF_OCCUPY     0x2
+#define HITSZFS_FLAG_DENTRYS_DIRTY  0x4     // 目录块中有脏目录项
+#define HITSZFS_FLAG_DATA_DIRTY     0x8     // 文件数据脏
+#define HITSZFS_FLAG_IMAP_DIRTY     0x10    // 块组的inode位图块脏
+#define HITSZFS_FLAG_DMAP_DIRTY     0x20    // 块组的数据位图块脏
+#define HITSZFS_FLAG_BACKUP_DIRTY   0x40    // 各块组的超级块备份待写回(格式化、卸载、fsck修复)
+#define HITSZFS_FLAG_XRENAME        0x80    // 目录是跨目录rename的一端，须与另一端在同一事务提交
+#define HITSZFS_FLAG_STAGING        0x100   // inode已选入正在组装的事务
+
+#define HITSZFS_SUPER_CLEAN         0x1     // 超级块state: 备份及其中的块组摘要与主超级块一致
+
+#define HITSZFS_BLK_NONE            (-1)    // 未分配的数据块
+#define HITSZFS_BLK_DELAY           (-2)    // 已预留、回写时才分配的数据块(延迟分配)
+
+#define HITSZFS_FEATURE_DIR_INDEX   0x1     // 目录带有磁盘哈希索引块
+#define HITSZFS_FEATURE_VAR_DENTRY  0x2     // 目录块使用变长目录项(hitszfs_dirent_d)
+#define HITSZFS_FEATURE_JOURNAL     0x4     // 磁盘末尾带有元数据日志区
+#define HITSZFS_DX_MAGIC            0x44584958
+#define HITSZFS_DINDEX_INIT_SZ      8       // 目录哈希表初始桶数
+
+#define HITSZFS_JOURNAL_MAGIC       0x4A524E4C
+#define HITSZFS_JOURNAL_SB          0x1     // 日志块类型: 日志超级块
+#define HITSZFS_JOURNAL_DESC        0x2     // 日志块类型: 描述块
+#define HITSZFS_JOURNAL_COMMIT      0x3     // 日志块类型: 提交块
+#define HITSZFS_JOURNAL_BUCKETS     256     // 待检查点块哈希桶数(2的幂)
+#define HITSZFS_JOURNAL_CKPT_RATIO  50      // 日志占用超过该百分比时后台做检查点
 /******************************************************************************
 * SECTION: Macro Function
 *******************************************************************************/
@@ -63,13 +125,15 @@ typedef enum hitszfs_file_type {
 #define HITSZFS_ROUND_DOWN(value, round)    (value % round == 0 ? value : (value / round) * round)
 #define HITSZFS_ROUND_UP(value, round)      (value % round == 0 ? value : (value / round + 1) * round)
 
-#define HITSZFS_BLKS_SZ(blks)               (blks * HITSZFS_BLK_SZ()) // EXT2文件系统一个块大小为1024B 
+#define HITSZFS_BLKS_SZ(blks)               ((blks) * HITSZFS_BLK_SZ()) // EXT2文件系统一个块大小为1024B 
 #define HITSZFS_ASSIGN_FNAME(phitszfs_dentry, _fname)\ 
                                         memcpy(phitszfs_dentry->fname, _fname, strlen(_fname))
 
 #define HITSZFS_IS_DIR(pinode)              (pinode->dentry->ftype == HITSZFS_DIR)
 #define HITSZFS_IS_REG(pinode)              (pinode->dentry->ftype == HITSZFS_REG_FILE)
 #define HITSZFS_IS_SYM_LINK(pinode)         (pinode->dentry->ftype == HITSZFS_SYM_LINK)
+// 普通文件与符号链接在分配第一个数据块之前，内容存放在inode_d.inline_data中
+#define HITSZFS_IS_INLINE(pinode)           (!HITSZFS_IS_DIR(pinode) && (pinode)->data_blk[0] == HITSZFS_BLK_NONE)
 
 /******************************************************************************
 // #define HITSZFS_INO_OFS(ino)                (hitszfs_super.data_offset + ino * HITSZFS_BLKS_SZ((\
@@ -77,9 +141,48 @@ typedef enum hitszfs_file_type {
 // #define HITSZFS_DATA_OFS(ino)               (HITSZFS_INO_OFS(ino) + HITSZFS_BLKS_SZ(HITSZFS_INODE_PER_FILE))
 *******************************************************************************/
 // inode, data offset 重新进行宏定义
+// 磁盘按块组划分，各块组布局相同，inode_offset/data_offset等为块组内偏移(也即块组0的绝对偏移)
 #define HITSZFS_INO_SZ()                  (sizeof(struct hitszfs_inode_d))
-#define HITSZFS_INO_OFS(ino)              (hitszfs_super.inode_offset + ino * HITSZFS_INO_SZ())
-#define HITSZFS_DATA_OFS(blk)             (hitszfs_super.data_offset +  HITSZFS_BLKS_SZ((blk)))
+// 磁盘偏移一律按off_t计算，块组内偏移(inode_offset等)不超过一个块组，用int即可
+#define HITSZFS_GROUP_OFS(group)          ((off_t)(group) * hitszfs_super.blks_per_group * HITSZFS_BLK_SZ())
+// inode按块打包，不跨块存放；ITABLE_BLK为全局inode表块号，ITABLE_POS为块内偏移
+#define HITSZFS_INO_PER_BLK()             (HITSZFS_BLK_SZ() / HITSZFS_INO_SZ())
+#define HITSZFS_ITABLE_BLK(ino)           (((ino) / hitszfs_super.inodes_per_group) * hitszfs_super.inode_blks + \
+                                          ((ino) % hitszfs_super.inodes_per_group) / HITSZFS_INO_PER_BLK())
+#define HITSZFS_ITABLE_POS(ino)           ((((ino) % hitszfs_super.inodes_per_group) % HITSZFS_INO_PER_BLK()) * \
+                                          HITSZFS_INO_SZ())
+#define HITSZFS_INO_OFS(ino)              (HITSZFS_GROUP_OFS((ino) / hitszfs_super.inodes_per_group) + \
+                                          hitszfs_super.inode_offset + \
+                                          HITSZFS_BLKS_SZ(((ino) % hitszfs_super.inodes_per_group) / HITSZFS_INO_PER_BLK()) + \
+                                          HITSZFS_ITABLE_POS(ino))
+#define HITSZFS_DATA_OFS(blk)             (HITSZFS_GROUP_OFS((blk) / hitszfs_super.data_per_group) + \
+                                          hitszfs_super.data_offset + \
+                                          HITSZFS_BLKS_SZ((blk) % hitszfs_super.data_per_group))
+// 内存中各块组的位图首尾相接
+#define HITSZFS_GROUP_MAP_INODE_SZ()      (hitszfs_super.inodes_per_group / UINT8_BITS)
+#define HITSZFS_GROUP_MAP_DATA_SZ()       (hitszfs_super.data_per_group / UINT8_BITS)
+#define HITSZFS_MAP_INODE_SZ()            (hitszfs_super.group_cnt * HITSZFS_GROUP_MAP_INODE_SZ())
+#define HITSZFS_MAP_DATA_SZ()             (hitszfs_super.group_cnt * HITSZFS_GROUP_MAP_DATA_SZ())
+// 目录项按槽位(slot)顺序存放在目录的数据块中
+#define HITSZFS_DENTRY_PER_BLK()          (HITSZFS_BLK_SZ() / sizeof(struct hitszfs_dentry_d))
+#define HITSZFS_DENTRY_OFS(pinode, slot)  (HITSZFS_DATA_OFS((pinode)->data_blk[(slot) / HITSZFS_DENTRY_PER_BLK()]) + \
+                                          ((slot) % HITSZFS_DENTRY_PER_BLK()) * sizeof(struct hitszfs_dentry_d))
+// 变长目录项: 记录头8字节 + 文件名，按4字节对齐；pos为目录内字节偏移(块号 * 块大小 + 块内偏移)
+#define HITSZFS_VAR_DENTRY()              (hitszfs_super.features & HITSZFS_FEATURE_VAR_DENTRY)
+#define HITSZFS_DIRENT_LEN(name_len)      ((sizeof(struct hitszfs_dirent_d) + (name_len) + 3) & ~3)
+#define HITSZFS_DIRENT_AT(pinode, pos)    ((struct hitszfs_dirent_d *)((pinode)->data + (pos)))
+#define HITSZFS_DX_PER_BLK()              ((HITSZFS_BLK_SZ() - sizeof(struct hitszfs_dx_head)) / sizeof(struct hitszfs_dx_entry))
+#define HITSZFS_JOURNAL()                 (hitszfs_super.features & HITSZFS_FEATURE_JOURNAL)
+#define HITSZFS_IS_DIRTY(pobj)            ((pobj)->flags & HITSZFS_FLAG_BUF_DIRTY)
+
+// 命名空间锁: 修改目录树、回写、淘汰inode持写锁；getattr/readdir/open等只读操作持读锁
+#define HITSZFS_LOCK()                    pthread_rwlock_wrlock(&hitszfs_super.lock)
+#define HITSZFS_RDLOCK()                  pthread_rwlock_rdlock(&hitszfs_super.lock)
+#define HITSZFS_UNLOCK()                  pthread_rwlock_unlock(&hitszfs_super.lock)
+// 统计计数可能被多个读者同时更新
+#define HITSZFS_STAT_ADD(field, n)        __atomic_fetch_add(&hitszfs_stats.field, (n), __ATOMIC_RELAXED)
+#define HITSZFS_STAT_SUB(field, n)        __atomic_fetch_sub(&hitszfs_stats.field, (n), __ATOMIC_RELAXED)
+#define HITSZFS_STAT_INC(field)           HITSZFS_STAT_ADD(field, 1)
 
 /******************************************************************************
 * SECTION: FS Specific Structure - In memory structure
@@ -91,6 +194,51 @@ struct hitszfs_super;
 struct custom_options {
 //	const char*                 device;
     char*                       device;
+    int                         format;             // 强制重新格式化(mkfs.hitszfs)
+    int                         no_format;          // 离线工具: 主超级块无效时不格式化，改用块组中的备份
+    int                         blk_sz;             // 格式化时的块大小
+    int                         bytes_per_inode;    // 格式化时每多少字节分配一个inode
+    int                         dir_index;          // 格式化时开启目录磁盘哈希索引
+    int                         var_dentry;         // 格式化时使用变长目录项
+    int                         dirty_age;          // 脏inode最长驻留时间(秒)，0关闭后台回写
+    int                         dirty_ratio;        // 脏inode占缓存inode的百分比上限
+    int                         inode_cache;        // 内存inode数上限，<=0不限制
+    int                         journal_blks;       // 格式化时日志区的块数，0为不带日志，-1按磁盘大小
+    double                      entry_timeout;      // 低层接口: 目录项的内核缓存时间(秒)
+    double                      attr_timeout;       // 低层接口: 属性的内核缓存时间(秒)
+    int                         kernel_cache;       // open时保留内核页缓存
+    int                         readahead;          // 数据块顺序预读窗口上限(块)，0关闭
+};
+
+/* 块组的空闲空间摘要，随位图增量维护，statfs与分配器不必扫描位图 */
+struct hitszfs_group_sum {
+    int                         free_inode;         // 空闲inode数
+    int                         free_data;          // 空闲数据块数
+    int                         max_extent;         // 最长空闲区间(块)的上界，整组扫描后精确
+    flag16                      flags;              // HITSZFS_FLAG_IMAP_DIRTY / HITSZFS_FLAG_DMAP_DIRTY
+};
+
+/* 定长对象的slab缓存 */
+struct hitszfs_slab {
+    const char*                 name;
+    int                         obj_sz;
+    int                         objs_per_chunk;
+    void*                       free_list;  // 空闲对象链表，链接指针存放在对象首部
+    void*                       chunks;     // 已申请的整块内存链表
+    uint64_t*                   live;       // 活跃对象计数器(hitszfs_stats中)
+    pthread_mutex_t             lock;
+};
+
+/* 已释放的块或inode号，释放它的元数据提交之前仍占着位图，不会被重新分配 */
+struct hitszfs_free_ent {
+    int                         no;         // 块号或inode号
+    boolean                     is_ino;
+};
+
+struct hitszfs_free_list {
+    struct hitszfs_free_ent*    ents;
+    int                         cnt;
+    int                         cap;
 };
 
 struct hitszfs_super {
@@ -98,9 +246,8 @@ struct hitszfs_super {
     int                         fd;
     /* TODO: Define yourself */
     int                         sz_io;              // inode的大小
-    int                         sz_disk;            // 磁盘大小
+    off_t                       sz_disk;            // 磁盘大小
     int                         sz_blk;             // 块大小,1024B
-    int                         sz_usage;
 
     int                         max_ino;            // inode的最大数目
     int                         max_data;           // 数据块的最大数目
@@ -109,14 +256,53 @@ struct hitszfs_super {
     int                         map_inode_offset;   // inode位图的起始地址
     uint8_t*                    map_data;           // data位图
     int                         map_data_blks;      // data位图占用的块数
+    int                         inode_free;         // inode位图中的空闲inode数
+    int                         data_free;          // data位图中的空闲块数
+    int                         data_delalloc;      // 为延迟分配预留、尚未分配的块数
+    int                         inode_freeing;      // 已释放、待事务提交后才归还位图的inode数
+    int                         data_freeing;       // 已释放、待事务提交后才归还位图的数据块数
+    int                         ino_cursor;         // 下次分配inode时从此处向后找(next-fit)
+    int                         data_cursor;        // 下次分配单个数据块时从此处向后找
+    struct hitszfs_group_sum*   groups;             // 各块组的空闲空间摘要
     int                         map_data_offset;
 
     int                         inode_offset;
     int                         data_offset;        // 数据块的起始地址
 
+    int                         group_cnt;          // 块组数
+    int                         blks_per_group;     // 每个块组的块数
+    int                         inodes_per_group;   // 每个块组的inode数
+    int                         data_per_group;     // 每个块组的数据块数
+    int                         inode_blks;         // 每个块组inode表占用的块数
+    off_t                       journal_offset;     // 日志区在磁盘上的偏移
+    int                         journal_blks;       // 日志区块数
+    uint8_t**                   itable;             // inode表块缓存，按全局inode表块号索引
+    struct hitszfs_slab         inode_slab;
+    struct hitszfs_slab         dentry_slab;
+    struct hitszfs_inode*       lru_head;           // inode LRU，表头最近使用
+    struct hitszfs_inode*       lru_tail;
+
     boolean                     is_mounted;
+    int                         super_backup;       // 主超级块无效时挂载所用备份的块组号，0为主超级块
+    flag16                      flags;              // 超级块是否脏、备份是否待写回
+    uint32_t                    features;           // HITSZFS_FEATURE_*
 
     struct hitszfs_dentry*      root_dentry;        //根目录dentry
+    struct hitszfs_inode*       dirty_list;         // 脏inode链表
+    int                         dirty_cnt;          // 脏inode数
+    struct hitszfs_free_list    orphan_frees;       // 已不在任何目录中的inode释放的块，脏链表清空时归还
+    int                         inode_cnt;          // 内存中的inode数
+
+    /**
+     * 加锁顺序: lock -> inode->rwlock -> attach_lock -> icache_lock / itable_lock / 
+     * bitmap_lock / slab->lock -> io_lock，dcache另有自己的锁
+     */
+    pthread_rwlock_t            lock;               // 命名空间锁，见HITSZFS_LOCK/HITSZFS_RDLOCK
+    pthread_mutex_t             attach_lock;        // 读锁下为dentry读入inode
+    pthread_mutex_t             icache_lock;        // inode LRU链表
+    pthread_mutex_t             itable_lock;        // inode表块缓存
+    pthread_mutex_t             bitmap_lock;        // inode/data位图、空闲计数与摘要、flags
+    pthread_mutex_t             io_lock;            // 驱动的seek与read/write须成对执行
 };
 
 struct hitszfs_inode {
@@ -126,31 +312,178 @@ struct hitszfs_inode {
     int                         dir_cnt;
     struct hitszfs_dentry*      dentry;     // 指向该inode的dentry
     struct hitszfs_dentry*      dentrys;    // 所有目录项
+    struct hitszfs_dindex*      dindex;     // 目录项哈希索引
+    boolean                     dentrys_loaded; // 目录项是否已全部读入
+    int                         index_blk;  // 磁盘哈希索引块
     uint8_t*                    data;
+    int                         data_valid; // 普通文件: data中已读入的块(按位)，其余按需读入
+    int                         data_ra;    // 由预读读入、尚未被读取的块(按位)
     int                         data_blk[HITSZFS_DATA_PER_FILE]; // 数据块
+    flag16                      flags;      // 脏标记
+    int                         dirty_blks; // 变长目录项格式下被修改的目录块(按位)
+    int                         ref;        // 打开计数，非0时不会被淘汰
+    int                         nlookup;    // 低层接口: 内核持有的lookup计数，非0时不会被淘汰
+    boolean                     unlinked;   // 已从目录删除，等最后一次forget/release再释放
+    boolean                     referenced; // 最近被访问过，淘汰时给予第二次机会
+    pthread_rwlock_t            rwlock;     // 读锁下按需读入目录项时持写锁
+    struct hitszfs_inode*       lru_prev;   // inode LRU链表
+    struct hitszfs_inode*       lru_next;
+    struct hitszfs_inode*       dirty_next; // 脏inode链表
+    time_t                      dirtied_when; // 首次变脏的时间
+    struct hitszfs_free_list    frees;      // 由本inode的修改释放、随其提交归还的块与inode号
+    time_t                      atime;      // 访问时间
+    time_t                      mtime;      // 内容(目录为目录项)修改时间
+    time_t                      ctime;      // inode修改时间
 };
 
 struct hitszfs_dentry {
-    char                        fname[MAX_NAME_LEN];
+    char*                       fname;      // 指向fname_inline或单独申请的长文件名
+    char                        fname_inline[HITSZFS_DNAME_INLINE_LEN];
     uint32_t                    ino;
     /* TODO: Define yourself */
     struct hitszfs_dentry*      parent;     // 父亲inode的dentry
     struct hitszfs_dentry*      brother;
+    struct hitszfs_dentry**     pbrother;   // 指向前一项的brother(或父目录的dentrys)，摘除为O(1)
     struct hitszfs_inode*       inode;      // 指向inode
     HITSZFS_FILE_TYPE           ftype;
+    int                         slot;       // 在父目录数据块中的槽位(变长格式下为遍历序号)
+    int                         pos;        // 变长格式下在父目录中的字节偏移
+    flag16                      flags;      // 脏标记
+    uint32_t                    hash;       // 文件名哈希
+    struct hitszfs_dentry*      hash_next;  // 哈希桶链表
 };
 
-static inline struct hitszfs_dentry* new_dentry(char * fname, HITSZFS_FILE_TYPE ftype) {
-    struct hitszfs_dentry * dentry = (struct hitszfs_dentry *)malloc(sizeof(struct hitszfs_dentry));
-    memset(dentry, 0, sizeof(struct hitszfs_dentry));
-    HITSZFS_ASSIGN_FNAME(dentry, fname);
-    dentry->ftype   = ftype;
-    dentry->ino     = -1;
-    dentry->inode   = NULL;
-    dentry->parent  = NULL;
-    dentry->brother = NULL;  
-    return dentry;                                          
-}
+/* 目录的内存哈希索引，按文件名哈希查找，按槽位顺序遍历 */
+struct hitszfs_dindex {
+    struct hitszfs_dentry**     buckets;
+    int                         nbuckets;   // 2的幂
+    int                         cnt;
+    struct hitszfs_dentry**     slots;      // 槽位 -> dentry
+    int                         nslots;
+};
+
+/* readdir时的目录快照项，名字存放在句柄的names中 */
+struct hitszfs_dir_ent {
+    uint32_t                    ino;
+    HITSZFS_FILE_TYPE           ftype;
+    int                         name_ofs;   // 名字在names中的偏移
+};
+
+/* opendir创建的目录句柄，保存在fi->fh；readdir的offset是快照下标，不受并发增删影响 */
+struct hitszfs_dir_handle {
+    struct hitszfs_inode*       inode;
+    struct hitszfs_dir_ent*     ents;       // 目录快照，offset为0时(重新)生成
+    char*                       names;
+    int                         cnt;
+};
+
+/**
+ * 路径 -> dentry 缓存项，dentry为查找结果，is_find为FALSE时是负缓存(dentry为最后匹配的目录)
+ * 缓存项从slab分配(类型稳定)，无锁读者可能读到正被复用的项，由顺序计数检测后重试
+ */
+struct hitszfs_dcache_entry {
+    char                        path[HITSZFS_DCACHE_PATH_LEN];
+    int                         len;
+    uint32_t                    hash;
+    uint32_t                    gen;        // 插入时的代数，与当前代数不同即失效
+    boolean                     is_find;
+    boolean                     is_root;
+    struct hitszfs_dentry*      dentry;
+    struct hitszfs_dcache_entry* next;
+};
+
+/* 运行统计，可通过HITSZFS_IOC_STATS读取 */
+struct hitszfs_stats {
+    uint64_t                    dcache_hits;
+    uint64_t                    dcache_neg_hits;
+    uint64_t                    dcache_misses;
+    uint64_t                    dcache_invalidations;
+    uint64_t                    dcache_retries;     // 无锁查找因并发插入而重试的次数
+    uint64_t                    itable_reads;       // inode表读盘次数
+    uint64_t                    itable_hits;        // inode表块缓存命中
+    uint64_t                    inodes_live;        // 内存中的inode对象数
+    uint64_t                    dentries_live;      // 内存中的dentry对象数
+    uint64_t                    slab_bytes;         // slab占用的内存
+    uint64_t                    inode_evictions;    // 被LRU淘汰的inode数
+    uint64_t                    journal_commits;    // 日志事务数
+    uint64_t                    journal_blocks;     // 写入日志的块数(含描述块与提交块)
+    uint64_t                    journal_checkpoints;
+    uint64_t                    journal_replays;    // 挂载时重放的事务数
+    uint64_t                    journal_splits;     // 比日志区还大、被拆成多个事务的批次数
+    uint64_t                    ra_windows;         // 读入的预读窗口数
+    uint64_t                    ra_hits;            // 从预读窗口取得的数据块数
+    uint64_t                    alloc_calls;        // 数据块分配次数(一次分配一段连续块)
+    uint64_t                    alloc_blocks;       // 分配的数据块数
+    uint64_t                    delalloc_dropped;   // 预留后未分配即被截断或删除的块数
+};
+
+/* 碎片整理结果，可通过HITSZFS_IOC_DEFRAG对文件或目录(整棵子树)发起整理并取得 */
+struct hitszfs_defrag_report {
+    uint32_t                    files;              // 检查过的(非内联)文件数
+    uint32_t                    fragmented;         // 数据块不连续的文件数
+    uint32_t                    moved;              // 迁移到连续空闲区间的文件数
+    uint32_t                    blocks;             // 迁移的数据块数
+    uint32_t                    frags_before;       // 检查过的文件整理前的段数之和
+    uint32_t                    frags_after;        // 整理后的段数之和
+    uint32_t                    seeks_before;       // 迁移前读一遍被迁移文件的设备寻道数
+    uint32_t                    seeks_after;        // 迁移后读一遍的设备寻道数
+};
+
+/* 一致性检查结果(fsck.hitszfs) */
+struct hitszfs_fsck_report {
+    int                         dirs;               // 可达的目录数(含根目录)
+    int                         files;              // 可达的文件与符号链接数
+    int                         bad_entries;        // ino或文件类型越界的目录项
+    int                         bad_inodes;         // 与目录项不符或内容损坏的inode
+    int                         dup_inodes;         // 被多个目录项引用的inode
+    int                         dup_blocks;         // 被多个inode引用的数据块
+    int                         inode_missing;      // 被引用但在位图中空闲的inode
+    int                         inode_leaked;       // 在位图中占用但不可达的inode(孤儿)
+    int                         data_missing;       // 被引用但在位图中空闲的数据块
+    int                         data_leaked;        // 在位图中占用但无人引用的数据块
+    int                         bad_counts;         // 与位图不符的超级块空闲计数与块组摘要
+    boolean                     bad_super;          // 主超级块无效，由块组中的备份挂载
+    boolean                     repaired;           // 已替换位图并重新统计，卸载时写回
+};
+
+/* open创建的文件句柄，保存在fi->fh；记录这次打开的顺序读状态(参照Linux按需预读) */
+struct hitszfs_file_handle {
+    struct hitszfs_inode*       inode;
+    off_t                       next;       // 上次读取结束的偏移，下一次从这里读视为顺序读
+    int                         ra_start;   // 最近一个预读窗口的首块(文件内块号)
+    int                         ra_size;    // 最近一个预读窗口的块数，0为没有窗口
+};
+
+/* 交给预读线程的请求: 读入文件第first..last块，排队期间持有inode引用 */
+struct hitszfs_ra_req {
+    struct hitszfs_inode*       inode;
+    int                         first;
+    int                         last;
+    struct hitszfs_ra_req*      next;
+};
+
+/* 已提交到日志、尚未写回原位置(检查点)的块，读盘时以它覆盖磁盘上的旧内容 */
+struct hitszfs_jblock {
+    off_t                       offset;     // 原位置的磁盘偏移(块对齐)
+    uint8_t*                    buf;        // 最新内容
+    boolean                     in_txn;     // 已加入正在组装的事务
+    struct hitszfs_jblock*      next;
+};
+
+/* 一次批量提交中的单个写请求 */
+struct hitszfs_io_req {
+    off_t                       offset;     // 磁盘偏移
+    int                         size;
+    uint8_t*                    buf;
+    int                         seq;        // 加入批次的顺序，重叠时后加入的覆盖先加入的
+};
+
+struct hitszfs_io_batch {
+    struct hitszfs_io_req*      reqs;
+    int                         cnt;
+    int                         cap;
+    struct hitszfs_free_list    frees;      // 事务提交后归还位图
+};
 
 /******************************************************************************
 * 磁盘中的数据结构
@@ -158,7 +491,7 @@ static inline struct hitszfs_dentry* new_dentry(char * fname, HITSZFS_FILE_TYPE
 struct hitszfs_super_d
 {
     uint32_t           magic_num;
-    int                sz_usage;
+    int64_t            sz_usage;
 
     int                max_ino;             // 索引结点最大数目
     int                max_data;            // 数据块最大数目
@@ -168,6 +501,23 @@ struct hitszfs_super_d
     int                map_data_offset;     // 数据位图在磁盘上的偏移
     int                inode_offset;        // inode块在磁盘上的偏移
     int                data_offset;         // data块在磁盘上的偏移
+    uint32_t           features;            // HITSZFS_FEATURE_*
+
+    int                sz_blk;              // 块大小
+    int                group_cnt;           // 块组数
+    int                blks_per_group;      // 每个块组的块数
+    int                inodes_per_group;    // 每个块组的inode数
+    int                data_per_group;      // 每个块组的数据块数
+    int                inode_blks;          // 每个块组inode表占用的块数
+    int64_t            journal_offset;      // 日志区在磁盘上的偏移(位于全部块组之后)
+    int                journal_blks;        // 日志区块数
+
+    int                free_inode;          // 空闲inode数
+    int                free_data;           // 空闲数据块数
+    int                grp_free_inode;      // 所在块组的空闲inode数(各块组的超级块备份不同)
+    int                grp_free_data;       // 所在块组的空闲数据块数
+    int                grp_max_extent;      // 所在块组最长空闲区间的上界
+    int                state;               // HITSZFS_SUPER_CLEAN，回写时只更新主超级块则清除
 };
 
 struct hitszfs_inode_d
@@ -177,7 +527,12 @@ struct hitszfs_inode_d
     int                 dir_cnt;
     HITSZFS_FILE_TYPE   ftype;   
     int                 link;               
-    uint16_t            data_blk[HITSZFS_DATA_PER_FILE];
+    int                 data_blk[HITSZFS_DATA_PER_FILE];
+    int                 index_blk;          // 目录哈希索引块
+    int64_t             atime;
+    int64_t             mtime;
+    int64_t             ctime;
+    uint8_t             inline_data[HITSZFS_INLINE_SZ]; // 内联的文件内容或链接目标，inode共128字节
 };  
 
 struct hitszfs_dentry_d
@@ -187,4 +542,60 @@ struct hitszfs_dentry_d
     int                 ino;           // 指向的ino号 
 };  
 
+/* 变长目录项 (ext2风格)，rec_len覆盖到下一条记录，name_len为0表示空闲记录 */
+struct hitszfs_dirent_d
+{
+    int                 ino;
+    uint16_t            rec_len;
+    uint8_t             name_len;
+    uint8_t             ftype;
+    char                name[];
+};
+
+/**
+ * 日志区: 第0块为日志超级块，其余块循环使用。一个事务依次为
+ * 描述块(列出其后各块的原位置) + 数据块 ... + 提交块，整个事务一次顺序写入，
+ * 不跨越日志区末尾(放不下时从第1块重新开始)。提交块带有数据块的校验和。
+ */
+struct hitszfs_jhead_d
+{
+    uint32_t            magic;
+    uint32_t            type;               // HITSZFS_JOURNAL_SB / DESC / COMMIT
+    uint32_t            seq;                // 事务序号
+};
+
+struct hitszfs_jsb_d
+{
+    struct hitszfs_jhead_d head;            // seq为start处事务的序号
+    int                 nblks;              // 日志区块数
+    int                 start;              // 最早的未检查点事务位置，重放从这里开始
+};
+
+struct hitszfs_jdesc_d
+{
+    struct hitszfs_jhead_d head;
+    int                 cnt;                // 本描述块之后的数据块数
+    int64_t             offset[];           // 各数据块的原位置
+};
+
+struct hitszfs_jcommit_d
+{
+    struct hitszfs_jhead_d head;
+    uint32_t            csum;               // 事务内全部数据块的校验和
+    int                 blks;               // 事务总块数(含描述块与提交块)
+};
+
+/* 目录哈希索引块: 头部 + 按哈希排序的(hash, pos)数组，pos为目录项位置 */
+struct hitszfs_dx_head
+{
+    uint32_t            magic;
+    int                 count;              // 超出一块容量时为-1，退化为线性查找
+};
+
+struct hitszfs_dx_entry
+{
+    uint32_t            hash;
+    int                 pos;
+};
+
 #endif /* _TYPES_H_ */
\ No newline at end of file
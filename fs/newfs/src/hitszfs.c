@@ -4,17 +4,28 @@
 * SECTION: 宏定义
 *******************************************************************************/
 #define OPTION(t, p)        { t, offsetof(struct custom_options, p), 1 }
+#define OPTION_OFF(t, p)    { t, offsetof(struct custom_options, p), 0 }
 
 /******************************************************************************
 * SECTION: global region
 *******************************************************************************/
-struct hitszfs_super    hitszfs_super; 
-struct custom_options 	hitszfs_options;
+/* hitszfs_super、hitszfs_options、hitszfs_stats定义于hitszfs_utils.c，供mkfs.hitszfs共用 */
 /******************************************************************************
 * SECTION: Global Static Var
 *******************************************************************************/
 static const struct fuse_opt option_spec[] = {		/* 用于FUSE文件系统解析参数 */
 	OPTION("--device=%s", device),
+	OPTION("--blk_sz=%d", blk_sz),
+	OPTION("--bytes_per_inode=%d", bytes_per_inode),
+	OPTION("--dir_index", dir_index),
+	OPTION("--var_dentry", var_dentry),
+	OPTION("--journal_blks=%d", journal_blks),
+	OPTION("--inode_cache=%d", inode_cache),
+	OPTION("--dirty_age=%d", dirty_age),
+	OPTION("--dirty_ratio=%d", dirty_ratio),
+	OPTION("--readahead=%d", readahead),
+	OPTION("kernel_cache", kernel_cache),			/* 覆盖libfuse的同名选项，由open设置keep_cache */
+	OPTION_OFF("nokernel_cache", kernel_cache),
 	FUSE_OPT_END
 };
 
@@ -26,19 +37,29 @@ static struct fuse_operations operations = {
 	.destroy = hitszfs_destroy,				 /* umount文件系统 */
 	.mkdir = hitszfs_mkdir,					 /* 建目录，mkdir */
 	.getattr = hitszfs_getattr,				 /* 获取文件属性，类似stat，必须完成 */
+	.statfs = hitszfs_statfs,					 /* 查询容量，df */
 	.readdir = hitszfs_readdir,				 /* 填充dentrys */
 	.mknod = hitszfs_mknod,					 /* 创建文件，touch相关 */
-	.write = NULL,								  	 /* 写入文件 */
-	.read = NULL,								  	 /* 读文件 */
-	.utimens = hitszfs_utimens,				 /* 修改时间，忽略，避免touch报错 */
-	.truncate = NULL,						  		 /* 改变文件大小 */
-	.unlink = NULL,							  		 /* 删除文件 */
-	.rmdir	= NULL,							  		 /* 删除目录， rm -r */
-	.rename = NULL,							  		 /* 重命名，mv */
-
-	.open = NULL,							
-	.opendir = NULL,
-	.access = NULL
+	.symlink = hitszfs_symlink,				 /* 创建符号链接，ln -s */
+	.readlink = hitszfs_readlink,				 /* 读取符号链接 */
+	.write = hitszfs_write,					 /* 写入文件 */
+	.read = hitszfs_read,						 /* 读文件 */
+	.write_buf = hitszfs_write_buf,			 /* 写入文件，可直接从FUSE管道splice */
+	.read_buf = hitszfs_read_buf,				 /* 读文件，结果由libfuse释放 */
+	.utimens = hitszfs_utimens,				 /* 修改访问与修改时间，touch */
+	.truncate = hitszfs_truncate,				 /* 改变文件大小 */
+	.unlink = hitszfs_unlink,					 /* 删除文件 */
+	.rmdir	= hitszfs_rmdir,					 /* 删除目录， rm -r */
+	.rename = hitszfs_rename,					 /* 重命名，mv */
+
+	.open = hitszfs_open,						 /* 打开文件，持有inode引用 */
+	.release = hitszfs_release,				 /* 关闭文件，释放inode引用 */
+	.opendir = hitszfs_opendir,				 /* 打开目录，持有inode引用 */
+	.releasedir = hitszfs_releasedir,			 /* 关闭目录，释放inode引用 */
+	.access = hitszfs_access,					 /* 判断文件是否存在 */
+	.ioctl = hitszfs_ioctl,					 /* 查询运行统计 */
+	.flush = hitszfs_flush,					 /* close时回写该文件 */
+	.fsync = hitszfs_fsync					 /* fsync，回写该文件 */
 };
 /******************************************************************************
 * SECTION: 必做函数实现
@@ -51,11 +72,14 @@ static struct fuse_operations operations = {
  */
 void* hitszfs_init(struct fuse_conn_info * conn_info) {
 	/* TODO: 在这里进行挂载 */
+	hitszfs_conn_init(conn_info);
 	if (hitszfs_mount(hitszfs_options) != HITSZFS_ERROR_NONE) {
         HITSZFS_DBG("[%s] mount error\n", __func__);
 		fuse_exit(fuse_get_context()->fuse);
 		return NULL;
 	} 
+	hitszfs_flusher_start();
+	hitszfs_file_ra_start();
 
 	/* 下面是一个控制设备的示例 */
 	// super.fd = ddriver_open(hitszfs_options.device);
@@ -70,6 +94,8 @@ void* hitszfs_init(struct fuse_conn_info * conn_info) {
  */
 void hitszfs_destroy(void* p) {
 	/* TODO: 在这里进行卸载 */
+	hitszfs_file_ra_stop();
+	hitszfs_flusher_stop();
 	if (hitszfs_umount() != HITSZFS_ERROR_NONE) {
 		HITSZFS_DBG("[%s] unmount error\n", __func__);
 		fuse_exit(fuse_get_context()->fuse);
@@ -91,27 +117,43 @@ int hitszfs_mkdir(const char* path, mode_t mode) {
 	/* TODO: 解析路径，创建目录 */
 	// 寻找上级目录 创建目录并建立连接
 	(void)mode;
-	boolean is_find, is_root;
+	boolean is_find;
 	char* fname;
-	struct hitszfs_dentry* last_dentry = hitszfs_lookup(path, &is_find, &is_root);
+	struct hitszfs_dentry* last_dentry;
 	struct hitszfs_dentry* dentry;
 	struct hitszfs_inode*  inode;
 
+	HITSZFS_LOCK();
+	hitszfs_icache_shrink();							/* 持写锁，当前操作尚未持有inode，可安全淘汰 */
+	last_dentry = hitszfs_lookup_parent(path, &is_find);
+	if (last_dentry == NULL) {
+		HITSZFS_UNLOCK();
+		return -HITSZFS_ERROR_NOTFOUND;
+	}
 	if (is_find) {
+		HITSZFS_UNLOCK();
 		return -HITSZFS_ERROR_EXISTS;
 	}
 
-	if (HITSZFS_IS_REG(last_dentry->inode)) {
-		return -HITSZFS_ERROR_UNSUPPORTED;
+	if (!HITSZFS_IS_DIR(last_dentry->inode)) {
+		HITSZFS_UNLOCK();
+		return -HITSZFS_ERROR_NOTDIR;
 	}
 
 	fname  = hitszfs_get_fname(path);
 	dentry = new_dentry(fname, HITSZFS_DIR); 
 	dentry->parent = last_dentry;
 	inode  = hitszfs_alloc_inode(dentry);
-	hitszfs_alloc_dentry(last_dentry->inode, dentry);
-	hitszfs_dump_map(0);
-	hitszfs_dump_map(1);
+	if (inode == NULL || hitszfs_alloc_dentry(last_dentry->inode, dentry) < 0) {
+		if (inode != NULL) {
+			hitszfs_drop_inode(inode);
+		}
+		hitszfs_free_dentry(dentry);
+		HITSZFS_UNLOCK();
+		return -HITSZFS_ERROR_NOSPACE;
+	}
+	hitszfs_dcache_invalidate_neg();
+	HITSZFS_UNLOCK();
 	return 0;
 }
 
@@ -125,39 +167,41 @@ int hitszfs_mkdir(const char* path, mode_t mode) {
 int hitszfs_getattr(const char* path, struct stat * hitszfs_stat) {
 	/* TODO: 解析路径，获取Inode，填充hitszfs_stat，可参考/fs/simplefs/sfs.c的sfs_getattr()函数实现 */
 	boolean	is_find, is_root;
+	struct hitszfs_dentry* dentry;
+	HITSZFS_RDLOCK();									/* 只读，多个getattr可并发 */
 	// 找到路径所对应的目录项
-	struct hitszfs_dentry* dentry = hitszfs_lookup(path, &is_find, &is_root);
+	dentry = hitszfs_lookup(path, &is_find, &is_root);
 	if (is_find == FALSE) {
+		HITSZFS_UNLOCK();
+		hitszfs_icache_balance();
 		return -HITSZFS_ERROR_NOTFOUND;
 	}
 	// 判断目录项的文件类型并对状态进行编写
-	if (HITSZFS_IS_DIR(dentry->inode)) {
-		hitszfs_stat->st_mode = S_IFDIR | HITSZFS_DEFAULT_PERM;
-		hitszfs_stat->st_size = dentry->inode->dir_cnt * sizeof(struct hitszfs_dentry_d);
-	}
-	else if (HITSZFS_IS_REG(dentry->inode)) {
-		hitszfs_stat->st_mode = S_IFREG | HITSZFS_DEFAULT_PERM;
-		hitszfs_stat->st_size = dentry->inode->size;
-	}
-
-	hitszfs_stat->st_nlink 		= 1;
-	hitszfs_stat->st_uid 	 	= getuid();
-	hitszfs_stat->st_gid 	 	= getgid();
-	hitszfs_stat->st_atime   	= time(NULL);
-	hitszfs_stat->st_mtime   	= time(NULL);
-	hitszfs_stat->st_blksize 	= HITSZFS_BLK_SZ();
+	hitszfs_fill_stat(dentry->inode, hitszfs_stat);
+	HITSZFS_UNLOCK();
+	hitszfs_icache_balance();
+	return 0;
+}
 
-	if (is_root) {
-		hitszfs_stat->st_size	= hitszfs_super.sz_usage; 
-		hitszfs_stat->st_blocks = HITSZFS_DISK_SZ() / HITSZFS_BLK_SZ();
-		hitszfs_stat->st_nlink  = 2;		/* !特殊，根目录link数为2 */
-	}
+/**
+ * @brief 查询文件系统容量(df)，由超级块中增量维护的空闲计数直接给出，不扫描位图
+ * 
+ * @param path 可忽略
+ * @param stbuf 返回容量
+ * @return int 0成功，否则失败
+ */
+int hitszfs_statfs(const char* path, struct statvfs * stbuf) {
+	(void)path;
+	hitszfs_fill_statfs(stbuf);
 	return 0;
 }
 
 /**
  * @brief 遍历目录项，填充至buf，并交给FUSE输出
  * 
+ * 一次调用填满buf(filler返回1)为止，offset是opendir句柄中目录快照的下标，
+ * 同时给出ino和文件类型，内核据此填充d_type
+ * 
  * @param path 相对于挂载点的路径
  * @param buf 输出buffer
  * @param filler 参数讲解:
@@ -166,38 +210,66 @@ int hitszfs_getattr(const char* path, struct stat * hitszfs_stat) {
  *				const struct stat *stbuf, off_t off)
  * buf: name会被复制到buf中
  * name: dentry名字
- * stbuf: 文件状态，可忽略
- * off: 下一次offset从哪里开始，这里可以理解为第几个dentry
+ * stbuf: 文件状态，这里只填st_ino和st_mode的类型位
+ * off: 下一次offset从哪里开始，即快照中的下一项
  * 
- * @param offset 第几个目录项？
- * @param fi 可忽略
+ * @param offset 从快照的第几项开始，0时重新生成快照
+ * @param fi fh为opendir创建的目录句柄
  * @return int 0成功，否则失败
  */
 int hitszfs_readdir(const char * path, void * buf, fuse_fill_dir_t filler, off_t offset,
 			    		 struct fuse_file_info * fi) {
-    /* TODO: 解析路径，获取目录的Inode，并读取目录项，利用filler填充到buf，可参考/fs/simplefs/sfs.c的sfs_readdir()函数实现 */
-    boolean is_find, is_root;
-    int     cur_dir = offset;
-
-    struct hitszfs_dentry* dentry = hitszfs_lookup(path, &is_find, &is_root);
-    struct hitszfs_dentry* sub_dentry;
-    struct hitszfs_inode* inode;
-    if (is_find) {
-        inode = dentry->inode;
-        sub_dentry = hitszfs_get_dentry(inode, cur_dir);
-        if (sub_dentry) {
-            filler(buf, sub_dentry->fname, NULL, ++offset);
-        }
-        return HITSZFS_ERROR_NONE;
-    }
-    return -HITSZFS_ERROR_NOTFOUND;
+	boolean is_find, is_root;
+	struct hitszfs_dentry*     dentry;
+	struct hitszfs_dir_handle* dh = (struct hitszfs_dir_handle*)(uintptr_t)fi->fh;
+	struct hitszfs_inode*      inode;
+	struct stat                st;
+	int                        ret = HITSZFS_ERROR_NONE;
+	int                        i;
+
+	if (dh == NULL) {									/* 未经opendir时按路径查找，用临时句柄 */
+		HITSZFS_RDLOCK();
+		dentry = hitszfs_lookup(path, &is_find, &is_root);
+		if (!is_find || !HITSZFS_IS_DIR(dentry->inode)) {
+			HITSZFS_UNLOCK();
+			return is_find ? -HITSZFS_ERROR_NOTDIR : -HITSZFS_ERROR_NOTFOUND;
+		}
+		__atomic_add_fetch(&dentry->inode->ref, 1, __ATOMIC_RELAXED);
+		HITSZFS_UNLOCK();
+		dh = hitszfs_dir_open(dentry->inode);
+	}
+	if (offset == 0 || dh->ents == NULL) {				/* 句柄持有引用，inode不会被淘汰 */
+		HITSZFS_RDLOCK();
+		ret = hitszfs_dir_snapshot(dh);
+		HITSZFS_UNLOCK();
+	}
+	memset(&st, 0, sizeof(struct stat));
+	for (i = offset; ret == HITSZFS_ERROR_NONE && i < dh->cnt; i++)
+	{
+		st.st_ino  = dh->ents[i].ino;
+		st.st_mode = hitszfs_ftype_mode(dh->ents[i].ftype);
+		if (filler(buf, dh->names + dh->ents[i].name_ofs, &st, i + 1) != 0) {
+			break;										/* buf已满，下次从第i项续读 */
+		}
+	}
+	if (fi->fh == 0) {
+		inode = dh->inode;
+		hitszfs_dir_close(dh);
+		hitszfs_icache_unref(inode, &inode->ref, 1);
+	}
+	hitszfs_icache_balance();
+	return ret;
 }
 
 /**
  * @brief 创建文件
  * 
+ * 父目录由hitszfs_lookup_parent查找，连续创建时命中dcache；新目录项只在内存中标脏。
+ * close时的flush只提交新文件的inode与位图，父目录留在脏链表上，同一目录下的多次创建
+ * 在下一次sync或后台回写时合并为每个目录块一次写入
+ * 
  * @param path 相对于挂载点的路径
- * @param mode 创建文件的模式，可忽略
+ * @param mode 创建文件的模式，只支持普通文件和目录
  * @param dev 设备类型，可忽略
  * @return int 0成功，否则失败
  */
@@ -208,42 +280,81 @@ int hitszfs_mknod(const char* path, mode_t mode, dev_t dev) {
 	 * 如果文件存在则返回错误
 	 * 文件不存在则在创建目录项和对应的inode，并和父目录项建立连接
 	*/
-	boolean is_find, is_root;
+	boolean is_find;
 
-    struct hitszfs_dentry* last_dentry = hitszfs_lookup(path, &is_find, &is_root);//找到创建文件所在的目录
+    struct hitszfs_dentry* last_dentry;
     struct hitszfs_dentry* dentry;
     struct hitszfs_inode* inode;
     char* fname;
 
+    if (!S_ISREG(mode) && !S_ISDIR(mode)) {//管道、设备文件等不支持
+        return -HITSZFS_ERROR_UNSUPPORTED;
+    }
+    HITSZFS_LOCK();
+    hitszfs_icache_shrink();
+    last_dentry = hitszfs_lookup_parent(path, &is_find);//找到创建文件所在的目录，通常命中dcache
+    if (last_dentry == NULL) {//上级目录不存在
+        HITSZFS_UNLOCK();
+        return -HITSZFS_ERROR_NOTFOUND;
+    }
     if (is_find == TRUE) {//文件存在
+        HITSZFS_UNLOCK();
         return -HITSZFS_ERROR_EXISTS;
     }
+    if (!HITSZFS_IS_DIR(last_dentry->inode)) {
+        HITSZFS_UNLOCK();
+        return -HITSZFS_ERROR_NOTDIR;
+    }
 
     fname = hitszfs_get_fname(path);//获取文件名字
 
-    if (S_ISREG(mode)) {
-        dentry = new_dentry(fname, HITSZFS_REG_FILE);
-    }
-    else if (S_ISDIR(mode)) {
-        dentry = new_dentry(fname, HITSZFS_DIR);
-    }
+    dentry = new_dentry(fname, S_ISDIR(mode) ? HITSZFS_DIR : HITSZFS_REG_FILE);
     dentry->parent = last_dentry;
-    inode = hitszfs_alloc_inode(dentry);	// 分配inode和一个数据块
-    hitszfs_alloc_dentry(last_dentry->inode, dentry);
+    inode = hitszfs_alloc_inode(dentry);	// 分配inode，目录另分配一个数据块
+    if (inode == NULL || hitszfs_alloc_dentry(last_dentry->inode, dentry) < 0) {
+        if (inode != NULL) {
+            hitszfs_drop_inode(inode);
+        }
+        hitszfs_free_dentry(dentry);
+        HITSZFS_UNLOCK();
+        return -HITSZFS_ERROR_NOSPACE;
+    }
+    hitszfs_dcache_invalidate_neg();
 
+    HITSZFS_UNLOCK();
     return HITSZFS_ERROR_NONE;
 }
 
 /**
- * @brief 修改时间，为了不让touch报错 
+ * @brief 修改访问时间和修改时间，inode的ctime同时更新
  * 
  * @param path 相对于挂载点的路径
- * @param tv 实践
+ * @param tv 访问时间与修改时间，tv_nsec为UTIME_NOW时取当前时间，为UTIME_OMIT时不修改
  * @return int 0成功，否则失败
  */
 int hitszfs_utimens(const char* path, const struct timespec tv[2]) {
-	(void)path;
-	return 0;
+	boolean is_find, is_root;
+	struct hitszfs_dentry* dentry;
+	struct hitszfs_inode*  inode;
+	time_t now = time(NULL);
+
+	HITSZFS_LOCK();
+	dentry = hitszfs_lookup(path, &is_find, &is_root);
+	if (!is_find || dentry->inode == NULL) {
+		HITSZFS_UNLOCK();
+		return -HITSZFS_ERROR_NOTFOUND;
+	}
+	inode = dentry->inode;
+	if (tv[0].tv_nsec != UTIME_OMIT) {
+		inode->atime = tv[0].tv_nsec == UTIME_NOW ? now : tv[0].tv_sec;
+	}
+	if (tv[1].tv_nsec != UTIME_OMIT) {
+		inode->mtime = tv[1].tv_nsec == UTIME_NOW ? now : tv[1].tv_sec;
+	}
+	inode->ctime = now;
+	hitszfs_mark_inode_dirty(inode, HITSZFS_FLAG_BUF_DIRTY);
+	HITSZFS_UNLOCK();
+	return HITSZFS_ERROR_NONE;
 }
 /******************************************************************************
 * SECTION: 选做函数实现
@@ -255,13 +366,36 @@ int hitszfs_utimens(const char* path, const struct timespec tv[2]) {
  * @param buf 写入的内容
  * @param size 写入的字节数
  * @param offset 相对文件的偏移
- * @param fi 可忽略
- * @return int 写入大小
+ * @param fi 文件信息，fh为open时创建的文件句柄
+ * @return int 写入大小，失败返回负值
  */
 int hitszfs_write(const char* path, const char* buf, size_t size, off_t offset,
 		        struct fuse_file_info* fi) {
-	/* 选做 */
-	return size;
+	struct fuse_bufvec src = FUSE_BUFVEC_INIT(size);
+
+	src.buf[0].mem = (void*)buf;
+	return hitszfs_write_buf(path, &src, offset, fi);
+}
+
+/**
+ * @brief 写入文件，启用splice时buf为FUSE管道上的fd，内容直接进入inode的缓存
+ * 
+ * @param path 相对于挂载点的路径
+ * @param buf 写入的内容
+ * @param offset 相对文件的偏移
+ * @param fi 文件信息，fh为open时创建的文件句柄
+ * @return int 写入大小，失败返回负值
+ */
+int hitszfs_write_buf(const char* path, struct fuse_bufvec* buf, off_t offset,
+		        struct fuse_file_info* fi) {
+	struct hitszfs_file_handle* fh = (struct hitszfs_file_handle*)(uintptr_t)fi->fh;
+	int ret;
+	(void)path;
+
+	HITSZFS_LOCK();
+	ret = hitszfs_file_write(fh->inode, buf, offset);
+	HITSZFS_UNLOCK();
+	return ret;
 }
 
 /**
@@ -271,13 +405,150 @@ int hitszfs_write(const char* path, const char* buf, size_t size, off_t offset,
  * @param buf 读取的内容
  * @param size 读取的字节数
  * @param offset 相对文件的偏移
- * @param fi 可忽略
+ * @param fi 文件信息，fh为open时创建的文件句柄
  * @return int 读取大小
  */
 int hitszfs_read(const char* path, char* buf, size_t size, off_t offset,
 		       struct fuse_file_info* fi) {
-	/* 选做 */
-	return size;			   
+	struct hitszfs_file_handle* fh = (struct hitszfs_file_handle*)(uintptr_t)fi->fh;
+	int ret;
+	(void)path;
+
+	HITSZFS_RDLOCK();
+	ret = hitszfs_file_read(fh, buf, size, offset);
+	HITSZFS_UNLOCK();
+	return ret;
+}
+
+/**
+ * @brief 读取文件，在锁内复制一份内容返回
+ * 
+ * libfuse在本函数返回、放锁之后才回复，镜像文件上的fd段届时可能已被释放给别的文件，
+ * 因此不返回fd段；直接splice数据块见低层接口的hitszfs_ll_read
+ * 
+ * @param path 相对于挂载点的路径
+ * @param bufp 输出，由libfuse释放
+ * @param size 读取的字节数
+ * @param offset 相对文件的偏移
+ * @param fi 文件信息，fh为open时创建的文件句柄
+ * @return int 0成功，否则失败
+ */
+int hitszfs_read_buf(const char* path, struct fuse_bufvec** bufp, size_t size, off_t offset,
+		       struct fuse_file_info* fi) {
+	struct hitszfs_file_handle* fh = (struct hitszfs_file_handle*)(uintptr_t)fi->fh;
+	int ret;
+	(void)path;
+
+	HITSZFS_RDLOCK();
+	ret = hitszfs_file_read_buf(fh, bufp, size, offset, FALSE);
+	HITSZFS_UNLOCK();
+	return ret;
+}
+
+/**
+ * @brief 创建符号链接，链接目标不超过HITSZFS_INLINE_SZ时内联在inode中
+ * 
+ * @param target 链接目标，原样保存
+ * @param path 相对于挂载点的路径
+ * @return int 0成功，否则失败
+ */
+int hitszfs_symlink(const char* target, const char* path) {
+	boolean is_find;
+	struct hitszfs_dentry* last_dentry;
+	struct hitszfs_dentry* dentry;
+	struct hitszfs_inode*  inode;
+	int    len = strlen(target);
+
+	if (len > HITSZFS_BLKS_SZ(HITSZFS_DATA_PER_FILE)) {
+		return -HITSZFS_ERROR_NAMETOOLONG;
+	}
+	HITSZFS_LOCK();
+	hitszfs_icache_shrink();
+	last_dentry = hitszfs_lookup_parent(path, &is_find);
+	if (last_dentry == NULL) {
+		HITSZFS_UNLOCK();
+		return -HITSZFS_ERROR_NOTFOUND;
+	}
+	if (is_find == TRUE) {
+		HITSZFS_UNLOCK();
+		return -HITSZFS_ERROR_EXISTS;
+	}
+	if (!HITSZFS_IS_DIR(last_dentry->inode)) {
+		HITSZFS_UNLOCK();
+		return -HITSZFS_ERROR_NOTDIR;
+	}
+
+	dentry = new_dentry(hitszfs_get_fname(path), HITSZFS_SYM_LINK);
+	dentry->parent = last_dentry;
+	inode = hitszfs_alloc_inode(dentry);
+	if (inode == NULL || hitszfs_reserve_data(inode, len) != HITSZFS_ERROR_NONE ||
+		hitszfs_alloc_dentry(last_dentry->inode, dentry) < 0) {
+		if (inode != NULL) {
+			hitszfs_drop_inode(inode);
+		}
+		hitszfs_free_dentry(dentry);
+		HITSZFS_UNLOCK();
+		return -HITSZFS_ERROR_NOSPACE;
+	}
+	memcpy(inode->data, target, len);
+	inode->size = len;
+	hitszfs_mark_inode_dirty(inode, HITSZFS_FLAG_BUF_DIRTY | HITSZFS_FLAG_DATA_DIRTY);
+	hitszfs_dcache_invalidate_neg();
+
+	HITSZFS_UNLOCK();
+	return HITSZFS_ERROR_NONE;
+}
+
+/**
+ * @brief 读取符号链接的目标
+ * 
+ * @param path 相对于挂载点的路径
+ * @param buf 输出，以'\0'结尾，过长时截断
+ * @param size buf大小
+ * @return int 0成功，否则失败
+ */
+int hitszfs_readlink(const char* path, char* buf, size_t size) {
+	boolean is_find, is_root;
+	struct hitszfs_dentry* dentry;
+	size_t len;
+
+	HITSZFS_RDLOCK();
+	dentry = hitszfs_lookup(path, &is_find, &is_root);
+	if (is_find == FALSE) {
+		HITSZFS_UNLOCK();
+		return -HITSZFS_ERROR_NOTFOUND;
+	}
+	if (!HITSZFS_IS_SYM_LINK(dentry->inode)) {
+		HITSZFS_UNLOCK();
+		return -HITSZFS_ERROR_INVAL;
+	}
+	len = (size_t)dentry->inode->size < size - 1 ? (size_t)dentry->inode->size : size - 1;
+	memcpy(buf, dentry->inode->data, len);
+	buf[len] = '\0';
+	HITSZFS_UNLOCK();
+	return HITSZFS_ERROR_NONE;
+}
+
+/**
+ * @brief 从父目录删除目录项并释放其inode，数据块和inode号归还位图
+ * 
+ * 文件或目录仍被打开时只从目录摘下，最后一次release/releasedir时再释放，
+ * 见hitszfs_icache_detach。默认挂载选项下FUSE会把打开中的文件先rename为.fuse_hidden*，
+ * 带hard_remove挂载时才会走到这里
+ * 
+ * @param dentry 调用者持写锁
+ * @return int 0成功，否则失败
+ */
+static int hitszfs_remove_dentry(struct hitszfs_dentry* dentry) {
+	int ret;
+
+	ret = hitszfs_dir_remove(hitszfs_dentry_inode(dentry->parent), dentry);
+	if (ret != HITSZFS_ERROR_NONE) {
+		return ret;
+	}
+	hitszfs_icache_detach(dentry);
+	hitszfs_dcache_invalidate_all();
+	return HITSZFS_ERROR_NONE;
 }
 
 /**
@@ -287,8 +558,23 @@ int hitszfs_read(const char* path, char* buf, size_t size, off_t offset,
  * @return int 0成功，否则失败
  */
 int hitszfs_unlink(const char* path) {
-	/* 选做 */
-	return 0;
+	boolean is_find, is_root;
+	struct hitszfs_dentry* dentry;
+	int ret;
+
+	HITSZFS_LOCK();
+	dentry = hitszfs_lookup(path, &is_find, &is_root);
+	if (is_find == FALSE) {
+		HITSZFS_UNLOCK();
+		return -HITSZFS_ERROR_NOTFOUND;
+	}
+	if (HITSZFS_IS_DIR(dentry->inode)) {
+		HITSZFS_UNLOCK();
+		return -HITSZFS_ERROR_ISDIR;
+	}
+	ret = hitszfs_remove_dentry(dentry);
+	HITSZFS_UNLOCK();
+	return ret;
 }
 
 /**
@@ -304,20 +590,101 @@ int hitszfs_unlink(const char* path) {
  * @return int 0成功，否则失败
  */
 int hitszfs_rmdir(const char* path) {
-	/* 选做 */
-	return 0;
+	boolean is_find, is_root;
+	struct hitszfs_dentry* dentry;
+	int ret;
+
+	HITSZFS_LOCK();
+	dentry = hitszfs_lookup(path, &is_find, &is_root);
+	if (is_find == FALSE) {
+		HITSZFS_UNLOCK();
+		return -HITSZFS_ERROR_NOTFOUND;
+	}
+	if (is_root) {
+		HITSZFS_UNLOCK();
+		return -HITSZFS_ERROR_BUSY;
+	}
+	if (!HITSZFS_IS_DIR(dentry->inode)) {
+		HITSZFS_UNLOCK();
+		return -HITSZFS_ERROR_NOTDIR;
+	}
+	if (dentry->inode->dir_cnt != 0) {
+		HITSZFS_UNLOCK();
+		return -HITSZFS_ERROR_NOTEMPTY;
+	}
+	ret = hitszfs_remove_dentry(dentry);
+	HITSZFS_UNLOCK();
+	return ret;
 }
 
 /**
  * @brief 重命名文件 
  * 
+ * 不拷贝任何内容: 把源dentry从原目录摘下，改名后挂到目标目录，inode及其数据块不动。
+ * 目标已存在时先摘下目标，移动成功后按删除处理(仍被打开时推迟释放)，失败则全部挂回原处
+ * 
  * @param from 源文件路径
  * @param to 目标文件路径
  * @return int 0成功，否则失败
  */
 int hitszfs_rename(const char* from, const char* to) {
-	/* 选做 */
-	return 0;
+	boolean is_find, is_root;
+	struct hitszfs_dentry* src;
+	struct hitszfs_dentry* dst;
+	struct hitszfs_dentry* new_parent;
+	char*  parent_path;
+	int    ret;
+
+	HITSZFS_LOCK();
+	src = hitszfs_lookup(from, &is_find, &is_root);
+	if (is_find == FALSE || is_root) {
+		HITSZFS_UNLOCK();
+		return is_find ? -HITSZFS_ERROR_BUSY : -HITSZFS_ERROR_NOTFOUND;
+	}
+	dst = hitszfs_lookup(to, &is_find, &is_root);
+	if (is_root) {
+		HITSZFS_UNLOCK();
+		return -HITSZFS_ERROR_BUSY;
+	}
+	if (!is_find) {
+		dst = NULL;
+	}
+	else if (dst == src) {
+		HITSZFS_UNLOCK();
+		return HITSZFS_ERROR_NONE;
+	}
+	else if (HITSZFS_IS_DIR(src->inode) != HITSZFS_IS_DIR(dst->inode)) {
+		HITSZFS_UNLOCK();
+		return HITSZFS_IS_DIR(dst->inode) ? -HITSZFS_ERROR_ISDIR : -HITSZFS_ERROR_NOTDIR;
+	}
+	else if (HITSZFS_IS_DIR(dst->inode) && dst->inode->dir_cnt != 0) {
+		HITSZFS_UNLOCK();
+		return -HITSZFS_ERROR_NOTEMPTY;
+	}
+
+	parent_path = strdup(to);							/* 目标所在目录须存在 */
+	*(hitszfs_get_fname(parent_path) - 1) = '\0';
+	new_parent  = hitszfs_lookup(parent_path[0] == '\0' ? "/" : parent_path, &is_find, &is_root);
+	free(parent_path);
+	if (is_find == FALSE) {
+		HITSZFS_UNLOCK();
+		return -HITSZFS_ERROR_NOTFOUND;
+	}
+	if (!HITSZFS_IS_DIR(new_parent->inode)) {
+		HITSZFS_UNLOCK();
+		return -HITSZFS_ERROR_NOTDIR;
+	}
+	ret = hitszfs_dir_rename(src, new_parent->inode, hitszfs_get_fname(to), dst);
+	if (ret != HITSZFS_ERROR_NONE) {
+		HITSZFS_UNLOCK();
+		return ret;
+	}
+	if (dst != NULL) {
+		hitszfs_icache_detach(dst);
+	}
+	hitszfs_dcache_invalidate_all();
+	HITSZFS_UNLOCK();
+	return HITSZFS_ERROR_NONE;
 }
 
 /**
@@ -329,8 +696,42 @@ int hitszfs_rename(const char* from, const char* to) {
  * @return int 0成功，否则失败
  */
 int hitszfs_open(const char* path, struct fuse_file_info* fi) {
-	/* 选做 */
-	return 0;
+	boolean is_find, is_root;
+	struct hitszfs_dentry* dentry;
+
+	HITSZFS_RDLOCK();
+	dentry = hitszfs_lookup(path, &is_find, &is_root);
+	if (!is_find || dentry->inode == NULL) {
+		HITSZFS_UNLOCK();
+		return -HITSZFS_ERROR_NOTFOUND;
+	}
+	__atomic_add_fetch(&dentry->inode->ref, 1, __ATOMIC_RELAXED);	/* 打开期间inode不会被淘汰 */
+	fi->fh = (uint64_t)(uintptr_t)hitszfs_file_open(dentry->inode);
+	fi->keep_cache = hitszfs_options.kernel_cache;	/* 内容只经由本挂载点修改，页缓存不会过期 */
+	HITSZFS_UNLOCK();
+	return HITSZFS_ERROR_NONE;
+}
+
+/**
+ * @brief 关闭文件，释放文件句柄与open时持有的inode引用
+ * 
+ * @param path 相对于挂载点的路径
+ * @param fi 文件信息，fh为open时创建的文件句柄
+ * @return int 0成功，否则失败
+ */
+int hitszfs_release(const char* path, struct fuse_file_info* fi) {
+	struct hitszfs_file_handle* fh = (struct hitszfs_file_handle*)(uintptr_t)fi->fh;
+	struct hitszfs_inode* inode;
+	(void)path;
+
+	if (fh != NULL) {									/* 已删除的文件在最后一次release时释放 */
+		inode = fh->inode;
+		hitszfs_file_close(fh);
+		hitszfs_icache_unref(inode, &inode->ref, 1);
+	}
+	fi->fh = 0;
+	hitszfs_icache_balance();
+	return HITSZFS_ERROR_NONE;
 }
 
 /**
@@ -341,8 +742,45 @@ int hitszfs_open(const char* path, struct fuse_file_info* fi) {
  * @return int 0成功，否则失败
  */
 int hitszfs_opendir(const char* path, struct fuse_file_info* fi) {
-	/* 选做 */
-	return 0;
+	boolean is_find, is_root;
+	struct hitszfs_dentry* dentry;
+
+	HITSZFS_RDLOCK();
+	dentry = hitszfs_lookup(path, &is_find, &is_root);
+	if (!is_find) {
+		HITSZFS_UNLOCK();
+		return -HITSZFS_ERROR_NOTFOUND;
+	}
+	if (!HITSZFS_IS_DIR(dentry->inode)) {
+		HITSZFS_UNLOCK();
+		return -HITSZFS_ERROR_NOTDIR;
+	}
+	__atomic_add_fetch(&dentry->inode->ref, 1, __ATOMIC_RELAXED);	/* readdir直接使用fh，不再查找路径 */
+	fi->fh = (uint64_t)(uintptr_t)hitszfs_dir_open(dentry->inode);
+	HITSZFS_UNLOCK();
+	return HITSZFS_ERROR_NONE;
+}
+
+/**
+ * @brief 关闭目录，释放目录句柄及opendir时持有的inode引用
+ * 
+ * @param path 相对于挂载点的路径
+ * @param fi 文件信息
+ * @return int 0成功，否则失败
+ */
+int hitszfs_releasedir(const char* path, struct fuse_file_info* fi) {
+	struct hitszfs_dir_handle* dh = (struct hitszfs_dir_handle*)(uintptr_t)fi->fh;
+	struct hitszfs_inode*      inode;
+	(void)path;
+
+	if (dh != NULL) {
+		inode = dh->inode;
+		hitszfs_dir_close(dh);
+		hitszfs_icache_unref(inode, &inode->ref, 1);
+	}
+	fi->fh = 0;
+	hitszfs_icache_balance();
+	return HITSZFS_ERROR_NONE;
 }
 
 /**
@@ -353,8 +791,23 @@ int hitszfs_opendir(const char* path, struct fuse_file_info* fi) {
  * @return int 0成功，否则失败
  */
 int hitszfs_truncate(const char* path, off_t offset) {
-	/* 选做 */
-	return 0;
+	boolean is_find, is_root;
+	struct hitszfs_dentry* dentry;
+	int ret;
+
+	HITSZFS_LOCK();
+	dentry = hitszfs_lookup(path, &is_find, &is_root);
+	if (!is_find || dentry->inode == NULL) {
+		HITSZFS_UNLOCK();
+		return -HITSZFS_ERROR_NOTFOUND;
+	}
+	if (!HITSZFS_IS_REG(dentry->inode)) {
+		HITSZFS_UNLOCK();
+		return HITSZFS_IS_DIR(dentry->inode) ? -HITSZFS_ERROR_ISDIR : -HITSZFS_ERROR_INVAL;
+	}
+	ret = hitszfs_file_truncate(dentry->inode, offset);
+	HITSZFS_UNLOCK();
+	return ret;
 }
 
 
@@ -371,9 +824,128 @@ int hitszfs_truncate(const char* path, off_t offset) {
  * @return int 0成功，否则失败
  */
 int hitszfs_access(const char* path, int type) {
-	/* 选做: 解析路径，判断是否存在 */
-	return 0;
+	boolean is_find, is_root;
+	(void)type;											/* 权限固定为HITSZFS_DEFAULT_PERM，只需判断是否存在 */
+
+	HITSZFS_RDLOCK();
+	hitszfs_lookup(path, &is_find, &is_root);
+	HITSZFS_UNLOCK();
+	hitszfs_icache_balance();
+	return is_find ? HITSZFS_ERROR_NONE : -HITSZFS_ERROR_NOTFOUND;
 }	
+
+/**
+ * @brief ioctl，目前支持HITSZFS_IOC_STATS读取运行统计(dcache命中率等)，
+ * HITSZFS_IOC_DEFRAG整理path(目录时为整棵子树)并返回整理结果
+ * 
+ * @param path 相对于挂载点的路径
+ * @param cmd 命令号
+ * @param arg 可忽略
+ * @param fi 可忽略
+ * @param flags 可忽略
+ * @param data 输入输出数据
+ * @return int 0成功，否则失败
+ */
+int hitszfs_ioctl(const char* path, int cmd, void* arg, struct fuse_file_info* fi, 
+				  unsigned int flags, void* data) {
+	boolean is_find, is_root;
+	struct hitszfs_dentry* dentry;
+	struct hitszfs_defrag_report rep;
+	int ret;
+	(void)arg;
+	(void)fi;
+	(void)flags;
+	switch ((unsigned int)cmd)
+	{
+	case HITSZFS_IOC_STATS:
+		HITSZFS_RDLOCK();
+		memcpy(data, &hitszfs_stats, sizeof(struct hitszfs_stats));
+		HITSZFS_UNLOCK();
+		return HITSZFS_ERROR_NONE;
+	case HITSZFS_IOC_DEFRAG:
+		memset(&rep, 0, sizeof(struct hitszfs_defrag_report));
+		HITSZFS_LOCK();
+		dentry = hitszfs_lookup(path, &is_find, &is_root);
+		if (is_find == FALSE) {
+			HITSZFS_UNLOCK();
+			return -HITSZFS_ERROR_NOTFOUND;
+		}
+		ret = hitszfs_defrag_tree(hitszfs_dentry_inode(dentry), &rep);
+		HITSZFS_UNLOCK();
+		memcpy(data, &rep, sizeof(struct hitszfs_defrag_report));
+		return ret;
+	default:
+		return -HITSZFS_ERROR_INVAL;
+	}
+}
+
+/**
+ * @brief 回写单个文件的脏数据与元数据（以及脏位图）
+ * 
+ * 每次close都会调用，先持读锁检查，文件和位图都不脏时不必取写锁
+ * 
+ * @param path 相对于挂载点的路径
+ * @return int 0成功，否则失败
+ */
+static int hitszfs_sync_path(const char* path, struct fuse_file_info* fi) {
+	boolean is_find, is_root;
+	boolean is_clean;
+	struct hitszfs_dentry* dentry;
+	struct hitszfs_inode*  inode = fi != NULL && fi->fh != 0 ? 
+								   ((struct hitszfs_file_handle*)(uintptr_t)fi->fh)->inode : NULL;
+	int ret;
+
+	HITSZFS_RDLOCK();
+	if (inode == NULL) {								/* 已打开的文件直接使用fh中的inode */
+		dentry = hitszfs_lookup(path, &is_find, &is_root);
+		is_clean = is_find && dentry->inode->flags == 0;
+	}
+	else {
+		is_clean = inode->flags == 0;
+	}
+	is_clean = is_clean && !(hitszfs_super.flags & HITSZFS_FLAG_BUF_DIRTY);
+	HITSZFS_UNLOCK();
+	if (is_clean) {
+		return HITSZFS_ERROR_NONE;
+	}
+
+	HITSZFS_LOCK();
+	if (inode == NULL) {
+		dentry = hitszfs_lookup(path, &is_find, &is_root);
+		if (is_find == FALSE) {
+			HITSZFS_UNLOCK();
+			return -HITSZFS_ERROR_NOTFOUND;
+		}
+		inode = dentry->inode;
+	}
+	ret = hitszfs_sync_inode(inode);
+	HITSZFS_UNLOCK();
+	return ret;
+}
+
+/**
+ * @brief 关闭文件时调用(每个close都会触发)，回写该文件
+ * 
+ * @param path 相对于挂载点的路径
+ * @param fi 文件信息
+ * @return int 0成功，否则失败
+ */
+int hitszfs_flush(const char* path, struct fuse_file_info* fi) {
+	return hitszfs_sync_path(path, fi);
+}
+
+/**
+ * @brief 同步文件，只回写该文件对应的inode
+ * 
+ * @param path 相对于挂载点的路径
+ * @param datasync 非0时只需同步数据，这里一并回写元数据
+ * @param fi 文件信息
+ * @return int 0成功，否则失败
+ */
+int hitszfs_fsync(const char* path, int datasync, struct fuse_file_info* fi) {
+	(void)datasync;
+	return hitszfs_sync_path(path, fi);
+}
 /******************************************************************************
 * SECTION: FUSE入口
 *******************************************************************************/
@@ -381,11 +953,25 @@ int main(int argc, char **argv)
 {
     int ret;
 	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+	char  timeouts[64];
 
 	hitszfs_options.device = strdup("/home/students/200111205/ddriver");
+	hitszfs_options.blk_sz          = HITSZFS_DEFAULT_BLK_SZ;
+	hitszfs_options.bytes_per_inode = HITSZFS_DEFAULT_BPI;
+	hitszfs_options.journal_blks    = HITSZFS_DEFAULT_JOURNAL_BLKS;
+	hitszfs_options.inode_cache = HITSZFS_DEFAULT_INODE_CACHE;
+	hitszfs_options.dirty_age   = HITSZFS_DEFAULT_DIRTY_AGE;
+	hitszfs_options.dirty_ratio = HITSZFS_DEFAULT_DIRTY_RATIO;
+	hitszfs_options.readahead   = HITSZFS_DEFAULT_READAHEAD;
+	hitszfs_options.kernel_cache = TRUE;
 
 	if (fuse_opt_parse(&args, &hitszfs_options, option_spec, NULL) == -1)
 		return -1;
+	/* 默认的缓存时间放在最前面，命令行中的-o entry_timeout/attr_timeout在后面解析，可以覆盖 */
+	snprintf(timeouts, sizeof(timeouts), "-oentry_timeout=%d,attr_timeout=%d",
+			 HITSZFS_DEFAULT_TIMEOUT, HITSZFS_DEFAULT_TIMEOUT);
+	if (fuse_opt_insert_arg(&args, 1, timeouts) == -1)
+		return -1;
 	
 	ret = fuse_main(args.argc, args.argv, &operations, NULL);
 	fuse_opt_free_args(&args);
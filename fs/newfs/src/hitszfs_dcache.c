@@ -0,0 +1,216 @@
+#include "../include/hitszfs.h"
+
+/******************************************************************************
+* SECTION: 全局目录项缓存 (dcache)
+* 
+* 以完整路径为键缓存hitszfs_lookup的结果，重复的getattr只需一次哈希探测。
+* 查找失败的结果也会缓存(负缓存)，记录最后匹配的目录，供mknod/mkdir直接使用。
+* 
+* 失效采用代数: 正缓存项在gen变化后失效，负缓存项在neg_gen变化后失效。
+* 创建文件只需使所有负缓存失效；删除、重命名使全部缓存失效。
+* 每个桶最多缓存HITSZFS_DCACHE_CHAIN_MAX项，超出时淘汰链尾。
+* 
+* 并发: 查找不加锁，插入持dcache_lock并在修改前后各递增一次顺序计数(seqlock)。
+* 读者在计数为奇数或前后不一致时重试，多次失败后加锁查找。缓存项从专用slab分配，
+* 内存在卸载前不会归还，读者即使读到刚被释放复用的项也不会越界。
+* 失效只发生在持命名空间写锁时，此时没有并发的读者。
+*******************************************************************************/
+static struct hitszfs_dcache_entry* dcache[HITSZFS_DCACHE_BUCKETS];
+static uint32_t                     dcache_gen     = 0;
+static uint32_t                     dcache_neg_gen = 0;
+static uint32_t                     dcache_seq     = 0;
+static pthread_mutex_t              dcache_lock    = PTHREAD_MUTEX_INITIALIZER;
+static struct hitszfs_slab          dcache_slab;
+static uint64_t                     dcache_live;
+
+static boolean hitszfs_dcache_valid(struct hitszfs_dcache_entry* entry) 
+{
+    return entry->is_find ? entry->gen == dcache_gen : entry->gen == dcache_neg_gen;
+}
+
+static boolean hitszfs_dcache_match(struct hitszfs_dcache_entry* entry, const char* path, 
+                                    int len, uint32_t hash) 
+{
+    int entry_len = entry->len;                       /* 无锁读者读到的len可能来自被复用的项 */
+    return entry->hash == hash && entry_len == len && len < HITSZFS_DCACHE_PATH_LEN && 
+           memcmp(entry->path, path, len) == 0;
+}
+/**
+ * @brief 在一个桶中查找，最多走HITSZFS_DCACHE_CHAIN_MAX步
+ * 
+ * @return struct hitszfs_dcache_entry* 
+ */
+static struct hitszfs_dcache_entry* hitszfs_dcache_walk(const char* path, int len, uint32_t hash) 
+{
+    struct hitszfs_dcache_entry* entry = __atomic_load_n(&dcache[hash & (HITSZFS_DCACHE_BUCKETS - 1)], 
+                                                         __ATOMIC_ACQUIRE);
+    int                          depth;
+
+    for (depth = 0; entry != NULL && depth < HITSZFS_DCACHE_CHAIN_MAX; depth++)
+    {
+        if (hitszfs_dcache_match(entry, path, len, hash) && hitszfs_dcache_valid(entry)) {
+            return entry;
+        }
+        entry = __atomic_load_n(&entry->next, __ATOMIC_ACQUIRE);
+    }
+    return NULL;
+}
+/**
+ * @brief 初始化dcache，挂载时调用
+ * 
+ */
+void hitszfs_dcache_init() 
+{
+    memset(dcache, 0, sizeof(dcache));
+    hitszfs_slab_init(&dcache_slab, "dcache", sizeof(struct hitszfs_dcache_entry), &dcache_live);
+}
+/**
+ * @brief 在dcache中查找路径
+ * 
+ * @param path 
+ * @param is_find 
+ * @param is_root 
+ * @return struct hitszfs_dentry* 未命中返回NULL
+ */
+struct hitszfs_dentry* hitszfs_dcache_lookup(const char* path, boolean* is_find, boolean* is_root) 
+{
+    uint32_t                     hash = hitszfs_name_hash(path);
+    int                          len  = strlen(path);
+    struct hitszfs_dcache_entry* entry;
+    struct hitszfs_dentry*       dentry = NULL;
+    boolean                      find = FALSE, root = FALSE;
+    uint32_t                     seq;
+    int                          retry;
+
+    if (len >= HITSZFS_DCACHE_PATH_LEN) {
+        HITSZFS_STAT_INC(dcache_misses);
+        return NULL;
+    }
+    for (retry = 0; retry < HITSZFS_DCACHE_RETRY; retry++)
+    {
+        seq = __atomic_load_n(&dcache_seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {                                /* 有写者正在修改 */
+            HITSZFS_STAT_INC(dcache_retries);
+            continue;
+        }
+        entry = hitszfs_dcache_walk(path, len, hash);
+        if (entry != NULL) {
+            find   = entry->is_find;
+            root   = entry->is_root;
+            dentry = entry->dentry;
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&dcache_seq, __ATOMIC_RELAXED) == seq) {
+            break;
+        }
+        HITSZFS_STAT_INC(dcache_retries);
+        dentry = NULL;
+    }
+    if (retry == HITSZFS_DCACHE_RETRY) 
+    {                                                 /* 插入过于频繁，加锁查找 */
+        pthread_mutex_lock(&dcache_lock);
+        entry = hitszfs_dcache_walk(path, len, hash);
+        if (entry != NULL) {
+            find   = entry->is_find;
+            root   = entry->is_root;
+            dentry = entry->dentry;
+        }
+        pthread_mutex_unlock(&dcache_lock);
+    }
+    if (dentry == NULL) {
+        HITSZFS_STAT_INC(dcache_misses);
+        return NULL;
+    }
+    *is_find = find;
+    *is_root = root;
+    if (find) {
+        HITSZFS_STAT_INC(dcache_hits);
+    }
+    else {
+        HITSZFS_STAT_INC(dcache_neg_hits);
+    }
+    return dentry;
+}
+/**
+ * @brief 将hitszfs_lookup的结果加入dcache，过长的路径不缓存
+ * 
+ * @param path 
+ * @param dentry 
+ * @param is_find 
+ * @param is_root 
+ */
+void hitszfs_dcache_insert(const char* path, struct hitszfs_dentry* dentry, boolean is_find, boolean is_root) 
+{
+    uint32_t                      hash = hitszfs_name_hash(path);
+    int                           len  = strlen(path);
+    struct hitszfs_dcache_entry** pprev;
+    struct hitszfs_dcache_entry*  entry;
+    struct hitszfs_dcache_entry*  victim;
+    int                           depth = 0;
+
+    if (len >= HITSZFS_DCACHE_PATH_LEN) {
+        return;
+    }
+    pthread_mutex_lock(&dcache_lock);
+    entry = (struct hitszfs_dcache_entry*)hitszfs_slab_alloc(&dcache_slab);
+    if (entry == NULL) {
+        pthread_mutex_unlock(&dcache_lock);
+        return;
+    }
+    memcpy(entry->path, path, len + 1);
+    entry->len     = len;
+    entry->hash    = hash;
+    entry->gen     = is_find ? dcache_gen : dcache_neg_gen;
+    entry->is_find = is_find;
+    entry->is_root = is_root;
+    entry->dentry  = dentry;
+
+    __atomic_fetch_add(&dcache_seq, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    pprev          = &dcache[hash & (HITSZFS_DCACHE_BUCKETS - 1)];
+    entry->next    = *pprev;
+    __atomic_store_n(pprev, entry, __ATOMIC_RELEASE);
+                                                      /* 顺带清理同路径的旧项、失效项和超长部分 */
+    pprev = &entry->next;
+    while (*pprev != NULL)
+    {
+        victim = *pprev;
+        if (++depth >= HITSZFS_DCACHE_CHAIN_MAX || !hitszfs_dcache_valid(victim) || 
+            hitszfs_dcache_match(victim, path, len, hash)) {
+            __atomic_store_n(pprev, victim->next, __ATOMIC_RELEASE);
+            hitszfs_slab_free(&dcache_slab, victim);
+            continue;
+        }
+        pprev = &victim->next;
+    }
+    __atomic_fetch_add(&dcache_seq, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&dcache_lock);
+}
+/**
+ * @brief 使全部负缓存失效，创建文件或目录后调用
+ * 
+ */
+void hitszfs_dcache_invalidate_neg() 
+{
+    dcache_neg_gen++;
+    HITSZFS_STAT_INC(dcache_invalidations);
+}
+/**
+ * @brief 使全部缓存失效，删除或重命名后调用
+ * 
+ */
+void hitszfs_dcache_invalidate_all() 
+{
+    dcache_gen++;
+    dcache_neg_gen++;
+    HITSZFS_STAT_INC(dcache_invalidations);
+}
+/**
+ * @brief 释放dcache，卸载时调用
+ * 
+ */
+void hitszfs_dcache_destroy() 
+{
+    memset(dcache, 0, sizeof(dcache));
+    hitszfs_slab_destroy(&dcache_slab);
+}
@@ -14,15 +14,15 @@ void hitszfs_dump_map(int option) {
         printf("inode位图:\n");
         map = hitszfs_super.map_inode;
         // blks = hitszfs_super.map_inode_blks;
-        bytes = HITSZFS_MAX_INO() / UINT8_BITS;
+        bytes = HITSZFS_MAP_INODE_SZ();
     }else{// data位图
         printf("数据位图:\n");
         map = hitszfs_super.map_data;
         // blks = hitszfs_super.map_data_blks;
-        bytes = HITSZFS_MAX_DATA() / UINT8_BITS;
+        bytes = HITSZFS_MAP_DATA_SZ();
     }
 
-    for (byte_cursor = 0; byte_cursor < bytes; 
+    for (byte_cursor = 0; byte_cursor + 3 < bytes; 
          byte_cursor+=4)
     {
         for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++) {
@@ -45,4 +45,53 @@ void hitszfs_dump_map(int option) {
         }
         printf("\n");
     }
-}
\ No newline at end of file
+}
+/**
+ * @brief 打印运行统计
+ * 
+ */
+void hitszfs_dump_stats() {
+    printf("dcache: hits %llu, negative hits %llu, misses %llu, invalidations %llu, retries %llu\n",
+           (unsigned long long)hitszfs_stats.dcache_hits,
+           (unsigned long long)hitszfs_stats.dcache_neg_hits,
+           (unsigned long long)hitszfs_stats.dcache_misses,
+           (unsigned long long)hitszfs_stats.dcache_invalidations,
+           (unsigned long long)hitszfs_stats.dcache_retries);
+    printf("itable: reads %llu, hits %llu\n",
+           (unsigned long long)hitszfs_stats.itable_reads,
+           (unsigned long long)hitszfs_stats.itable_hits);
+    printf("objects: inodes %llu, dentries %llu, slab %llu bytes, inode evictions %llu\n",
+           (unsigned long long)hitszfs_stats.inodes_live,
+           (unsigned long long)hitszfs_stats.dentries_live,
+           (unsigned long long)hitszfs_stats.slab_bytes,
+           (unsigned long long)hitszfs_stats.inode_evictions);
+    printf("journal: commits %llu, blocks %llu, checkpoints %llu, replays %llu, splits %llu\n",
+           (unsigned long long)hitszfs_stats.journal_commits,
+           (unsigned long long)hitszfs_stats.journal_blocks,
+           (unsigned long long)hitszfs_stats.journal_checkpoints,
+           (unsigned long long)hitszfs_stats.journal_replays,
+           (unsigned long long)hitszfs_stats.journal_splits);
+    printf("readahead: windows %llu, block hits %llu\n",
+           (unsigned long long)hitszfs_stats.ra_windows,
+           (unsigned long long)hitszfs_stats.ra_hits);
+    printf("alloc: calls %llu, blocks %llu, delalloc dropped %llu\n",
+           (unsigned long long)hitszfs_stats.alloc_calls,
+           (unsigned long long)hitszfs_stats.alloc_blocks,
+           (unsigned long long)hitszfs_stats.delalloc_dropped);
+}
+
+void hitszfs_dump_layout() {
+    printf("block size %d B, %d group(s) x %d blocks\n",
+           hitszfs_super.sz_blk, hitszfs_super.group_cnt, hitszfs_super.blks_per_group);
+    printf("| Super(1) | Inode Map(%d) | DATA MaP(%d) | Inode(%d) | DATA(%d) |\n",
+           hitszfs_super.map_inode_blks, hitszfs_super.map_data_blks,
+           hitszfs_super.inode_blks,
+           hitszfs_super.data_per_group);
+    printf("inodes %d (%d per group, %d free), data blocks %d (%d free)\n",
+           hitszfs_super.max_ino, hitszfs_super.inodes_per_group, hitszfs_super.inode_free,
+           hitszfs_super.max_data, hitszfs_super.data_free);
+    if (HITSZFS_JOURNAL()) {
+        printf("journal %d blocks at offset %lld\n",
+               hitszfs_super.journal_blks, (long long)hitszfs_super.journal_offset);
+    }
+}
@@ -0,0 +1,169 @@
+#include "../include/hitszfs.h"
+
+/******************************************************************************
+* SECTION: 碎片整理
+*
+* 文件的数据块由位图逐块分配，长期增删改后同一文件的块可能散落在磁盘各处，
+* 读入时每一段都要一次寻道。整理时为数据块不连续的文件在data位图中找一段
+* 足够长的连续空闲区间，把内容(inode->data中的缓存)写到新位置，再更新inode并归还旧块。
+*
+* 任何时刻崩溃inode都指向完整的内容: 带日志时按ordered模式，新数据先直接写到新位置
+* (新位置仍有待检查点的日志块时随事务记日志)，再把inode与位图作为一个事务提交；
+* 不带日志时同样先写新位置的数据，再写inode与位图。旧块等提交之后才归还位图，此前内容不变。
+*
+* 节省的寻道数用ddriver的IOC_REQ_DEVICE_STATE实测: 迁移前后各按段读一遍文件，
+* 比较设备寻道计数的增量。
+*
+* 调用者持命名空间写锁。
+*******************************************************************************/
+/**
+ * @brief 文件数据块的段数(物理上连续的块为一段)
+ *
+ * @param inode
+ * @param blks 输出，数据块数
+ * @return int
+ */
+static int hitszfs_defrag_frags(struct hitszfs_inode* inode, int* blks)
+{
+    int frags = 0;
+    int i;
+
+    for (i = 0; i < HITSZFS_DATA_PER_FILE && inode->data_blk[i] >= 0; i++)
+    {
+        if (i == 0 || inode->data_blk[i] != inode->data_blk[i - 1] + 1) {
+            frags++;
+        }
+    }
+    *blks = i;
+    return frags;
+}
+/**
+ * @brief 按段读一遍文件的数据块，返回设备寻道计数的增量
+ *
+ * @param inode
+ * @param buf 至少HITSZFS_DATA_PER_FILE块
+ * @return int
+ */
+static int hitszfs_defrag_seeks(struct hitszfs_inode* inode, uint8_t* buf)
+{
+    struct ddriver_state before, after;
+    int                  i, run;
+
+    ddriver_ioctl(HITSZFS_DRIVER(), IOC_REQ_DEVICE_STATE, &before);
+    for (i = 0; i < HITSZFS_DATA_PER_FILE && inode->data_blk[i] >= 0; i += run)
+    {
+        for (run = 1; i + run < HITSZFS_DATA_PER_FILE &&
+             inode->data_blk[i + run] == inode->data_blk[i] + run; run++);
+        hitszfs_driver_read(HITSZFS_DATA_OFS(inode->data_blk[i]), buf, HITSZFS_BLKS_SZ(run));
+    }
+    ddriver_ioctl(HITSZFS_DRIVER(), IOC_REQ_DEVICE_STATE, &after);
+    return after.seek_cnt - before.seek_cnt;
+}
+/**
+ * @brief 整理一个文件: 数据块不连续时迁移到一段连续的空闲区间
+ *
+ * 目录、内联文件以及带有延迟分配块(回写时本就整段分配)的文件不处理；
+ * 找不到足够长的空闲区间时保持原样
+ *
+ * @param inode
+ * @param rep 累加整理结果
+ * @return int 0成功，否则失败
+ */
+int hitszfs_defrag_inode(struct hitszfs_inode* inode, struct hitszfs_defrag_report* rep)
+{
+    uint8_t* buf;
+    int      old_blk[HITSZFS_DATA_PER_FILE];
+    int      frags, blks, blk, i;
+    flag16   flags = HITSZFS_FLAG_BUF_DIRTY | HITSZFS_FLAG_DATA_DIRTY;
+
+    if (HITSZFS_IS_DIR(inode) || HITSZFS_IS_INLINE(inode)) {
+        return HITSZFS_ERROR_NONE;
+    }
+    for (i = 0; i < HITSZFS_DATA_PER_FILE; i++)
+    {
+        if (inode->data_blk[i] == HITSZFS_BLK_DELAY) {
+            return HITSZFS_ERROR_NONE;
+        }
+    }
+    frags = hitszfs_defrag_frags(inode, &blks);
+    rep->files++;
+    rep->frags_before += frags;
+    if (frags <= 1) {
+        rep->frags_after += frags;
+        return HITSZFS_ERROR_NONE;
+    }
+    rep->fragmented++;
+    if (hitszfs_file_fill(inode, 0, HITSZFS_DATA_PER_FILE - 1, FALSE) != HITSZFS_ERROR_NONE) {
+        return -HITSZFS_ERROR_IO;                     /* 要写到新位置的内容须已全部读入 */
+    }
+    blk = hitszfs_alloc_data_blks(blks);
+    if (blk < 0) {
+        rep->frags_after += frags;
+        return HITSZFS_ERROR_NONE;
+    }
+
+    buf = (uint8_t *)malloc(HITSZFS_BLKS_SZ(HITSZFS_DATA_PER_FILE));
+    rep->seeks_before += hitszfs_defrag_seeks(inode, buf);
+    if (!HITSZFS_JOURNAL())
+    {                                                 /* 不带日志: 新位置的数据先于inode落盘 */
+        if (hitszfs_driver_write(HITSZFS_DATA_OFS(blk), inode->data, HITSZFS_BLKS_SZ(blks)) != HITSZFS_ERROR_NONE) {
+            for (i = 0; i < blks; i++)
+            {
+                hitszfs_free_data_blk(blk + i);
+            }
+            free(buf);
+            return -HITSZFS_ERROR_IO;
+        }
+        flags = HITSZFS_FLAG_BUF_DIRTY;
+    }
+    for (i = 0; i < blks; i++)
+    {
+        old_blk[i]         = inode->data_blk[i];
+        inode->data_blk[i] = blk + i;
+    }
+    for (i = 0; i < blks; i++)
+    {
+        hitszfs_defer_free(inode, old_blk[i], FALSE);
+    }
+    hitszfs_mark_inode_dirty(inode, flags);
+    if (hitszfs_sync_inode(inode) != HITSZFS_ERROR_NONE) {
+        free(buf);
+        return -HITSZFS_ERROR_IO;
+    }
+    rep->seeks_after += hitszfs_defrag_seeks(inode, buf);
+    rep->frags_after += 1;
+    rep->moved++;
+    rep->blocks += blks;
+    free(buf);
+    return HITSZFS_ERROR_NONE;
+}
+/**
+ * @brief 整理inode及其下的整棵子树
+ *
+ * 遍历期间目录持有引用不会被淘汰，每处理完一项按缓存上限淘汰inode，
+ * 整理整个文件系统不会把所有inode留在内存中
+ *
+ * @param inode 文件或目录
+ * @param rep 累加整理结果
+ * @return int 0成功，否则失败
+ */
+int hitszfs_defrag_tree(struct hitszfs_inode* inode, struct hitszfs_defrag_report* rep)
+{
+    struct hitszfs_dentry* dentry;
+    struct hitszfs_inode*  child;
+    int                    ret;
+
+    if (!HITSZFS_IS_DIR(inode)) {
+        return hitszfs_defrag_inode(inode, rep);
+    }
+    ret = hitszfs_dir_load(inode);
+    __atomic_add_fetch(&inode->ref, 1, __ATOMIC_RELAXED);
+    for (dentry = inode->dentrys; ret == HITSZFS_ERROR_NONE && dentry != NULL; dentry = dentry->brother)
+    {
+        child = hitszfs_dentry_inode(dentry);
+        ret   = child == NULL ? -HITSZFS_ERROR_IO : hitszfs_defrag_tree(child, rep);
+        hitszfs_icache_shrink();
+    }
+    __atomic_sub_fetch(&inode->ref, 1, __ATOMIC_RELEASE);
+    return ret;
+}
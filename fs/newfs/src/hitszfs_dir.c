@@ -0,0 +1,840 @@
+#include "../include/hitszfs.h"
+
+/******************************************************************************
+* SECTION: 目录哈希索引
+* 
+* 每个目录在内存中维护一张以文件名哈希为键的哈希表以及槽位数组，
+* 查找目录项为O(1)，readdir按槽位顺序遍历。
+* 开启HITSZFS_FEATURE_DIR_INDEX后，目录额外带有一个磁盘索引块，保存按哈希排序的
+* (hash, pos)，目录项尚未读入内存时可只读索引块和目标目录项完成查找。
+*******************************************************************************/
+/**
+ * @brief 文件名哈希 (FNV-1a)
+ * 
+ * @param fname 
+ * @return uint32_t 
+ */
+uint32_t hitszfs_name_hash(const char* fname) 
+{
+    uint32_t hash = 2166136261u;
+    while (*fname != '\0')
+    {
+        hash ^= (uint8_t)*fname++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static struct hitszfs_dindex* hitszfs_dindex_get(struct hitszfs_inode* dir) 
+{
+    struct hitszfs_dindex* dindex = dir->dindex;
+    if (dindex == NULL) 
+    {
+        dindex           = (struct hitszfs_dindex*)malloc(sizeof(struct hitszfs_dindex));
+        dindex->nbuckets = HITSZFS_DINDEX_INIT_SZ;
+        dindex->buckets  = (struct hitszfs_dentry**)calloc(dindex->nbuckets, sizeof(struct hitszfs_dentry*));
+        dindex->cnt      = 0;
+        dindex->slots    = NULL;
+        dindex->nslots   = 0;
+        dir->dindex      = dindex;
+    }
+    return dindex;
+}
+/**
+ * @brief 桶数翻倍并重新散列
+ * 
+ * @param dindex 
+ */
+static void hitszfs_dindex_grow(struct hitszfs_dindex* dindex) 
+{
+    int                     nbuckets = dindex->nbuckets * 2;
+    struct hitszfs_dentry** buckets  = (struct hitszfs_dentry**)calloc(nbuckets, sizeof(struct hitszfs_dentry*));
+    struct hitszfs_dentry*  dentry;
+    struct hitszfs_dentry*  next;
+    int i;
+
+    for (i = 0; i < dindex->nbuckets; i++)
+    {
+        for (dentry = dindex->buckets[i]; dentry != NULL; dentry = next)
+        {
+            next              = dentry->hash_next;
+            dentry->hash_next = buckets[dentry->hash & (nbuckets - 1)];
+            buckets[dentry->hash & (nbuckets - 1)] = dentry;
+        }
+    }
+    free(dindex->buckets);
+    dindex->buckets  = buckets;
+    dindex->nbuckets = nbuckets;
+}
+/**
+ * @brief 将目录项挂到目录的子项链表，并加入哈希索引和槽位数组
+ * 
+ * @param dir 
+ * @param dentry 
+ */
+void hitszfs_dindex_insert(struct hitszfs_inode* dir, struct hitszfs_dentry* dentry) 
+{
+    struct hitszfs_dindex* dindex = hitszfs_dindex_get(dir);
+    int                    bucket;
+
+    dentry->brother  = dir->dentrys;
+    dentry->pbrother = &dir->dentrys;
+    if (dir->dentrys != NULL) {
+        dir->dentrys->pbrother = &dentry->brother;
+    }
+    dir->dentrys     = dentry;
+    if (dindex->cnt >= dindex->nbuckets) {
+        hitszfs_dindex_grow(dindex);
+    }
+    dentry->hash          = hitszfs_name_hash(dentry->fname);
+    bucket                = dentry->hash & (dindex->nbuckets - 1);
+    dentry->hash_next     = dindex->buckets[bucket];
+    dindex->buckets[bucket] = dentry;
+    dindex->cnt++;
+    hitszfs_dindex_place(dir, dentry);
+}
+/**
+ * @brief 将目录项放入槽位数组，slot为-1(变长格式下遍历序号尚未确定)时不放
+ * 
+ * @param dir 
+ * @param dentry 
+ */
+void hitszfs_dindex_place(struct hitszfs_inode* dir, struct hitszfs_dentry* dentry) 
+{
+    struct hitszfs_dindex* dindex = hitszfs_dindex_get(dir);
+
+    if (dentry->slot < 0) {
+        return;
+    }
+    if (dentry->slot >= dindex->nslots) 
+    {
+        int nslots = dindex->nslots == 0 ? HITSZFS_DINDEX_INIT_SZ : dindex->nslots;
+        while (nslots <= dentry->slot)
+        {
+            nslots *= 2;
+        }
+        dindex->slots = (struct hitszfs_dentry**)realloc(dindex->slots, nslots * sizeof(struct hitszfs_dentry*));
+        memset(dindex->slots + dindex->nslots, 0, (nslots - dindex->nslots) * sizeof(struct hitszfs_dentry*));
+        dindex->nslots = nslots;
+    }
+    dindex->slots[dentry->slot] = dentry;
+}
+/**
+ * @brief 将目录项从子项链表、哈希索引和槽位数组中摘除，与hitszfs_dindex_insert相反
+ * 
+ * @param dir 
+ * @param dentry 
+ */
+void hitszfs_dindex_remove(struct hitszfs_inode* dir, struct hitszfs_dentry* dentry) 
+{
+    struct hitszfs_dindex*  dindex = dir->dindex;
+    struct hitszfs_dentry** pprev;
+
+    *dentry->pbrother = dentry->brother;
+    if (dentry->brother != NULL) {
+        dentry->brother->pbrother = dentry->pbrother;
+    }
+    dentry->brother  = NULL;
+    dentry->pbrother = NULL;
+    if (dindex == NULL) {
+        return;
+    }
+    for (pprev = &dindex->buckets[dentry->hash & (dindex->nbuckets - 1)]; *pprev != NULL; 
+         pprev = &(*pprev)->hash_next)
+    {
+        if (*pprev == dentry) {
+            *pprev = dentry->hash_next;
+            dindex->cnt--;
+            break;
+        }
+    }
+    dentry->hash_next = NULL;
+    if (dentry->slot >= 0 && dentry->slot < dindex->nslots && dindex->slots[dentry->slot] == dentry) {
+        dindex->slots[dentry->slot] = NULL;
+    }
+}
+/**
+ * @brief 只在内存哈希索引中查找目录项，名字需完全相同
+ * 
+ * @param dir 
+ * @param fname 
+ * @return struct hitszfs_dentry* 
+ */
+struct hitszfs_dentry* hitszfs_dindex_find(struct hitszfs_inode* dir, const char* fname) 
+{
+    struct hitszfs_dentry* dentry;
+    uint32_t               hash;
+
+    if (dir->dindex == NULL) {
+        return NULL;
+    }
+    hash = hitszfs_name_hash(fname);
+    for (dentry = dir->dindex->buckets[hash & (dir->dindex->nbuckets - 1)]; dentry != NULL; 
+         dentry = dentry->hash_next)
+    {
+        if (dentry->hash == hash && strcmp(dentry->fname, fname) == 0) {
+            return dentry;
+        }
+    }
+    return NULL;
+}
+/**
+ * @brief 按槽位取目录项
+ * 
+ * @param dir 
+ * @param slot 
+ * @return struct hitszfs_dentry* 
+ */
+struct hitszfs_dentry* hitszfs_dindex_at(struct hitszfs_inode* dir, int slot) 
+{
+    if (dir->dindex == NULL || slot < 0 || slot >= dir->dindex->nslots) {
+        return NULL;
+    }
+    return dir->dindex->slots[slot];
+}
+/**
+ * @brief 将磁盘目录项解码为内存目录项并挂到目录下
+ * 
+ * @param dir 
+ * @param dentry_d 
+ * @param slot 
+ * @return struct hitszfs_dentry* 
+ */
+static struct hitszfs_dentry* hitszfs_dir_attach(struct hitszfs_inode* dir, 
+                                                 struct hitszfs_dentry_d* dentry_d, int slot) 
+{
+    struct hitszfs_dentry*  dentry;
+
+    dentry          = new_dentry(dentry_d->fname, dentry_d->ftype);
+    dentry->parent  = dir->dentry;
+    dentry->ino     = dentry_d->ino;
+    dentry->slot    = slot;
+    hitszfs_dindex_insert(dir, dentry);
+    return dentry;
+}
+/**
+ * @brief 从磁盘读入一个目录项并挂到目录下
+ * 
+ * @param dir 
+ * @param slot 
+ * @return struct hitszfs_dentry* 
+ */
+static struct hitszfs_dentry* hitszfs_dir_read_dentry(struct hitszfs_inode* dir, int slot) 
+{
+    struct hitszfs_dentry_d dentry_d;
+
+    if (hitszfs_driver_read(HITSZFS_DENTRY_OFS(dir, slot), (uint8_t *)&dentry_d, 
+                            sizeof(struct hitszfs_dentry_d)) != HITSZFS_ERROR_NONE) {
+        HITSZFS_DBG("[%s] io error\n", __func__);
+        return NULL;
+    }
+    return hitszfs_dir_attach(dir, &dentry_d, slot);
+}
+/**
+ * @brief 将目录尚未读入内存的目录项全部读入
+ * 每个目录块整块读一次，再逐项解码；子项的inode留到查找时才读入
+ * 
+ * @param dir 
+ * @return int 
+ */
+int hitszfs_dir_load(struct hitszfs_inode* dir) 
+{
+    struct hitszfs_dentry_d* dentrys_d;
+    struct hitszfs_dentry*   dentry;
+    uint8_t*                 blk;
+    int*                     inos;
+    int                      per_blk = HITSZFS_DENTRY_PER_BLK();
+    int                      loaded_blk = -1;
+    int                      slot;
+
+    if (dir->dentrys_loaded) {
+        return HITSZFS_ERROR_NONE;
+    }
+    if (HITSZFS_VAR_DENTRY()) {
+        return hitszfs_dirent_load(dir);
+    }
+    blk       = (uint8_t *)malloc(HITSZFS_BLK_SZ());
+    dentrys_d = (struct hitszfs_dentry_d *)blk;
+    inos      = (int *)malloc(sizeof(int) * (dir->dir_cnt + 1));
+    for (slot = 0; slot < dir->dir_cnt; slot++)
+    {
+        dentry = hitszfs_dindex_at(dir, slot);
+        if (dentry == NULL) {
+            if (slot / per_blk != loaded_blk) {         /* 同一目录块只读一次 */
+                loaded_blk = slot / per_blk;
+                if (hitszfs_driver_read(HITSZFS_DATA_OFS(dir->data_blk[loaded_blk]), blk, 
+                                        HITSZFS_BLK_SZ()) != HITSZFS_ERROR_NONE) {
+                    HITSZFS_DBG("[%s] io error\n", __func__);
+                    free(blk);
+                    free(inos);
+                    return -HITSZFS_ERROR_IO;
+                }
+            }
+            dentry = hitszfs_dir_attach(dir, &dentrys_d[slot % per_blk], slot);
+        }
+        inos[slot] = dentry->ino;
+    }
+    dir->dentrys_loaded = TRUE;
+    /* 遍历目录后通常紧接着逐个getattr，预先读入子项所在的inode表块 */
+    hitszfs_itable_readahead(inos, dir->dir_cnt);
+    free(blk);
+    free(inos);
+    return HITSZFS_ERROR_NONE;
+}
+/**
+ * @brief 借助磁盘索引块查找尚未读入的目录项，只读取索引块和命中的目录项
+ * 
+ * @param dir 
+ * @param fname 
+ * @return struct hitszfs_dentry* 
+ */
+static struct hitszfs_dentry* hitszfs_dx_lookup(struct hitszfs_inode* dir, const char* fname) 
+{
+    uint8_t*                 blk = (uint8_t*)malloc(HITSZFS_BLK_SZ());
+    struct hitszfs_dx_head*  head = (struct hitszfs_dx_head*)blk;
+    struct hitszfs_dx_entry* entries = (struct hitszfs_dx_entry*)(head + 1);
+    struct hitszfs_dentry*   dentry = NULL;
+    uint32_t                 hash = hitszfs_name_hash(fname);
+    int lo = 0, hi, mid;
+
+    if (hitszfs_driver_read(HITSZFS_DATA_OFS(dir->index_blk), blk, HITSZFS_BLK_SZ()) != HITSZFS_ERROR_NONE ||
+        head->magic != HITSZFS_DX_MAGIC || head->count < 0) {
+        free(blk);
+        hitszfs_dir_load(dir);
+        return hitszfs_dindex_find(dir, fname);
+    }
+    hi = head->count;
+    while (lo < hi)                                   /* 找到第一个 >= hash 的位置 */
+    {
+        mid = (lo + hi) / 2;
+        if (entries[mid].hash < hash) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    for (; lo < head->count && entries[lo].hash == hash; lo++)
+    {
+        if (HITSZFS_VAR_DENTRY()) {                   /* 变长格式下pos为字节偏移，只挂入命中的目录项 */
+            dentry = hitszfs_dirent_read(dir, entries[lo].pos, fname);
+            if (dentry != NULL) {
+                break;
+            }
+            continue;
+        }
+        if (hitszfs_dindex_at(dir, entries[lo].pos) != NULL) {
+            continue;                                 /* 已在内存中，且未命中 */
+        }
+        dentry = hitszfs_dir_read_dentry(dir, entries[lo].pos);
+        if (dentry != NULL && strcmp(dentry->fname, fname) == 0) {
+            break;
+        }
+        dentry = NULL;
+    }
+    free(blk);
+    return dentry;
+}
+/**
+ * @brief 在目录中查找名为fname的目录项
+ * 
+ * 先持目录的读锁在内存索引中查找，未命中且目录项未全部读入时改持写锁从磁盘读入
+ * 
+ * @param dir 
+ * @param fname 
+ * @return struct hitszfs_dentry* 
+ */
+struct hitszfs_dentry* hitszfs_dir_lookup(struct hitszfs_inode* dir, const char* fname) 
+{
+    struct hitszfs_dentry* dentry;
+
+    pthread_rwlock_rdlock(&dir->rwlock);
+    dentry = hitszfs_dindex_find(dir, fname);
+    if (dentry != NULL || dir->dentrys_loaded) {
+        pthread_rwlock_unlock(&dir->rwlock);
+        return dentry;
+    }
+    pthread_rwlock_unlock(&dir->rwlock);
+
+    pthread_rwlock_wrlock(&dir->rwlock);
+    dentry = hitszfs_dindex_find(dir, fname);         /* 等待写锁期间可能已被其他线程读入 */
+    if (dentry == NULL && !dir->dentrys_loaded) {
+        if (dir->index_blk != HITSZFS_BLK_NONE) {
+            dentry = hitszfs_dx_lookup(dir, fname);
+        }
+        else {
+            hitszfs_dir_load(dir);
+            dentry = hitszfs_dindex_find(dir, fname);
+        }
+    }
+    pthread_rwlock_unlock(&dir->rwlock);
+    return dentry;
+}
+/**
+ * @brief 从目录中删除目录项(不释放dentry本身)，rename时可再挂到其他目录下
+ *
+ * 槽位保持连续: 最后一个槽位的目录项搬到空出的槽位，定长格式下只需重写它所在的目录块，
+ * 最后一个目录块因此变空时归还；变长格式下在目录块中原地删除记录
+ *
+ * @param dir
+ * @param dentry
+ * @return int
+ */
+int hitszfs_dir_remove(struct hitszfs_inode* dir, struct hitszfs_dentry* dentry)
+{
+    struct hitszfs_dentry* last;
+    int                    per_blk = HITSZFS_DENTRY_PER_BLK();
+    int                    last_slot;
+    int                    blk_idx;
+
+    if (hitszfs_dir_load(dir) != HITSZFS_ERROR_NONE) {
+        return -HITSZFS_ERROR_IO;
+    }
+    last_slot = dir->dir_cnt - 1;
+    last      = hitszfs_dindex_at(dir, last_slot);
+    if (HITSZFS_VAR_DENTRY()) {
+        hitszfs_dirent_remove(dir, dentry);
+    }
+    hitszfs_dindex_remove(dir, dentry);
+    if (last != NULL && last != dentry)
+    {
+        dir->dindex->slots[last_slot] = NULL;
+        last->slot   = dentry->slot;
+        last->flags |= HITSZFS_FLAG_BUF_DIRTY;
+        hitszfs_dindex_place(dir, last);
+    }
+    dentry->slot = -1;
+    dir->dir_cnt--;
+    dir->mtime = dir->ctime = time(NULL);
+    blk_idx = last_slot / per_blk;
+    if (!HITSZFS_VAR_DENTRY() && last_slot % per_blk == 0 && blk_idx > 0 &&
+        dir->data_blk[blk_idx] != HITSZFS_BLK_NONE)
+    {
+        hitszfs_defer_free(dir, dir->data_blk[blk_idx], FALSE);
+        dir->data_blk[blk_idx] = HITSZFS_BLK_NONE;
+    }
+    hitszfs_mark_inode_dirty(dir, HITSZFS_FLAG_BUF_DIRTY | HITSZFS_FLAG_DENTRYS_DIRTY);
+    return HITSZFS_ERROR_NONE;
+}
+/**
+ * @brief 把src移到new_dir下并改名为fname，只重新挂接dentry，inode及其数据块不动
+ *
+ * dst为目标位置已有的目录项，先从new_dir摘下，由调用者在成功后释放其inode；
+ * 任一步失败时src和dst都挂回原处
+ *
+ * @param src
+ * @param new_dir
+ * @param fname
+ * @param dst 可为NULL
+ * @return int
+ */
+int hitszfs_dir_rename(struct hitszfs_dentry* src, struct hitszfs_inode* new_dir, const char* fname,
+                       struct hitszfs_dentry* dst)
+{
+    struct hitszfs_dentry* old_parent = src->parent;
+    struct hitszfs_dentry* cursor;
+    char*                  old_fname;
+    int                    ret;
+
+    for (cursor = new_dir->dentry; cursor != NULL; cursor = cursor->parent)
+    {                                                 /* 目录不能移动到自己的子树下 */
+        if (cursor == src) {
+            return -HITSZFS_ERROR_INVAL;
+        }
+    }
+    if (hitszfs_super.data_free <= hitszfs_super.data_delalloc) {
+        hitszfs_reclaim_frees(FALSE);                 /* 目标目录可能要新目录块，须在摘下任何目录项之前 */
+    }
+    if (dst != NULL && hitszfs_dir_remove(new_dir, dst) != HITSZFS_ERROR_NONE) {
+        return -HITSZFS_ERROR_IO;
+    }
+    old_fname = strdup(src->fname);
+    ret       = hitszfs_dir_remove(hitszfs_dentry_inode(old_parent), src);
+    if (ret == HITSZFS_ERROR_NONE)
+    {
+        hitszfs_dentry_set_fname(src, fname);
+        src->parent = new_dir->dentry;
+        ret = hitszfs_alloc_dentry(new_dir, src);
+        if (ret < 0)
+        {                                             /* 目标目录放不下，挂回原处 */
+            hitszfs_dentry_set_fname(src, old_fname);
+            src->parent = old_parent;
+            hitszfs_alloc_dentry(hitszfs_dentry_inode(old_parent), src);
+            ret = -HITSZFS_ERROR_NOSPACE;
+        }
+    }
+    free(old_fname);
+    if (ret < 0)
+    {
+        if (dst != NULL) {
+            hitszfs_alloc_dentry(new_dir, dst);
+        }
+        return ret;
+    }
+    if (src->inode != NULL) {
+        src->inode->ctime = time(NULL);
+        hitszfs_mark_inode_dirty(src->inode, HITSZFS_FLAG_BUF_DIRTY);
+    }
+    if (old_parent != new_dir->dentry)
+    {                                                 /* 摘下与挂上须在同一事务中提交 */
+        hitszfs_mark_inode_dirty(hitszfs_dentry_inode(old_parent), HITSZFS_FLAG_XRENAME);
+        hitszfs_mark_inode_dirty(new_dir, HITSZFS_FLAG_XRENAME);
+    }
+    return HITSZFS_ERROR_NONE;
+}
+
+static int hitszfs_dx_entry_cmp(const void* a, const void* b)
+{
+    uint32_t ha = ((const struct hitszfs_dx_entry*)a)->hash;
+    uint32_t hb = ((const struct hitszfs_dx_entry*)b)->hash;
+    return ha < hb ? -1 : (ha > hb ? 1 : 0);
+}
+/**
+ * @brief 重建目录的磁盘索引块并加入批次，目录项须已全部读入
+ * 
+ * @param dir 
+ * @param batch 
+ * @return int 
+ */
+int hitszfs_dx_stage(struct hitszfs_inode* dir, struct hitszfs_io_batch* batch) 
+{
+    uint8_t*                 blk;
+    struct hitszfs_dx_head*  head;
+    struct hitszfs_dx_entry* entries;
+    struct hitszfs_dentry*   dentry;
+    int                      cnt = 0;
+
+    if (!(hitszfs_super.features & HITSZFS_FEATURE_DIR_INDEX)) {
+        return HITSZFS_ERROR_NONE;
+    }
+    if (dir->index_blk == HITSZFS_BLK_NONE) 
+    {
+        dir->index_blk = hitszfs_alloc_data_blk();
+        if (dir->index_blk < 0) {
+            dir->index_blk = HITSZFS_BLK_NONE;        /* 没有空间时不建索引 */
+            return HITSZFS_ERROR_NONE;
+        }
+    }
+    blk     = (uint8_t*)malloc(HITSZFS_BLK_SZ());
+    memset(blk, 0, HITSZFS_BLK_SZ());
+    head    = (struct hitszfs_dx_head*)blk;
+    entries = (struct hitszfs_dx_entry*)(head + 1);
+    head->magic = HITSZFS_DX_MAGIC;
+    if (dir->dir_cnt > (int)HITSZFS_DX_PER_BLK()) {
+        head->count = -1;
+    }
+    else {
+        for (dentry = dir->dentrys; dentry != NULL; dentry = dentry->brother)
+        {
+            entries[cnt].hash = dentry->hash;
+            entries[cnt].pos  = HITSZFS_VAR_DENTRY() ? dentry->pos : dentry->slot;
+            cnt++;
+        }
+        qsort(entries, cnt, sizeof(struct hitszfs_dx_entry), hitszfs_dx_entry_cmp);
+        head->count = cnt;
+    }
+    hitszfs_batch_add(batch, HITSZFS_DATA_OFS(dir->index_blk), blk, HITSZFS_BLK_SZ());
+    free(blk);
+    return HITSZFS_ERROR_NONE;
+}
+
+/******************************************************************************
+* SECTION: 目录句柄
+* 
+* readdir按快照下标续读: offset为0时把目录项的(ino, 类型, 名字)拷贝为快照，
+* 之后的调用直接按下标填充，不再查找路径或遍历链表。
+* 删除目录项会把最后一个槽位搬到空位，按槽位续读会漏项，快照则不受影响。
+*******************************************************************************/
+/**
+ * @brief 创建目录句柄，快照在第一次readdir时生成
+ * 
+ * @param dir 
+ * @return struct hitszfs_dir_handle* 
+ */
+struct hitszfs_dir_handle* hitszfs_dir_open(struct hitszfs_inode* dir) 
+{
+    struct hitszfs_dir_handle* dh = (struct hitszfs_dir_handle*)calloc(1, sizeof(struct hitszfs_dir_handle));
+
+    dh->inode = dir;
+    return dh;
+}
+/**
+ * @brief 生成目录快照，目录项未读入时先持写锁读入
+ * 
+ * @param dh 
+ * @return int 
+ */
+int hitszfs_dir_snapshot(struct hitszfs_dir_handle* dh) 
+{
+    struct hitszfs_inode*  dir = dh->inode;
+    struct hitszfs_dentry* dentry;
+    int                    names_sz = 0;
+    int                    slot;
+
+    pthread_rwlock_rdlock(&dir->rwlock);
+    if (!dir->dentrys_loaded) 
+    {
+        pthread_rwlock_unlock(&dir->rwlock);
+        pthread_rwlock_wrlock(&dir->rwlock);
+        if (hitszfs_dir_load(dir) != HITSZFS_ERROR_NONE) {
+            pthread_rwlock_unlock(&dir->rwlock);
+            return -HITSZFS_ERROR_IO;
+        }
+    }
+    for (slot = 0; slot < dir->dir_cnt; slot++)
+    {
+        names_sz += strlen(hitszfs_dindex_at(dir, slot)->fname) + 1;
+    }
+    free(dh->ents);
+    free(dh->names);
+    dh->ents  = (struct hitszfs_dir_ent*)malloc(sizeof(struct hitszfs_dir_ent) * (dir->dir_cnt + 1));
+    dh->names = (char*)malloc(names_sz + 1);
+    dh->cnt   = dir->dir_cnt;
+    names_sz  = 0;
+    for (slot = 0; slot < dir->dir_cnt; slot++)
+    {
+        dentry                   = hitszfs_dindex_at(dir, slot);
+        dh->ents[slot].ino       = dentry->ino;
+        dh->ents[slot].ftype     = dentry->ftype;
+        dh->ents[slot].name_ofs  = names_sz;
+        strcpy(dh->names + names_sz, dentry->fname);
+        names_sz += strlen(dentry->fname) + 1;
+    }
+    pthread_rwlock_unlock(&dir->rwlock);
+    return HITSZFS_ERROR_NONE;
+}
+/**
+ * @brief 释放目录句柄及其快照
+ * 
+ * @param dh 
+ */
+void hitszfs_dir_close(struct hitszfs_dir_handle* dh) 
+{
+    free(dh->ents);
+    free(dh->names);
+    free(dh);
+}
+
+/******************************************************************************
+* SECTION: 变长目录项 (HITSZFS_FEATURE_VAR_DENTRY)
+* 
+* 目录块由首尾相接的hitszfs_dirent_d记录铺满，rec_len指向下一条记录。
+* 插入时复用记录尾部的空闲空间(切分)，删除时并入前一条记录，
+* 目录块镜像常驻inode->data，修改后按块标记dirty_blks写回。
+*******************************************************************************/
+/**
+ * @brief 把第blk_idx个目录块初始化为一条覆盖整块的空闲记录
+ * 
+ * @param dir 
+ * @param blk_idx 
+ */
+void hitszfs_dirent_init_blk(struct hitszfs_inode* dir, int blk_idx) 
+{
+    struct hitszfs_dirent_d* rec = HITSZFS_DIRENT_AT(dir, HITSZFS_BLKS_SZ(blk_idx));
+
+    memset(rec, 0, HITSZFS_BLK_SZ());
+    rec->ino      = -1;
+    rec->rec_len  = HITSZFS_BLK_SZ();
+    rec->name_len = 0;
+    dir->dirty_blks |= 1 << blk_idx;
+}
+/**
+ * @brief 读入目录的全部目录块并逐条解码，每块一次读
+ * 
+ * @param dir 
+ * @return int 
+ */
+int hitszfs_dirent_load(struct hitszfs_inode* dir) 
+{
+    struct hitszfs_dirent_d* rec;
+    struct hitszfs_dentry*   dentry;
+    char                     fname[MAX_NAME_LEN];
+    int*                     inos;
+    int                      cnt = 0;
+    int                      blk_idx, off;
+
+    if (dir->data == NULL) {
+        dir->data = (uint8_t *)calloc(HITSZFS_DATA_PER_FILE, HITSZFS_BLK_SZ());
+    }
+    inos = (int *)malloc(sizeof(int) * (dir->dir_cnt + 1));
+    for (blk_idx = 0; blk_idx < HITSZFS_DATA_PER_FILE; blk_idx++)
+    {
+        if (dir->data_blk[blk_idx] == HITSZFS_BLK_NONE) {
+            continue;
+        }
+        if (hitszfs_driver_read(HITSZFS_DATA_OFS(dir->data_blk[blk_idx]), dir->data + HITSZFS_BLKS_SZ(blk_idx), 
+                                HITSZFS_BLK_SZ()) != HITSZFS_ERROR_NONE) {
+            HITSZFS_DBG("[%s] io error\n", __func__);
+            free(inos);
+            return -HITSZFS_ERROR_IO;
+        }
+        for (off = 0; off < HITSZFS_BLK_SZ(); off += rec->rec_len)
+        {
+            rec = HITSZFS_DIRENT_AT(dir, HITSZFS_BLKS_SZ(blk_idx) + off);
+            if (rec->rec_len < sizeof(struct hitszfs_dirent_d) || off + rec->rec_len > HITSZFS_BLK_SZ()) {
+                HITSZFS_DBG("[%s] corrupted dirent at blk %d ofs %d\n", __func__, blk_idx, off);
+                free(inos);
+                return -HITSZFS_ERROR_IO;
+            }
+            if (rec->name_len == 0 || cnt >= dir->dir_cnt) {
+                continue;
+            }
+            memcpy(fname, rec->name, rec->name_len);
+            fname[rec->name_len] = '\0';
+            dentry = hitszfs_dindex_find(dir, fname);  /* 可能已由磁盘索引单独读入 */
+            if (dentry == NULL) {
+                dentry          = new_dentry(fname, (HITSZFS_FILE_TYPE)rec->ftype);
+                dentry->parent  = dir->dentry;
+                dentry->ino     = rec->ino;
+                dentry->pos     = HITSZFS_BLKS_SZ(blk_idx) + off;
+                dentry->slot    = cnt;
+                hitszfs_dindex_insert(dir, dentry);
+            }
+            else {
+                dentry->slot = cnt;
+                hitszfs_dindex_place(dir, dentry);
+            }
+            inos[cnt++] = dentry->ino;
+        }
+    }
+    dir->dentrys_loaded = TRUE;
+    hitszfs_itable_readahead(inos, cnt);
+    free(inos);
+    return HITSZFS_ERROR_NONE;
+}
+/**
+ * @brief 目录块尚未读入时，按字节偏移单独读一条记录，名字为fname时挂到目录下
+ * 
+ * @param dir 
+ * @param pos 
+ * @param fname 
+ * @return struct hitszfs_dentry* 
+ */
+struct hitszfs_dentry* hitszfs_dirent_read(struct hitszfs_inode* dir, int pos, const char* fname) 
+{
+    int                      blk_idx = pos / HITSZFS_BLK_SZ();
+    int                      off     = pos % HITSZFS_BLK_SZ();
+    int                      size    = sizeof(struct hitszfs_dirent_d) + MAX_NAME_LEN;
+    uint8_t*                 buf;
+    struct hitszfs_dirent_d* rec;
+    struct hitszfs_dentry*   dentry = NULL;
+
+    if (blk_idx >= HITSZFS_DATA_PER_FILE || dir->data_blk[blk_idx] == HITSZFS_BLK_NONE) {
+        return NULL;
+    }
+    if (off + size > HITSZFS_BLK_SZ()) {
+        size = HITSZFS_BLK_SZ() - off;
+    }
+    buf = (uint8_t *)malloc(size);
+    rec = (struct hitszfs_dirent_d *)buf;
+    if (hitszfs_driver_read(HITSZFS_DATA_OFS(dir->data_blk[blk_idx]) + off, buf, size) == HITSZFS_ERROR_NONE &&
+        rec->name_len != 0 && rec->name_len == strlen(fname) && 
+        memcmp(rec->name, fname, rec->name_len) == 0) {
+        dentry          = new_dentry((char *)fname, (HITSZFS_FILE_TYPE)rec->ftype);
+        dentry->parent  = dir->dentry;
+        dentry->ino     = rec->ino;
+        dentry->pos     = pos;
+        hitszfs_dindex_insert(dir, dentry);
+    }
+    free(buf);
+    return dentry;
+}
+/**
+ * @brief 在目录块中为dentry找一处空间写入记录，优先复用已有记录的尾部空闲，
+ * 都放不下时再分配新的目录块
+ * 
+ * @param dir 目录项须已全部读入
+ * @param dentry 
+ * @return int 
+ */
+int hitszfs_dirent_insert(struct hitszfs_inode* dir, struct hitszfs_dentry* dentry) 
+{
+    struct hitszfs_dirent_d* rec;
+    struct hitszfs_dirent_d* new_rec;
+    int                      name_len = strlen(dentry->fname);
+    int                      need     = HITSZFS_DIRENT_LEN(name_len);
+    int                      blk_idx, off, used = 0;
+    boolean                  found = FALSE;
+
+    for (blk_idx = 0; blk_idx < HITSZFS_DATA_PER_FILE; blk_idx++)
+    {
+        if (dir->data_blk[blk_idx] == HITSZFS_BLK_NONE) {
+            continue;
+        }
+        for (off = 0; off < HITSZFS_BLK_SZ(); off += rec->rec_len)
+        {
+            rec  = HITSZFS_DIRENT_AT(dir, HITSZFS_BLKS_SZ(blk_idx) + off);
+            used = rec->name_len == 0 ? 0 : HITSZFS_DIRENT_LEN(rec->name_len);
+            if (rec->rec_len - used >= need) {
+                found = TRUE;
+                break;
+            }
+        }
+        if (found) {
+            break;
+        }
+    }
+    if (!found) {                                     /* 已有目录块都放不下，分配新块 */
+        for (blk_idx = 0; blk_idx < HITSZFS_DATA_PER_FILE; blk_idx++)
+        {
+            if (dir->data_blk[blk_idx] == HITSZFS_BLK_NONE) {
+                break;
+            }
+        }
+        if (blk_idx == HITSZFS_DATA_PER_FILE) {
+            return -HITSZFS_ERROR_NOSPACE;
+        }
+        dir->data_blk[blk_idx] = hitszfs_alloc_data_blk();
+        if (dir->data_blk[blk_idx] < 0) {
+            dir->data_blk[blk_idx] = HITSZFS_BLK_NONE;
+            return -HITSZFS_ERROR_NOSPACE;
+        }
+        hitszfs_dirent_init_blk(dir, blk_idx);
+        off  = 0;
+        rec  = HITSZFS_DIRENT_AT(dir, HITSZFS_BLKS_SZ(blk_idx));
+        used = 0;
+    }
+    if (used == 0) {                                  /* 空闲记录，直接占用 */
+        new_rec = rec;
+    }
+    else {                                            /* 切分记录尾部的空闲空间 */
+        new_rec          = HITSZFS_DIRENT_AT(dir, HITSZFS_BLKS_SZ(blk_idx) + off + used);
+        new_rec->rec_len = rec->rec_len - used;
+        rec->rec_len     = used;
+    }
+    new_rec->ino      = dentry->ino;
+    new_rec->name_len = name_len;
+    new_rec->ftype    = dentry->ftype;
+    memcpy(new_rec->name, dentry->fname, name_len);
+    dentry->pos       = (uint8_t *)new_rec - dir->data;
+    dir->dirty_blks  |= 1 << blk_idx;
+    return HITSZFS_ERROR_NONE;
+}
+/**
+ * @brief 从目录块中删除dentry的记录: 并入同块的前一条记录，位于块首时标记为空闲
+ * 
+ * @param dir 目录项须已全部读入
+ * @param dentry 
+ */
+void hitszfs_dirent_remove(struct hitszfs_inode* dir, struct hitszfs_dentry* dentry) 
+{
+    int                      blk_idx = dentry->pos / HITSZFS_BLK_SZ();
+    int                      target  = dentry->pos % HITSZFS_BLK_SZ();
+    struct hitszfs_dirent_d* rec     = HITSZFS_DIRENT_AT(dir, dentry->pos);
+    struct hitszfs_dirent_d* prev    = NULL;
+    int                      off;
+
+    for (off = 0; off < target; off += prev->rec_len)
+    {
+        prev = HITSZFS_DIRENT_AT(dir, HITSZFS_BLKS_SZ(blk_idx) + off);
+    }
+    if (prev != NULL) {
+        prev->rec_len += rec->rec_len;
+    }
+    else {
+        rec->ino      = -1;
+        rec->name_len = 0;
+    }
+    dentry->pos      = -1;
+    dir->dirty_blks |= 1 << blk_idx;
+}
@@ -0,0 +1,515 @@
+#include "../include/hitszfs.h"
+
+/******************************************************************************
+* SECTION: 数据块按需读入与预读
+*
+* 读时只读入请求用到的块。顺序读按打开的文件(fi->fh)检测，参照Linux的按需预读:
+* 本次读从上次结束的位置开始，或落在最近一个预读窗口内，视为顺序读；读到窗口时
+* 把其后的一个窗口交给预读线程异步读入，窗口从HITSZFS_RA_INIT块起逐次翻倍，
+* 不超过options.readahead；随机读清除窗口，不再预读。
+*
+* 读入在命名空间读锁下进行，同一inode的读入由inode->rwlock串行，已读入的块不会再被改写；
+* 修改文件内容都持写锁，与读入互斥。预读请求排队期间持有inode引用，inode不会被淘汰。
+* 同一句柄上并发的读可能交错更新顺序读状态，只影响预读的效果。
+*******************************************************************************/
+static pthread_t              ra_worker;
+static pthread_mutex_t        ra_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t         ra_cond = PTHREAD_COND_INITIALIZER;
+static struct hitszfs_ra_req* ra_head = NULL;
+static struct hitszfs_ra_req* ra_tail = NULL;
+static boolean                ra_running = FALSE;
+static boolean                ra_stop    = FALSE;
+
+/**
+ * @brief 把文件第first..last块中尚未读入的块读入inode->data，调用者持读锁或写锁
+ *
+ * 物理上连续的块合并为一次读，空洞保持为0
+ *
+ * @param inode 普通文件或符号链接
+ * @param first
+ * @param last
+ * @param ra 为TRUE时是预读，读入的块记入inode->data_ra
+ * @return int 0成功，否则失败
+ */
+int hitszfs_file_fill(struct hitszfs_inode* inode, int first, int last, boolean ra)
+{
+    int   want = 0, miss, got = 0;
+    int   blk, i, run;
+    off_t ofs;
+    int   ret = HITSZFS_ERROR_NONE;
+
+    if (last >= HITSZFS_DATA_PER_FILE) {
+        last = HITSZFS_DATA_PER_FILE - 1;
+    }
+    for (i = first; i <= last; i++)
+    {
+        want |= 1 << i;
+    }
+    if ((__atomic_load_n(&inode->data_valid, __ATOMIC_ACQUIRE) & want) == want) {
+        return HITSZFS_ERROR_NONE;
+    }
+    pthread_rwlock_wrlock(&inode->rwlock);
+    miss = want & ~inode->data_valid;
+    for (i = first; i <= last && ret == HITSZFS_ERROR_NONE; i += run)
+    {
+        run = 1;
+        blk = inode->data_blk[i];
+        if (!(miss & (1 << i))) {
+            continue;
+        }
+        if (blk == HITSZFS_BLK_NONE || blk == HITSZFS_BLK_DELAY) {
+            got |= 1 << i;
+            continue;
+        }
+        ofs = HITSZFS_DATA_OFS(blk);
+        while (i + run <= last && (miss & (1 << (i + run))) && inode->data_blk[i + run] >= 0 &&
+               HITSZFS_DATA_OFS(inode->data_blk[i + run]) == ofs + HITSZFS_BLKS_SZ(run))
+        {
+            run++;
+        }
+        ret = hitszfs_driver_read(ofs, inode->data + HITSZFS_BLKS_SZ(i), HITSZFS_BLKS_SZ(run));
+        if (ret == HITSZFS_ERROR_NONE) {
+            got |= ((1 << run) - 1) << i;
+        }
+    }
+    if (ra) {
+        __atomic_or_fetch(&inode->data_ra, got, __ATOMIC_RELAXED);
+    }
+    __atomic_or_fetch(&inode->data_valid, got, __ATOMIC_RELEASE);
+    pthread_rwlock_unlock(&inode->rwlock);
+    return ret;
+}
+/**
+ * @brief 读之前读入[offset, offset + size)所在的块，统计其中由预读读入的块
+ *
+ * @param inode
+ * @param offset
+ * @param size 大于0
+ * @return int 0成功，否则失败
+ */
+static int hitszfs_file_prepare(struct hitszfs_inode* inode, off_t offset, size_t size)
+{
+    int first = offset / HITSZFS_BLK_SZ();
+    int last  = (offset + size - 1) / HITSZFS_BLK_SZ();
+    int mask  = ((1 << (last - first + 1)) - 1) << first;
+    int hits;
+
+    if (__atomic_load_n(&inode->data_ra, __ATOMIC_RELAXED) & mask) {
+        hits = __atomic_fetch_and(&inode->data_ra, ~mask, __ATOMIC_RELAXED) & mask;
+        HITSZFS_STAT_ADD(ra_hits, __builtin_popcount(hits));
+    }
+    return hitszfs_file_fill(inode, first, last, FALSE);
+}
+/**
+ * @brief 把文件第first..last块交给预读线程，线程未运行或块都已读入时忽略
+ *
+ * @param inode 调用者持读锁
+ * @param first
+ * @param last
+ */
+static void hitszfs_file_ra_submit(struct hitszfs_inode* inode, int first, int last)
+{
+    struct hitszfs_ra_req* req;
+    int                    want = ((1 << (last - first + 1)) - 1) << first;
+
+    if (!__atomic_load_n(&ra_running, __ATOMIC_ACQUIRE) ||
+        (__atomic_load_n(&inode->data_valid, __ATOMIC_ACQUIRE) & want) == want) {
+        return;
+    }
+    req = (struct hitszfs_ra_req *)malloc(sizeof(struct hitszfs_ra_req));
+    if (req == NULL) {
+        return;
+    }
+    __atomic_add_fetch(&inode->ref, 1, __ATOMIC_RELAXED);
+    req->inode = inode;
+    req->first = first;
+    req->last  = last;
+    req->next  = NULL;
+    pthread_mutex_lock(&ra_lock);
+    if (ra_tail != NULL) {
+        ra_tail->next = req;
+    }
+    else {
+        ra_head = req;
+    }
+    ra_tail = req;
+    pthread_cond_signal(&ra_cond);
+    pthread_mutex_unlock(&ra_lock);
+}
+/**
+ * @brief 按本次读的范围更新句柄的顺序读状态，需要时提交下一个预读窗口
+ *
+ * @param fh
+ * @param offset
+ * @param size 大于0，不超过文件末尾
+ */
+static void hitszfs_file_ra_update(struct hitszfs_file_handle* fh, off_t offset, size_t size)
+{
+    int     first = offset / HITSZFS_BLK_SZ();
+    int     last  = (offset + size - 1) / HITSZFS_BLK_SZ();
+    int     blks  = (fh->inode->size + HITSZFS_BLK_SZ() - 1) / HITSZFS_BLK_SZ();
+    boolean seq   = offset == fh->next ||
+                    (fh->ra_size > 0 && first >= fh->ra_start && first < fh->ra_start + fh->ra_size);
+    int     start, win;
+
+    fh->next = offset + size;
+    if (hitszfs_options.readahead <= 0 || HITSZFS_IS_INLINE(fh->inode)) {
+        return;
+    }
+    if (!seq) {
+        fh->ra_size = 0;
+        return;
+    }
+    if (fh->ra_size > 0 && last < fh->ra_start) {
+        return;                                       /* 还没读到最近的窗口 */
+    }
+    start = fh->ra_size > 0 ? fh->ra_start + fh->ra_size : last + 1;
+    if (start <= last) {
+        start = last + 1;
+    }
+    win = fh->ra_size == 0 ? HITSZFS_RA_INIT : fh->ra_size * 2;
+    if (win > hitszfs_options.readahead) {
+        win = hitszfs_options.readahead;
+    }
+    fh->ra_start = start;
+    fh->ra_size  = win;
+    if (start < blks) {
+        hitszfs_file_ra_submit(fh->inode, start, start + win > blks ? blks - 1 : start + win - 1);
+    }
+}
+/**
+ * @brief 预读线程主循环，依次处理排队的请求，调用时不持锁
+ *
+ * @param arg
+ * @return void*
+ */
+static void* hitszfs_file_ra_main(void* arg)
+{
+    struct hitszfs_ra_req* req;
+    (void)arg;
+
+    pthread_mutex_lock(&ra_lock);
+    while (!ra_stop)
+    {
+        if (ra_head == NULL) {
+            pthread_cond_wait(&ra_cond, &ra_lock);
+            continue;
+        }
+        req     = ra_head;
+        ra_head = req->next;
+        if (ra_head == NULL) {
+            ra_tail = NULL;
+        }
+        pthread_mutex_unlock(&ra_lock);
+        HITSZFS_RDLOCK();
+        if (hitszfs_file_fill(req->inode, req->first, req->last, TRUE) == HITSZFS_ERROR_NONE) {
+            HITSZFS_STAT_INC(ra_windows);
+        }
+        HITSZFS_UNLOCK();
+        hitszfs_icache_unref(req->inode, &req->inode->ref, 1);
+        free(req);
+        pthread_mutex_lock(&ra_lock);
+    }
+    pthread_mutex_unlock(&ra_lock);
+    return NULL;
+}
+/**
+ * @brief 启动预读线程，options.readahead为0时不启动(读时只读入用到的块)
+ *
+ * @return int
+ */
+int hitszfs_file_ra_start()
+{
+    if (hitszfs_options.readahead <= 0 || ra_running) {
+        return HITSZFS_ERROR_NONE;
+    }
+    ra_stop = FALSE;
+    if (pthread_create(&ra_worker, NULL, hitszfs_file_ra_main, NULL) != 0) {
+        HITSZFS_DBG("[%s] create readahead worker error\n", __func__);
+        return -HITSZFS_ERROR_INVAL;
+    }
+    __atomic_store_n(&ra_running, TRUE, __ATOMIC_RELEASE);
+    return HITSZFS_ERROR_NONE;
+}
+/**
+ * @brief 停止预读线程，丢弃尚未处理的请求并放下其inode引用，调用时不持锁
+ *
+ */
+void hitszfs_file_ra_stop()
+{
+    struct hitszfs_ra_req* req;
+
+    if (!ra_running) {
+        return;
+    }
+    __atomic_store_n(&ra_running, FALSE, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&ra_lock);
+    ra_stop = TRUE;
+    pthread_cond_signal(&ra_cond);
+    pthread_mutex_unlock(&ra_lock);
+    pthread_join(ra_worker, NULL);
+    while (ra_head != NULL)
+    {
+        req     = ra_head;
+        ra_head = req->next;
+        hitszfs_icache_unref(req->inode, &req->inode->ref, 1);
+        free(req);
+    }
+    ra_tail = NULL;
+}
+/******************************************************************************
+* SECTION: 文件句柄
+*******************************************************************************/
+/**
+ * @brief 创建文件句柄，调用者已为inode增加打开计数
+ *
+ * @param inode
+ * @return struct hitszfs_file_handle*
+ */
+struct hitszfs_file_handle* hitszfs_file_open(struct hitszfs_inode* inode)
+{
+    struct hitszfs_file_handle* fh = (struct hitszfs_file_handle *)calloc(1, sizeof(struct hitszfs_file_handle));
+
+    fh->inode = inode;
+    return fh;
+}
+/**
+ * @brief 释放文件句柄，打开计数由调用者放下
+ *
+ * @param fh
+ */
+void hitszfs_file_close(struct hitszfs_file_handle* fh)
+{
+    free(fh);
+}
+/******************************************************************************
+* SECTION: 文件数据
+*
+* 普通文件的内容缓存在inode->data中(大小固定为HITSZFS_DATA_PER_FILE块，
+* 文件打开期间不会被释放或重新分配)，读写只操作这份缓存，回写时再整块写回数据块。
+* 数据块按需读入: inode->data_valid记录已读入的块，读时只读入用到的块；
+* 写、截断和整理前先读入全部块，因此带HITSZFS_FLAG_DATA_DIRTY的文件缓存总是完整的。
+*
+* 读以fuse_bufvec返回: 内容与磁盘一致时直接给出ddriver镜像文件上的fd + 偏移段，
+* 由libfuse从镜像文件splice到/dev/fuse，不经过用户态缓冲；否则指向(或复制)缓存。
+* 写直接从请求的fuse_bufvec复制到缓存，启用splice时源为FUSE管道的fd。
+*******************************************************************************/
+/**
+ * @brief 文件内容在数据块中与磁盘一致，可以直接从镜像文件读
+ *
+ * 脏数据尚未写回，或数据块已提交到日志而未检查点时，原位置上是旧内容
+ *
+ * @param inode
+ * @param offset
+ * @param size
+ * @return boolean
+ */
+static boolean hitszfs_file_on_disk(struct hitszfs_inode* inode, off_t offset, size_t size)
+{
+    int blk;
+
+    if (HITSZFS_IS_INLINE(inode) || (inode->flags & HITSZFS_FLAG_DATA_DIRTY)) {
+        return FALSE;
+    }
+    for (blk = offset / HITSZFS_BLK_SZ(); blk < HITSZFS_DATA_PER_FILE && HITSZFS_BLKS_SZ(blk) < offset + size; blk++)
+    {
+        if (inode->data_blk[blk] == HITSZFS_BLK_NONE ||
+            hitszfs_journal_pinned(HITSZFS_DATA_OFS(inode->data_blk[blk]), HITSZFS_BLK_SZ())) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+/**
+ * @brief 读文件，结果以fuse_bufvec返回，调用者持读锁
+ *
+ * fd段和借用的inode->data都在回复时才被读取，此前数据块不能被释放重用、内容不能被改写，
+ * 因此只有调用者持读锁直到回复完成(held为TRUE)时才这样返回: 内容与磁盘一致时返回镜像文件上的
+ * fd段(物理上连续的数据块合并为一段，不必读入缓存)，否则直接指向inode->data。
+ * held为FALSE时(高层接口由libfuse在返回后回复)在锁内从inode->data复制一份
+ *
+ * @param fh open时创建的文件句柄
+ * @param bufp 输出，调用者释放，held为FALSE时连同各段的mem
+ * @param size
+ * @param offset
+ * @param held 调用者持读锁直到回复完成
+ * @return int 0成功，否则失败
+ */
+int hitszfs_file_read_buf(struct hitszfs_file_handle* fh, struct fuse_bufvec** bufp, size_t size, off_t offset,
+                          boolean held)
+{
+    struct hitszfs_inode* inode = fh->inode;
+    struct fuse_bufvec*   buf;
+    int                   blk, blk_ofs, len, ret;
+    int                   segs = 0;
+
+    if (offset >= inode->size) {
+        size = 0;
+    }
+    else if (offset + size > (size_t)inode->size) {
+        size = inode->size - offset;
+    }
+    buf = (struct fuse_bufvec *)malloc(sizeof(struct fuse_bufvec) +
+                                       HITSZFS_DATA_PER_FILE * sizeof(struct fuse_buf));
+    if (buf == NULL) {
+        return -ENOMEM;
+    }
+    *buf = FUSE_BUFVEC_INIT(size);
+    *bufp = buf;
+    if (size == 0) {
+        return HITSZFS_ERROR_NONE;
+    }
+    hitszfs_file_ra_update(fh, offset, size);
+    if (!held || !hitszfs_file_on_disk(inode, offset, size)) {
+        ret = hitszfs_file_prepare(inode, offset, size);
+        if (ret != HITSZFS_ERROR_NONE) {
+            return ret;
+        }
+        if (held) {
+            buf->buf[0].mem = inode->data + offset;
+            return HITSZFS_ERROR_NONE;
+        }
+        buf->buf[0].mem = malloc(size);
+        if (buf->buf[0].mem == NULL) {
+            return -ENOMEM;
+        }
+        memcpy(buf->buf[0].mem, inode->data + offset, size);
+        return HITSZFS_ERROR_NONE;
+    }
+    while (size > 0)
+    {
+        blk     = offset / HITSZFS_BLK_SZ();
+        blk_ofs = offset % HITSZFS_BLK_SZ();
+        len     = HITSZFS_BLK_SZ() - blk_ofs < (int)size ? HITSZFS_BLK_SZ() - blk_ofs : (int)size;
+        if (segs > 0 && buf->buf[segs - 1].pos + buf->buf[segs - 1].size ==
+                        (size_t)HITSZFS_DATA_OFS(inode->data_blk[blk]) + blk_ofs) {
+            buf->buf[segs - 1].size += len;           /* 与上一段在磁盘上连续 */
+        }
+        else {
+            buf->buf[segs].size  = len;
+            buf->buf[segs].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK | FUSE_BUF_FD_RETRY;
+            buf->buf[segs].mem   = NULL;
+            buf->buf[segs].fd    = HITSZFS_DRIVER();
+            buf->buf[segs].pos   = HITSZFS_DATA_OFS(inode->data_blk[blk]) + blk_ofs;
+            segs++;
+        }
+        offset += len;
+        size   -= len;
+    }
+    buf->count = segs;
+    return HITSZFS_ERROR_NONE;
+}
+/**
+ * @brief 读文件到buf，调用者持读锁
+ *
+ * @param fh open时创建的文件句柄
+ * @param buf
+ * @param size
+ * @param offset
+ * @return int 读取的字节数，失败返回负值
+ */
+int hitszfs_file_read(struct hitszfs_file_handle* fh, char* buf, size_t size, off_t offset)
+{
+    struct hitszfs_inode* inode = fh->inode;
+    int                   ret;
+
+    if (offset >= inode->size) {
+        return 0;
+    }
+    if (offset + size > (size_t)inode->size) {
+        size = inode->size - offset;
+    }
+    hitszfs_file_ra_update(fh, offset, size);
+    ret = hitszfs_file_prepare(inode, offset, size);
+    if (ret != HITSZFS_ERROR_NONE) {
+        return ret;
+    }
+    memcpy(buf, inode->data + offset, size);
+    return size;
+}
+/**
+ * @brief 写文件，从src(内存或FUSE管道)直接复制到inode->data，调用者持写锁
+ *
+ * 先读入全部数据块，回写时整个缓存写回。超出文件大小上限的部分不写(短写)，偏移已在上限处时返回EFBIG
+ *
+ * @param inode 普通文件
+ * @param src
+ * @param offset
+ * @return int 写入的字节数，失败返回负值
+ */
+int hitszfs_file_write(struct hitszfs_inode* inode, struct fuse_bufvec* src, off_t offset)
+{
+    struct fuse_bufvec dst  = FUSE_BUFVEC_INIT(0);
+    size_t             size = fuse_buf_size(src);
+    off_t              max  = HITSZFS_BLKS_SZ(HITSZFS_DATA_PER_FILE);
+    ssize_t            ret;
+
+    if (size == 0) {
+        return 0;
+    }
+    if (offset >= max) {
+        return -HITSZFS_ERROR_FBIG;
+    }
+    if (offset + size > (size_t)max) {
+        size = max - offset;
+    }
+    if (hitszfs_file_fill(inode, 0, HITSZFS_DATA_PER_FILE - 1, FALSE) != HITSZFS_ERROR_NONE) {
+        return -HITSZFS_ERROR_IO;
+    }
+    if (hitszfs_reserve_data(inode, offset + size) != HITSZFS_ERROR_NONE) {
+        return -HITSZFS_ERROR_NOSPACE;
+    }
+    dst.buf[0].mem  = inode->data + offset;
+    dst.buf[0].size = size;
+    ret = fuse_buf_copy(&dst, src, 0);
+    if (ret <= 0) {
+        return ret < 0 ? ret : -HITSZFS_ERROR_IO;
+    }
+    if (offset + ret > inode->size) {
+        inode->size = offset + ret;
+    }
+    inode->mtime = inode->ctime = time(NULL);
+    hitszfs_mark_inode_dirty(inode, HITSZFS_FLAG_BUF_DIRTY | HITSZFS_FLAG_DATA_DIRTY);
+    return ret;
+}
+/**
+ * @brief 修改文件大小，调用者持写锁
+ *
+ * 缩小时清零截掉的内容并归还不再需要的数据块，不超过HITSZFS_INLINE_SZ时回到内联；
+ * 扩大时新增部分读出为0
+ *
+ * @param inode 普通文件
+ * @param size
+ * @return int 0成功，否则失败
+ */
+int hitszfs_file_truncate(struct hitszfs_inode* inode, off_t size)
+{
+    int keep, i;
+
+    if (size > HITSZFS_BLKS_SZ(HITSZFS_DATA_PER_FILE)) {
+        return -HITSZFS_ERROR_FBIG;
+    }
+    if (hitszfs_file_fill(inode, 0, HITSZFS_DATA_PER_FILE - 1, FALSE) != HITSZFS_ERROR_NONE) {
+        return -HITSZFS_ERROR_IO;
+    }
+    if (size > inode->size) {
+        if (hitszfs_reserve_data(inode, size) != HITSZFS_ERROR_NONE) {
+            return -HITSZFS_ERROR_NOSPACE;
+        }
+    }
+    else {
+        memset(inode->data + size, 0, inode->size - size);
+        keep = size <= HITSZFS_INLINE_SZ ? 0 : (size + HITSZFS_BLK_SZ() - 1) / HITSZFS_BLK_SZ();
+        for (i = keep; i < HITSZFS_DATA_PER_FILE; i++)
+        {
+            if (inode->data_blk[i] != HITSZFS_BLK_NONE) {
+                hitszfs_defer_free(inode, inode->data_blk[i], FALSE);
+                inode->data_blk[i] = HITSZFS_BLK_NONE;
+            }
+        }
+    }
+    inode->size  = size;
+    inode->mtime = inode->ctime = time(NULL);
+    hitszfs_mark_inode_dirty(inode, HITSZFS_FLAG_BUF_DIRTY | HITSZFS_FLAG_DATA_DIRTY);
+    return HITSZFS_ERROR_NONE;
+}
@@ -0,0 +1,114 @@
+#include "../include/hitszfs.h"
+
+/******************************************************************************
+* SECTION: 后台回写线程
+* 
+* 周期性地回写驻留超过dirty_age秒的脏inode；脏inode比例超过dirty_ratio时被唤醒，
+* 立即回写全部脏inode。每回写HITSZFS_WB_CHUNK个inode释放一次文件系统锁，
+* 避免前台操作长时间等待。每次唤醒顺带淘汰超出上限的内存inode。
+* 启用日志时回写只提交事务，日志占用过半时由本线程做检查点，前台操作不必等待写回原位置。
+* 命名空间锁是读写锁，不能配合条件变量使用，线程的睡眠与唤醒使用单独的flusher_lock。
+*******************************************************************************/
+static pthread_t        flusher;
+static pthread_mutex_t  flusher_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   flusher_cond = PTHREAD_COND_INITIALIZER;
+static boolean          flusher_running = FALSE;
+static boolean          flusher_stop    = FALSE;
+static boolean          flusher_urgent  = FALSE;
+
+/**
+ * @brief 后台回写线程主循环，调用时不持锁
+ * 
+ * @param arg 
+ * @return void* 
+ */
+static void* hitszfs_flusher_main(void* arg) 
+{
+    struct timespec deadline;
+    time_t          expire;
+    int             cnt;
+    (void)arg;
+
+    pthread_mutex_lock(&flusher_lock);
+    while (!flusher_stop)
+    {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += HITSZFS_WB_INTERVAL;
+        if (!flusher_urgent) {
+            pthread_cond_timedwait(&flusher_cond, &flusher_lock, &deadline);
+        }
+        if (flusher_stop) {
+            break;
+        }
+                                                      /* 比例超限时回写全部，否则只回写过期的 */
+        expire         = flusher_urgent ? time(NULL) : time(NULL) - hitszfs_options.dirty_age;
+        flusher_urgent = FALSE;
+        pthread_mutex_unlock(&flusher_lock);
+        do {
+            HITSZFS_LOCK();
+            cnt = hitszfs_writeback(expire, HITSZFS_WB_CHUNK);
+            HITSZFS_UNLOCK();
+        } while (cnt == HITSZFS_WB_CHUNK && !__atomic_load_n(&flusher_stop, __ATOMIC_RELAXED));
+        if (cnt < 0) {
+            HITSZFS_DBG("[%s] writeback error\n", __func__);
+        }
+        HITSZFS_LOCK();
+        if (hitszfs_journal_need_checkpoint() && hitszfs_journal_checkpoint() != HITSZFS_ERROR_NONE) {
+            HITSZFS_DBG("[%s] checkpoint error\n", __func__);
+        }
+        HITSZFS_UNLOCK();
+        hitszfs_icache_balance();
+        pthread_mutex_lock(&flusher_lock);
+    }
+    pthread_mutex_unlock(&flusher_lock);
+    return NULL;
+}
+/**
+ * @brief 启动后台回写线程，dirty_age为0时不启动
+ * 
+ * @return int 
+ */
+int hitszfs_flusher_start() 
+{
+    if (hitszfs_options.dirty_age <= 0 || flusher_running) {
+        return HITSZFS_ERROR_NONE;
+    }
+    flusher_stop   = FALSE;
+    flusher_urgent = FALSE;
+    if (pthread_create(&flusher, NULL, hitszfs_flusher_main, NULL) != 0) {
+        HITSZFS_DBG("[%s] create flusher error\n", __func__);
+        return -HITSZFS_ERROR_INVAL;
+    }
+    flusher_running = TRUE;
+    return HITSZFS_ERROR_NONE;
+}
+/**
+ * @brief 停止后台回写线程，剩余脏数据由umount写回
+ * 
+ */
+void hitszfs_flusher_stop() 
+{
+    if (!flusher_running) {
+        return;
+    }
+    pthread_mutex_lock(&flusher_lock);
+    flusher_stop = TRUE;
+    pthread_cond_signal(&flusher_cond);
+    pthread_mutex_unlock(&flusher_lock);
+    pthread_join(flusher, NULL);
+    flusher_running = FALSE;
+}
+/**
+ * @brief 唤醒后台回写线程立即回写
+ * 
+ */
+void hitszfs_flusher_kick() 
+{
+    if (!flusher_running) {
+        return;
+    }
+    pthread_mutex_lock(&flusher_lock);
+    flusher_urgent = TRUE;
+    pthread_cond_signal(&flusher_cond);
+    pthread_mutex_unlock(&flusher_lock);
+}
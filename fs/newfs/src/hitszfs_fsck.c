@@ -0,0 +1,443 @@
+#include "../include/hitszfs.h"
+
+/******************************************************************************
+* SECTION: 一致性检查 (fsck.hitszfs)
+*
+* 挂载(重放日志)后，按块组整段读入全部inode表，从根目录开始由多个线程遍历目录树:
+* 目录放入工作队列，线程取出目录后按物理连续的段读入目录块，逐项检查并标记
+* 引用到的inode与数据块(含目录索引块)，重建出两张引用位图。遍历结束后与
+* map_inode/map_data按64位字异或比较:
+*   位图中空闲而被引用 -- 分配器可能把它再分配出去，造成交叉引用；
+*   位图中占用而不可达 -- 孤儿inode与泄漏的数据块，包括低层接口中已删除、
+*                        内核仍持有引用(forget之前)时异常退出留下的inode。
+* 另外检查超级块中的空闲计数与各块组备份中的空闲摘要。
+*
+* 修复时以引用位图替换磁盘位图(回收孤儿inode与其数据块)并重新统计空闲摘要，
+* 由卸载写回位图与超级块；无法自动修复的(坏目录项、交叉引用)只报告。
+*******************************************************************************/
+struct hitszfs_fsck {
+    uint8_t*                    itable;     // 全部inode表，按全局inode表块号排列
+    uint8_t*                    map_inode;  // 由目录树重建的引用位图
+    uint8_t*                    map_data;
+    int*                        queue;      // 待遍历的目录，每个inode至多入队一次
+    int                         head;
+    int                         tail;
+    int                         busy;       // 正在遍历目录的线程数
+    pthread_mutex_t             lock;
+    pthread_cond_t              cond;
+    struct hitszfs_fsck_report* rep;
+};
+static struct hitszfs_fsck fsck;
+
+#define HITSZFS_FSCK_ADD(field, n)  __atomic_fetch_add(&fsck.rep->field, (n), __ATOMIC_RELAXED)
+#define HITSZFS_FSCK_INC(field)     HITSZFS_FSCK_ADD(field, 1)
+
+static struct hitszfs_inode_d* hitszfs_fsck_inode(int ino)
+{
+    return (struct hitszfs_inode_d *)(fsck.itable + HITSZFS_BLKS_SZ(HITSZFS_ITABLE_BLK(ino)) +
+                                      HITSZFS_ITABLE_POS(ino));
+}
+/**
+ * @brief 在引用位图中置位
+ *
+ * @param map
+ * @param bit
+ * @return boolean 之前已置位(被重复引用)时返回TRUE
+ */
+static boolean hitszfs_fsck_mark(uint8_t* map, int bit)
+{
+    uint8_t mask = 0x1 << (bit % UINT8_BITS);
+
+    return (__atomic_fetch_or(&map[bit / UINT8_BITS], mask, __ATOMIC_RELAXED) & mask) != 0;
+}
+/**
+ * @brief 按块组整段读入inode表
+ *
+ * @return int
+ */
+static int hitszfs_fsck_load_itable()
+{
+    int group;
+
+    fsck.itable = (uint8_t *)malloc(HITSZFS_BLKS_SZ(hitszfs_super.group_cnt * hitszfs_super.inode_blks));
+    for (group = 0; group < hitszfs_super.group_cnt; group++)
+    {
+        if (hitszfs_driver_read(HITSZFS_GROUP_OFS(group) + hitszfs_super.inode_offset,
+                                fsck.itable + HITSZFS_BLKS_SZ(group * hitszfs_super.inode_blks),
+                                HITSZFS_BLKS_SZ(hitszfs_super.inode_blks)) != HITSZFS_ERROR_NONE) {
+            return -HITSZFS_ERROR_IO;
+        }
+    }
+    return HITSZFS_ERROR_NONE;
+}
+/**
+ * @brief 检查目录项指向的inode并标记其数据块，子目录放入工作队列
+ *
+ * @param dir_ino 所在目录，根目录为-1
+ * @param fname
+ * @param ftype 目录项中的文件类型
+ * @param ino
+ */
+static void hitszfs_fsck_visit(int dir_ino, const char* fname, int ftype, int ino)
+{
+    struct hitszfs_inode_d* inode_d;
+    int                     i, blk;
+
+    if (ino < 0 || ino >= HITSZFS_MAX_INO() || ftype < HITSZFS_REG_FILE || ftype > HITSZFS_SYM_LINK) {
+        printf("dir %d entry '%s': bad inode %d / type %d\n", dir_ino, fname, ino, ftype);
+        HITSZFS_FSCK_INC(bad_entries);
+        return;
+    }
+    if (hitszfs_fsck_mark(fsck.map_inode, ino)) {       /* 没有硬链接，重复引用即交叉链接或环 */
+        printf("dir %d entry '%s': inode %d already referenced\n", dir_ino, fname, ino);
+        HITSZFS_FSCK_INC(dup_inodes);
+        return;
+    }
+    inode_d = hitszfs_fsck_inode(ino);
+    if (inode_d->ino != ino || (int)inode_d->ftype != ftype) {
+        printf("dir %d entry '%s': inode %d does not match (ino %d, type %d)\n", dir_ino, fname, ino,
+               inode_d->ino, inode_d->ftype);
+        HITSZFS_FSCK_INC(bad_inodes);
+        return;
+    }
+    for (i = 0; i <= HITSZFS_DATA_PER_FILE; i++)
+    {
+        blk = i < HITSZFS_DATA_PER_FILE ? inode_d->data_blk[i] : inode_d->index_blk;
+        if (blk == HITSZFS_BLK_NONE) {
+            continue;
+        }
+        if (blk < 0 || blk >= HITSZFS_MAX_DATA()) {
+            printf("inode %d: bad data block %d\n", ino, blk);
+            HITSZFS_FSCK_INC(bad_inodes);
+        }
+        else if (hitszfs_fsck_mark(fsck.map_data, blk)) {
+            printf("inode %d: data block %d already referenced\n", ino, blk);
+            HITSZFS_FSCK_INC(dup_blocks);
+        }
+    }
+    if (ftype == HITSZFS_DIR) {
+        HITSZFS_FSCK_INC(dirs);
+        pthread_mutex_lock(&fsck.lock);
+        fsck.queue[fsck.tail++] = ino;
+        pthread_cond_signal(&fsck.cond);
+        pthread_mutex_unlock(&fsck.lock);
+    }
+    else {
+        HITSZFS_FSCK_INC(files);
+    }
+}
+/**
+ * @brief 读入目录块并检查其中的全部目录项，物理上连续的目录块一次读入
+ *
+ * @param ino
+ * @param buf 至少HITSZFS_DATA_PER_FILE块
+ */
+static void hitszfs_fsck_dir(int ino, uint8_t* buf)
+{
+    struct hitszfs_inode_d*  inode_d = hitszfs_fsck_inode(ino);
+    struct hitszfs_dentry_d* dentry_d;
+    struct hitszfs_dirent_d* rec;
+    char                     fname[MAX_NAME_LEN];
+    int                      nblks, i, run, off, slot;
+
+    if (HITSZFS_VAR_DENTRY()) {
+        nblks = HITSZFS_DATA_PER_FILE;
+    }
+    else {
+        nblks = (inode_d->dir_cnt + HITSZFS_DENTRY_PER_BLK() - 1) / HITSZFS_DENTRY_PER_BLK();
+        if (inode_d->dir_cnt < 0 || nblks > HITSZFS_DATA_PER_FILE) {
+            printf("dir %d: bad entry count %d\n", ino, inode_d->dir_cnt);
+            HITSZFS_FSCK_INC(bad_inodes);
+            return;
+        }
+    }
+    for (i = 0; i < nblks; i += run)
+    {
+        run = 1;
+        if (inode_d->data_blk[i] < 0 || inode_d->data_blk[i] >= HITSZFS_MAX_DATA()) {
+            if (!HITSZFS_VAR_DENTRY()) {                /* 定长格式下目录项所在的块必须存在 */
+                printf("dir %d: entries in missing block %d\n", ino, i);
+                HITSZFS_FSCK_INC(bad_inodes);
+                return;
+            }
+            continue;
+        }
+        while (i + run < nblks && inode_d->data_blk[i + run] == inode_d->data_blk[i] + run &&
+               (inode_d->data_blk[i] + run) % hitszfs_super.data_per_group != 0)
+        {
+            run++;
+        }
+        if (hitszfs_driver_read(HITSZFS_DATA_OFS(inode_d->data_blk[i]), buf + HITSZFS_BLKS_SZ(i),
+                                HITSZFS_BLKS_SZ(run)) != HITSZFS_ERROR_NONE) {
+            printf("dir %d: io error\n", ino);
+            HITSZFS_FSCK_INC(bad_inodes);
+            return;
+        }
+    }
+
+    if (!HITSZFS_VAR_DENTRY()) {
+        for (slot = 0; slot < inode_d->dir_cnt; slot++)
+        {
+            dentry_d = (struct hitszfs_dentry_d *)(buf + HITSZFS_BLKS_SZ(slot / HITSZFS_DENTRY_PER_BLK())) +
+                       slot % HITSZFS_DENTRY_PER_BLK();
+            memcpy(fname, dentry_d->fname, MAX_NAME_LEN);
+            fname[MAX_NAME_LEN - 1] = '\0';
+            hitszfs_fsck_visit(ino, fname, dentry_d->ftype, dentry_d->ino);
+        }
+        return;
+    }
+    for (i = 0, slot = 0; i < nblks; i++)
+    {
+        if (inode_d->data_blk[i] < 0 || inode_d->data_blk[i] >= HITSZFS_MAX_DATA()) {
+            continue;
+        }
+        for (off = 0; off < HITSZFS_BLK_SZ(); off += rec->rec_len)
+        {
+            rec = (struct hitszfs_dirent_d *)(buf + HITSZFS_BLKS_SZ(i) + off);
+            if (rec->rec_len < sizeof(struct hitszfs_dirent_d) || off + rec->rec_len > HITSZFS_BLK_SZ() ||
+                sizeof(struct hitszfs_dirent_d) + rec->name_len > rec->rec_len) {
+                printf("dir %d: corrupted dirent at block %d offset %d\n", ino, i, off);
+                HITSZFS_FSCK_INC(bad_inodes);
+                break;
+            }
+            if (rec->name_len == 0) {
+                continue;
+            }
+            memcpy(fname, rec->name, rec->name_len);
+            fname[rec->name_len] = '\0';
+            hitszfs_fsck_visit(ino, fname, rec->ftype, rec->ino);
+            slot++;
+        }
+    }
+    if (slot != inode_d->dir_cnt) {
+        printf("dir %d: %d entries, inode says %d\n", ino, slot, inode_d->dir_cnt);
+        HITSZFS_FSCK_INC(bad_inodes);
+    }
+}
+/**
+ * @brief 工作线程: 从队列取目录遍历，队列为空且没有线程在遍历时结束
+ *
+ * @param arg
+ * @return void*
+ */
+static void* hitszfs_fsck_worker(void* arg)
+{
+    uint8_t* buf = (uint8_t *)malloc(HITSZFS_BLKS_SZ(HITSZFS_DATA_PER_FILE));
+    int      ino;
+    (void)arg;
+
+    pthread_mutex_lock(&fsck.lock);
+    for (;;)
+    {
+        while (fsck.head == fsck.tail && fsck.busy > 0)
+        {
+            pthread_cond_wait(&fsck.cond, &fsck.lock);
+        }
+        if (fsck.head == fsck.tail) {
+            pthread_cond_broadcast(&fsck.cond);
+            break;
+        }
+        ino = fsck.queue[fsck.head++];
+        fsck.busy++;
+        pthread_mutex_unlock(&fsck.lock);
+        hitszfs_fsck_dir(ino, buf);
+        pthread_mutex_lock(&fsck.lock);
+        fsck.busy--;
+    }
+    pthread_mutex_unlock(&fsck.lock);
+    free(buf);
+    return NULL;
+}
+/**
+ * @brief 按64位字异或比较位图，逐段打印不一致的位
+ *
+ * @param what
+ * @param map 磁盘位图
+ * @param ref 引用位图
+ * @param bytes
+ * @param missing 输出，被引用但空闲的位数
+ * @param leaked 输出，占用但未被引用的位数
+ */
+static void hitszfs_fsck_diff(const char* what, const uint8_t* map, const uint8_t* ref, int bytes,
+                              int* missing, int* leaked)
+{
+    uint64_t w_map, w_ref, x;
+    int      words = bytes / sizeof(uint64_t);
+    int      i, bit, used;
+    int      start = -1, last = -1, last_used = 0;
+
+    for (i = 0; i <= words; i++)
+    {
+        w_map = w_ref = 0;
+        if (i < words) {                                 /* 位图按字节寻址，逐字拷出避免对齐问题 */
+            memcpy(&w_map, map + i * sizeof(uint64_t), sizeof(uint64_t));
+            memcpy(&w_ref, ref + i * sizeof(uint64_t), sizeof(uint64_t));
+        }
+        else {
+            memcpy(&w_map, map + i * sizeof(uint64_t), bytes % sizeof(uint64_t));
+            memcpy(&w_ref, ref + i * sizeof(uint64_t), bytes % sizeof(uint64_t));
+        }
+        for (x = w_map ^ w_ref; x != 0; x &= x - 1)
+        {
+            bit  = i * 64 + __builtin_ctzll(x);
+            used = (w_map >> (bit % 64)) & 0x1;
+            *(used ? leaked : missing) += 1;
+            if (bit == last + 1 && used == last_used) {
+                last = bit;
+                continue;
+            }
+            if (start >= 0) {
+                printf("%s %d-%d: %s\n", what, start, last, last_used ? "allocated but unreferenced"
+                                                                      : "referenced but free");
+            }
+            start = last = bit;
+            last_used = used;
+        }
+    }
+    if (start >= 0) {
+        printf("%s %d-%d: %s\n", what, start, last, last_used ? "allocated but unreferenced"
+                                                              : "referenced but free");
+    }
+}
+/**
+ * @brief 检查超级块与各块组备份中的空闲计数和摘要，摘要以引用位图为准
+ *
+ * 备份只在格式化、卸载时写回，主超级块没有HITSZFS_SUPER_CLEAN(非正常卸载)时只检查块组0的摘要
+ *
+ * @return int 不一致的项数
+ */
+static int hitszfs_fsck_counts()
+{
+    struct hitszfs_super_d super_d;
+    int                    free_inode = 0, free_data = 0;
+    int                    group, bit, start, end, grp_inode, grp_data, run, longest;
+    int                    bad = 0;
+    boolean                clean;
+
+    if (hitszfs_driver_read(HITSZFS_SUPER_OFS, (uint8_t *)&super_d,
+                            sizeof(struct hitszfs_super_d)) != HITSZFS_ERROR_NONE) {
+        return 1;
+    }
+    clean = (super_d.state & HITSZFS_SUPER_CLEAN) != 0;
+    for (group = 0; group < hitszfs_super.group_cnt; group++)
+    {
+        grp_inode = grp_data = run = longest = 0;
+        for (bit = group * hitszfs_super.inodes_per_group; bit < (group + 1) * hitszfs_super.inodes_per_group; bit++)
+        {
+            grp_inode += !(fsck.map_inode[bit / UINT8_BITS] & (0x1 << (bit % UINT8_BITS)));
+        }
+        start = group * hitszfs_super.data_per_group;
+        end   = start + hitszfs_super.data_per_group < HITSZFS_MAX_DATA() ? start + hitszfs_super.data_per_group
+                                                                        : HITSZFS_MAX_DATA();
+        for (bit = start; bit < end; bit++)
+        {
+            if (fsck.map_data[bit / UINT8_BITS] & (0x1 << (bit % UINT8_BITS))) {
+                run = 0;
+                continue;
+            }
+            grp_data++;
+            run++;
+            longest = run > longest ? run : longest;
+        }
+        free_inode += grp_inode;
+        free_data  += grp_data;
+        if (group > 0 && !clean) {
+            continue;                                   /* 备份已过时 */
+        }
+        if (hitszfs_driver_read(HITSZFS_GROUP_OFS(group) + HITSZFS_SUPER_OFS, (uint8_t *)&super_d,
+                                sizeof(struct hitszfs_super_d)) != HITSZFS_ERROR_NONE) {
+            return bad + 1;
+        }
+        if (super_d.free_inode + super_d.free_data == 0) {
+            continue;                                   /* 早期格式未记录空闲计数 */
+        }
+                                                      /* 最长空闲区间只需是上界，偏小时分配器会跳过可用的块组 */
+        if (super_d.grp_free_inode != grp_inode || super_d.grp_free_data != grp_data ||
+            super_d.grp_max_extent < longest) {
+            printf("group %d: free inodes %d/%d, free data %d/%d, max extent %d/%d\n", group,
+                   super_d.grp_free_inode, grp_inode, super_d.grp_free_data, grp_data,
+                   super_d.grp_max_extent, longest);
+            bad++;
+        }
+    }
+    if (hitszfs_driver_read(HITSZFS_SUPER_OFS, (uint8_t *)&super_d,
+                            sizeof(struct hitszfs_super_d)) != HITSZFS_ERROR_NONE) {
+        return bad + 1;
+    }
+    if (super_d.free_inode + super_d.free_data != 0 &&
+        (super_d.free_inode != free_inode || super_d.free_data != free_data)) {
+        printf("super: free inodes %d/%d, free data %d/%d\n", super_d.free_inode, free_inode,
+               super_d.free_data, free_data);
+        bad++;
+    }
+    return bad;
+}
+/**
+ * @brief 检查已挂载(离线打开)的文件系统，可选修复位图与空闲计数
+ *
+ * @param jobs 遍历目录树的线程数
+ * @param repair 为TRUE时以引用位图替换磁盘位图并重新统计，卸载时写回
+ * @param rep 输出
+ * @return int 0成功(不论是否发现问题)，否则为读盘错误
+ */
+int hitszfs_fsck(int jobs, boolean repair, struct hitszfs_fsck_report* rep)
+{
+    pthread_t* workers;
+    int        ret, i;
+
+    memset(rep, 0, sizeof(struct hitszfs_fsck_report));
+    memset(&fsck, 0, sizeof(struct hitszfs_fsck));
+    fsck.rep = rep;
+    ret = hitszfs_fsck_load_itable();
+    if (ret != HITSZFS_ERROR_NONE) {
+        free(fsck.itable);
+        return ret;
+    }
+    fsck.map_inode = (uint8_t *)calloc(HITSZFS_MAP_INODE_SZ(), 1);
+    fsck.map_data  = (uint8_t *)calloc(HITSZFS_MAP_DATA_SZ(), 1);
+    fsck.queue     = (int *)malloc(sizeof(int) * HITSZFS_MAX_INO());
+    pthread_mutex_init(&fsck.lock, NULL);
+    pthread_cond_init(&fsck.cond, NULL);
+
+    hitszfs_fsck_visit(-1, "/", HITSZFS_DIR, HITSZFS_ROOT_INO);
+    jobs    = jobs < 1 ? 1 : jobs;
+    workers = (pthread_t *)malloc(sizeof(pthread_t) * jobs);
+    for (i = 0; i < jobs; i++)
+    {
+        pthread_create(&workers[i], NULL, hitszfs_fsck_worker, NULL);
+    }
+    for (i = 0; i < jobs; i++)
+    {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+
+    pthread_mutex_lock(&hitszfs_super.bitmap_lock);
+    hitszfs_fsck_diff("inode", hitszfs_super.map_inode, fsck.map_inode, HITSZFS_MAP_INODE_SZ(),
+                      &rep->inode_missing, &rep->inode_leaked);
+    hitszfs_fsck_diff("data", hitszfs_super.map_data, fsck.map_data, HITSZFS_MAP_DATA_SZ(),
+                      &rep->data_missing, &rep->data_leaked);
+    pthread_mutex_unlock(&hitszfs_super.bitmap_lock);
+    rep->bad_counts = hitszfs_fsck_counts();
+    rep->bad_super  = hitszfs_super.super_backup != 0;  /* 卸载时按备份重写主超级块 */
+
+    if (repair && (rep->inode_missing + rep->inode_leaked + rep->data_missing + rep->data_leaked +
+                   rep->bad_counts != 0 || rep->bad_super)) {
+        pthread_mutex_lock(&hitszfs_super.bitmap_lock);
+        memcpy(hitszfs_super.map_inode, fsck.map_inode, HITSZFS_MAP_INODE_SZ());
+        memcpy(hitszfs_super.map_data, fsck.map_data, HITSZFS_MAP_DATA_SZ());
+        free(hitszfs_super.groups);
+        hitszfs_group_sum_init();
+        hitszfs_group_dirty_all();
+        pthread_mutex_unlock(&hitszfs_super.bitmap_lock);
+        rep->repaired = TRUE;
+    }
+
+    pthread_cond_destroy(&fsck.cond);
+    pthread_mutex_destroy(&fsck.lock);
+    free(fsck.queue);
+    free(fsck.map_inode);
+    free(fsck.map_data);
+    free(fsck.itable);
+    return HITSZFS_ERROR_NONE;
+}
@@ -0,0 +1,246 @@
+#include "../include/hitszfs.h"
+
+/******************************************************************************
+* SECTION: inode缓存 (LRU)
+*
+* 所有内存inode挂在超级块的LRU链表上，最近使用的在表头。
+* 内存inode数超过options.inode_cache时从表尾开始淘汰: 被打开(ref > 0)或被内核引用
+* (nlookup > 0)的inode、根目录以及仍有子项inode在内存中的目录不淘汰，脏inode先写回。
+* 淘汰后dentry保留，dentry->inode置空，下次查找时重新从磁盘读入。
+*
+* 并发: 链表的增删持icache_lock；访问inode只置referenced位而不移动链表，
+* 淘汰时被访问过的inode清位后移回表头(第二次机会)，读者之间因此不争用链表。
+* 淘汰须持命名空间写锁，保证没有读者正在使用被淘汰的inode和dentry。
+*
+* 删除仍被打开或被内核引用的inode时只从目录摘下(unlinked)，不淘汰，
+* 最后一次release/forget时再归还数据块和inode号。两个前端共用。
+*******************************************************************************/
+static void hitszfs_icache_unlink(struct hitszfs_inode* inode)
+{
+    if (inode->lru_prev != NULL) {
+        inode->lru_prev->lru_next = inode->lru_next;
+    }
+    else {
+        hitszfs_super.lru_head = inode->lru_next;
+    }
+    if (inode->lru_next != NULL) {
+        inode->lru_next->lru_prev = inode->lru_prev;
+    }
+    else {
+        hitszfs_super.lru_tail = inode->lru_prev;
+    }
+    inode->lru_prev = NULL;
+    inode->lru_next = NULL;
+}
+/**
+ * @brief 将新的内存inode挂到LRU表头
+ *
+ * @param inode
+ */
+static void hitszfs_icache_link(struct hitszfs_inode* inode)
+{
+    inode->lru_prev = NULL;
+    inode->lru_next = hitszfs_super.lru_head;
+    if (hitszfs_super.lru_head != NULL) {
+        hitszfs_super.lru_head->lru_prev = inode;
+    }
+    hitszfs_super.lru_head = inode;
+    if (hitszfs_super.lru_tail == NULL) {
+        hitszfs_super.lru_tail = inode;
+    }
+}
+/**
+ * @brief 将新的内存inode挂到LRU表头
+ *
+ * @param inode
+ */
+void hitszfs_icache_add(struct hitszfs_inode* inode)
+{
+    pthread_mutex_lock(&hitszfs_super.icache_lock);
+    hitszfs_icache_link(inode);
+    __atomic_add_fetch(&hitszfs_super.inode_cnt, 1, __ATOMIC_RELAXED);   /* balance不加锁读取 */
+    pthread_mutex_unlock(&hitszfs_super.icache_lock);
+}
+/**
+ * @brief 将inode从LRU中摘除
+ *
+ * @param inode
+ */
+void hitszfs_icache_del(struct hitszfs_inode* inode)
+{
+    pthread_mutex_lock(&hitszfs_super.icache_lock);
+    hitszfs_icache_unlink(inode);
+    __atomic_sub_fetch(&hitszfs_super.inode_cnt, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&hitszfs_super.icache_lock);
+}
+/**
+ * @brief 访问inode时置referenced位，已置位时不再写，避免读者之间争用缓存行
+ *
+ * @param inode
+ */
+void hitszfs_icache_touch(struct hitszfs_inode* inode)
+{
+    if (inode == NULL || __atomic_load_n(&inode->referenced, __ATOMIC_RELAXED)) {
+        return;
+    }
+    __atomic_store_n(&inode->referenced, TRUE, __ATOMIC_RELAXED);
+}
+/**
+ * @brief 判断inode能否被淘汰
+ *
+ * @param inode
+ * @return boolean
+ */
+static boolean hitszfs_icache_evictable(struct hitszfs_inode* inode)
+{
+    struct hitszfs_dentry* dentry;
+
+    if (__atomic_load_n(&inode->ref, __ATOMIC_ACQUIRE) > 0 || inode->dentry == hitszfs_super.root_dentry) {
+        return FALSE;
+    }
+    if (__atomic_load_n(&inode->nlookup, __ATOMIC_ACQUIRE) > 0 || inode->unlinked) {
+        return FALSE;                                 /* 低层接口下节点号即inode指针 */
+    }
+    if (HITSZFS_IS_DIR(inode)) {
+        for (dentry = inode->dentrys; dentry != NULL; dentry = dentry->brother)
+        {
+            if (dentry->inode != NULL) {
+                return FALSE;
+            }
+        }
+    }
+    return TRUE;
+}
+/**
+ * @brief 淘汰一个inode: 脏则先写回，目录连同其子dentry一起释放
+ *
+ * @param inode
+ * @return int
+ */
+static int hitszfs_icache_evict(struct hitszfs_inode* inode)
+{
+    struct hitszfs_dentry* dentry;
+    struct hitszfs_dentry* next;
+    int                    ret;
+
+    ret = hitszfs_sync_inode(inode);
+    if (ret != HITSZFS_ERROR_NONE) {
+        return ret;
+    }
+    if (HITSZFS_IS_DIR(inode) && inode->dentrys != NULL) {
+        for (dentry = inode->dentrys; dentry != NULL; dentry = next)
+        {
+            next = dentry->brother;
+            hitszfs_free_dentry(dentry);
+        }
+        hitszfs_dcache_invalidate_all();              /* dcache中可能引用了被释放的dentry */
+    }
+    inode->dentry->inode = NULL;
+    hitszfs_free_inode(inode);
+    HITSZFS_STAT_INC(inode_evictions);
+    return HITSZFS_ERROR_NONE;
+}
+/**
+ * @brief 内存inode数超过上限时从LRU表尾淘汰，直到回到上限或没有可淘汰的inode，调用者需持有写锁
+ *
+ * 最多扫描一遍链表: 被访问过的inode清除referenced位后移回表头
+ *
+ */
+void hitszfs_icache_shrink()
+{
+    struct hitszfs_inode* inode = hitszfs_super.lru_tail;
+    struct hitszfs_inode* prev;
+    int                   scan  = hitszfs_super.inode_cnt;
+
+    if (hitszfs_options.inode_cache <= 0) {
+        return;
+    }
+    while (inode != NULL && scan-- > 0 && hitszfs_super.inode_cnt > hitszfs_options.inode_cache)
+    {
+        prev = inode->lru_prev;
+        if (inode->referenced) {
+            inode->referenced = FALSE;
+            pthread_mutex_lock(&hitszfs_super.icache_lock);
+            hitszfs_icache_unlink(inode);
+            hitszfs_icache_link(inode);
+            pthread_mutex_unlock(&hitszfs_super.icache_lock);
+        }
+        else if (hitszfs_icache_evictable(inode) && hitszfs_icache_evict(inode) != HITSZFS_ERROR_NONE) {
+            HITSZFS_DBG("[%s] write back ino %d failed\n", __func__, inode->ino);
+            break;
+        }
+        inode = prev;
+    }
+}
+/**
+ * @brief 只读操作结束后调用(不持锁)，内存inode数超限时取写锁淘汰
+ *
+ */
+void hitszfs_icache_balance()
+{
+    if (hitszfs_options.inode_cache <= 0 ||
+        __atomic_load_n(&hitszfs_super.inode_cnt, __ATOMIC_RELAXED) <= hitszfs_options.inode_cache) {
+        return;
+    }
+    HITSZFS_LOCK();
+    hitszfs_icache_shrink();
+    HITSZFS_UNLOCK();
+}
+/**
+ * @brief 已从目录删除的inode在lookup计数和打开计数都归零后释放，调用者持写锁
+ *
+ * @param inode
+ */
+void hitszfs_icache_put(struct hitszfs_inode* inode)
+{
+    struct hitszfs_dentry* dentry = inode->dentry;
+
+    if (!inode->unlinked || __atomic_load_n(&inode->nlookup, __ATOMIC_ACQUIRE) > 0 ||
+        __atomic_load_n(&inode->ref, __ATOMIC_ACQUIRE) > 0) {
+        return;
+    }
+    hitszfs_drop_inode(inode);
+    hitszfs_free_dentry(dentry);
+}
+/**
+ * @brief 目录项已从父目录摘下: 没有引用时立即释放(释放随父目录提交)，
+ * 否则断开父目录，等最后一个引用放下时由hitszfs_icache_put释放，调用者持写锁
+ *
+ * @param dentry
+ */
+void hitszfs_icache_detach(struct hitszfs_dentry* dentry)
+{
+    struct hitszfs_inode* inode = hitszfs_dentry_inode(dentry);
+
+    inode->unlinked = TRUE;
+    if (__atomic_load_n(&inode->nlookup, __ATOMIC_ACQUIRE) > 0 ||
+        __atomic_load_n(&inode->ref, __ATOMIC_ACQUIRE) > 0) {
+        dentry->parent = NULL;
+        return;
+    }
+    hitszfs_icache_put(inode);
+}
+/**
+ * @brief 释放n个引用(nlookup或ref)，不持锁调用
+ *
+ * 未删除的inode持读锁递减即可(删除须持写锁，不会同时发生)；
+ * 已删除的inode在写锁下递减并尝试释放，保证只释放一次
+ *
+ * @param inode
+ * @param cnt &inode->nlookup或&inode->ref
+ * @param n
+ */
+void hitszfs_icache_unref(struct hitszfs_inode* inode, int* cnt, int n)
+{
+    HITSZFS_RDLOCK();
+    if (!inode->unlinked) {
+        __atomic_sub_fetch(cnt, n, __ATOMIC_RELEASE);
+        HITSZFS_UNLOCK();
+        return;
+    }
+    HITSZFS_UNLOCK();
+    HITSZFS_LOCK();
+    __atomic_sub_fetch(cnt, n, __ATOMIC_RELEASE);
+    hitszfs_icache_put(inode);
+    HITSZFS_UNLOCK();
+}
@@ -0,0 +1,145 @@
+#include "../include/hitszfs.h"
+
+/******************************************************************************
+* SECTION: inode表块缓存
+*
+* inode按块打包存放(见HITSZFS_INO_OFS)，每次以整块读入inode表，
+* 块内全部inode_d留在内存中，之后读同一块内的inode不再访问磁盘。
+* 写回时同步更新已缓存的块，保证缓存与磁盘一致。
+* 缓存由itable_lock保护，多个读者可同时读入inode。
+*******************************************************************************/
+/**
+ * @brief 一次读入从第blk块开始、连续未缓存的若干inode表块(不跨块组)
+ *
+ * @param blk 全局inode表块号
+ * @param max_cnt 最多读入的块数
+ * @return int 读入的块数，出错时为负的错误码
+ */
+static int hitszfs_itable_load(int blk, int max_cnt)
+{
+    int      group   = blk / hitszfs_super.inode_blks;
+    int      grp_end = (group + 1) * hitszfs_super.inode_blks;
+    int      cnt     = 0;
+    int      i;
+    uint8_t* buf;
+
+    while (cnt < max_cnt && blk + cnt < grp_end && hitszfs_super.itable[blk + cnt] == NULL)
+    {
+        cnt++;
+    }
+    if (cnt == 0) {
+        return 0;
+    }
+    buf = (uint8_t *)malloc(HITSZFS_BLKS_SZ(cnt));
+    if (hitszfs_driver_read(HITSZFS_GROUP_OFS(group) + hitszfs_super.inode_offset +
+                            HITSZFS_BLKS_SZ(blk - group * hitszfs_super.inode_blks),
+                            buf, HITSZFS_BLKS_SZ(cnt)) != HITSZFS_ERROR_NONE) {
+        free(buf);
+        return -HITSZFS_ERROR_IO;
+    }
+    HITSZFS_STAT_INC(itable_reads);
+    for (i = 0; i < cnt; i++)
+    {
+        hitszfs_super.itable[blk + i] = (uint8_t *)malloc(HITSZFS_BLK_SZ());
+        memcpy(hitszfs_super.itable[blk + i], buf + HITSZFS_BLKS_SZ(i), HITSZFS_BLK_SZ());
+    }
+    free(buf);
+    return cnt;
+}
+/**
+ * @brief 读取ino号的磁盘inode，块未缓存时连同其后的若干块一起读入
+ *
+ * @param ino
+ * @param inode_d
+ * @return int
+ */
+int hitszfs_itable_read(int ino, struct hitszfs_inode_d* inode_d)
+{
+    int blk = HITSZFS_ITABLE_BLK(ino);
+    int ret;
+
+    pthread_mutex_lock(&hitszfs_super.itable_lock);
+    if (hitszfs_super.itable[blk] == NULL) {
+        ret = hitszfs_itable_load(blk, HITSZFS_ITABLE_RA);
+        if (ret < 0) {
+            pthread_mutex_unlock(&hitszfs_super.itable_lock);
+            return ret;
+        }
+    }
+    else {
+        HITSZFS_STAT_INC(itable_hits);
+    }
+    memcpy(inode_d, hitszfs_super.itable[blk] + HITSZFS_ITABLE_POS(ino), sizeof(struct hitszfs_inode_d));
+    pthread_mutex_unlock(&hitszfs_super.itable_lock);
+    return HITSZFS_ERROR_NONE;
+}
+/**
+ * @brief 预读inos所在的inode表块，相邻的块合并为一次读
+ *
+ * @param inos
+ * @param cnt
+ * @return int
+ */
+int hitszfs_itable_readahead(int* inos, int cnt)
+{
+    int      total = hitszfs_super.group_cnt * hitszfs_super.inode_blks;
+    uint8_t* wanted = (uint8_t *)calloc(total, sizeof(uint8_t));
+    int      blk, run, i;
+    int      ret = HITSZFS_ERROR_NONE;
+
+    for (i = 0; i < cnt; i++)
+    {
+        wanted[HITSZFS_ITABLE_BLK(inos[i])] = 1;
+    }
+    pthread_mutex_lock(&hitszfs_super.itable_lock);
+    for (blk = 0; blk < total; blk += run)
+    {
+        run = 1;
+        if (!wanted[blk] || hitszfs_super.itable[blk] != NULL) {
+            continue;
+        }
+        while (blk + run < total && wanted[blk + run])
+        {
+            run++;
+        }
+        run = hitszfs_itable_load(blk, run);          /* 遇到已缓存的块或块组边界时提前截断 */
+        if (run < 0) {
+            ret = run;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&hitszfs_super.itable_lock);
+    free(wanted);
+    return ret;
+}
+/**
+ * @brief 写回inode时更新缓存中的副本
+ *
+ * @param inode_d
+ */
+void hitszfs_itable_update(struct hitszfs_inode_d* inode_d)
+{
+    int blk = HITSZFS_ITABLE_BLK(inode_d->ino);
+
+    pthread_mutex_lock(&hitszfs_super.itable_lock);
+    if (hitszfs_super.itable[blk] != NULL) {
+        memcpy(hitszfs_super.itable[blk] + HITSZFS_ITABLE_POS(inode_d->ino), inode_d,
+               sizeof(struct hitszfs_inode_d));
+    }
+    pthread_mutex_unlock(&hitszfs_super.itable_lock);
+}
+/**
+ * @brief 释放全部inode表块缓存
+ *
+ */
+void hitszfs_itable_destroy()
+{
+    int blk;
+
+    for (blk = 0; blk < hitszfs_super.group_cnt * hitszfs_super.inode_blks; blk++)
+    {
+        free(hitszfs_super.itable[blk]);
+    }
+    free(hitszfs_super.itable);
+    hitszfs_super.itable = NULL;
+}
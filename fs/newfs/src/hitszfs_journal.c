@@ -0,0 +1,537 @@
+#include "../include/hitszfs.h"
+
+/******************************************************************************
+* SECTION: 元数据日志 (HITSZFS_FEATURE_JOURNAL)
+*
+* 回写不再直接覆盖原位置: 一批脏元数据(inode、目录块、位图、超级块)按块组装为一个事务，
+* 描述块 + 数据块 + 提交块一次顺序写入磁盘末尾的循环日志区。后台回写与sync把脏链表上的
+* 全部inode一起提交(组提交)，多个操作共用一次日志写；fsync/flush只提交该inode与位图。文件数据不进日志，回写时先写回原位置，
+* 再提交引用它的元数据(ordered模式)。
+*
+* 已提交的块在内存中保留最新内容(hitszfs_jblock)，读盘时覆盖原位置上的旧内容；
+* 检查点把这些块写回原位置后推进日志超级块的start，释放日志空间。
+* 检查点由后台回写线程在日志过半时执行，日志写满或卸载时同步执行。
+* 挂载时从start开始按序号重放校验和正确的事务，未写完的事务被丢弃。
+*
+* 日志与待检查点块只在持命名空间写锁(或挂载、卸载)时修改，
+* 读盘时的覆盖在持读锁时进行，二者由命名空间锁互斥。
+*******************************************************************************/
+struct hitszfs_journal {
+    off_t                   offset;         // 日志区磁盘偏移
+    int                     nblks;          // 日志区块数，第0块为日志超级块
+    int                     sz_blk;
+    int                     head;           // 下一个事务的写入位置
+    int                     used;           // 自上次检查点以来占用的块数(含末尾跳过的块)
+    uint32_t                seq;            // 下一个事务的序号
+    int                     start;          // 日志超级块中的start
+    uint32_t                start_seq;
+    struct hitszfs_jblock*  table[HITSZFS_JOURNAL_BUCKETS];
+    int                     cnt;            // 待检查点块数
+};
+static struct hitszfs_journal journal;
+
+static uint32_t hitszfs_journal_csum(uint32_t csum, const uint8_t* buf, int size)
+{
+    int i;
+
+    for (i = 0; i < size; i++)                        /* FNV-1a */
+    {
+        csum ^= buf[i];
+        csum *= 16777619u;
+    }
+    return csum;
+}
+
+static int hitszfs_journal_desc_cap()
+{
+    return (journal.sz_blk - sizeof(struct hitszfs_jdesc_d)) / sizeof(int64_t);
+}
+
+static off_t hitszfs_journal_blk_ofs(int blk)
+{
+    return journal.offset + (off_t)blk * journal.sz_blk;
+}
+
+static struct hitszfs_jblock** hitszfs_journal_bucket(off_t offset)
+{
+    return &journal.table[(offset / journal.sz_blk) & (HITSZFS_JOURNAL_BUCKETS - 1)];
+}
+
+static struct hitszfs_jblock* hitszfs_journal_find(off_t offset)
+{
+    struct hitszfs_jblock* jblock;
+
+    for (jblock = *hitszfs_journal_bucket(offset); jblock != NULL; jblock = jblock->next)
+    {
+        if (jblock->offset == offset) {
+            return jblock;
+        }
+    }
+    return NULL;
+}
+/**
+ * @brief 写日志超级块，记录重放起点
+ *
+ * @return int
+ */
+static int hitszfs_journal_write_sb()
+{
+    struct hitszfs_jsb_d jsb;
+
+    memset(&jsb, 0, sizeof(struct hitszfs_jsb_d));
+    jsb.head.magic = HITSZFS_JOURNAL_MAGIC;
+    jsb.head.type  = HITSZFS_JOURNAL_SB;
+    jsb.head.seq   = journal.start_seq;
+    jsb.nblks      = journal.nblks;
+    jsb.start      = journal.start;
+    return hitszfs_driver_write(journal.offset, (uint8_t *)&jsb, sizeof(struct hitszfs_jsb_d));
+}
+
+static void hitszfs_journal_init(struct hitszfs_super_d* super_d)
+{
+    hitszfs_journal_destroy();
+    journal.offset = super_d->journal_offset;
+    journal.nblks  = super_d->journal_blks;
+    journal.sz_blk = super_d->sz_blk;
+    journal.used   = 0;
+}
+/**
+ * @brief 格式化时初始化日志区
+ *
+ * 序号从当前时间开始，避免把日志区中上一次格式化留下的事务当作有效事务；
+ * 同一秒内重新格式化时时间不足以区分，若原日志超级块有效则再越过其后
+ * 可能残留的全部事务(每个事务至少占两块，不会超过nblks个序号)
+ *
+ * @param super_d
+ * @return int
+ */
+int hitszfs_journal_format(struct hitszfs_super_d* super_d)
+{
+    struct hitszfs_jsb_d jsb;
+    uint32_t             seq = (uint32_t)time(NULL);
+
+    hitszfs_journal_init(super_d);
+    if (hitszfs_driver_read(journal.offset, (uint8_t *)&jsb, sizeof(struct hitszfs_jsb_d)) == HITSZFS_ERROR_NONE &&
+        jsb.head.magic == HITSZFS_JOURNAL_MAGIC && jsb.head.type == HITSZFS_JOURNAL_SB &&
+        (int32_t)(jsb.head.seq + journal.nblks - seq) > 0) {
+        seq = jsb.head.seq + journal.nblks;
+    }
+    journal.head      = 1;
+    journal.seq       = seq;
+    journal.start     = journal.head;
+    journal.start_seq = journal.seq;
+    return hitszfs_journal_write_sb();
+}
+/**
+ * @brief 解析并重放位于pos、序号为seq的事务
+ *
+ * @param log 整个日志区的内容
+ * @param pos
+ * @param seq
+ * @return int 事务块数，不是完整有效的事务时返回0
+ */
+static int hitszfs_journal_replay_txn(uint8_t* log, int pos, uint32_t seq)
+{
+    struct hitszfs_jhead_d*   head;
+    struct hitszfs_jdesc_d*   desc;
+    struct hitszfs_jcommit_d* commit;
+    uint32_t                  csum = 0;
+    int                       cur = pos;
+    int                       i;
+
+    while (cur < journal.nblks)                       /* 先校验: 描述块与数据块直到提交块 */
+    {
+        head = (struct hitszfs_jhead_d *)(log + cur * journal.sz_blk);
+        if (head->magic != HITSZFS_JOURNAL_MAGIC || head->seq != seq) {
+            return 0;
+        }
+        if (head->type == HITSZFS_JOURNAL_COMMIT) {
+            break;
+        }
+        desc = (struct hitszfs_jdesc_d *)head;
+        if (head->type != HITSZFS_JOURNAL_DESC || desc->cnt <= 0 ||
+            desc->cnt > hitszfs_journal_desc_cap() || cur + 1 + desc->cnt >= journal.nblks) {
+            return 0;
+        }
+        csum = hitszfs_journal_csum(csum, log + (cur + 1) * journal.sz_blk, desc->cnt * journal.sz_blk);
+        cur += 1 + desc->cnt;
+    }
+    if (cur >= journal.nblks) {
+        return 0;
+    }
+    commit = (struct hitszfs_jcommit_d *)(log + cur * journal.sz_blk);
+    if (commit->csum != csum || commit->blks != cur + 1 - pos) {
+        return 0;
+    }
+    for (cur = pos; cur < pos + commit->blks - 1; cur += 1 + desc->cnt)
+    {                                                 /* 校验通过，写回原位置 */
+        desc = (struct hitszfs_jdesc_d *)(log + cur * journal.sz_blk);
+        for (i = 0; i < desc->cnt; i++)
+        {
+            if (hitszfs_driver_write(desc->offset[i], log + (cur + 1 + i) * journal.sz_blk,
+                                     journal.sz_blk) != HITSZFS_ERROR_NONE) {
+                return 0;
+            }
+        }
+    }
+    return commit->blks;
+}
+/**
+ * @brief 挂载时读取日志区并重放未检查点的事务
+ *
+ * @param super_d 磁盘超级块(日志区位置在格式化后不再变化，可能是旧内容)
+ * @return int
+ */
+int hitszfs_journal_load(struct hitszfs_super_d* super_d)
+{
+    struct hitszfs_jsb_d* jsb;
+    uint8_t*              log;
+    int                   pos, blks;
+    uint32_t              seq;
+
+    hitszfs_journal_init(super_d);
+    log = (uint8_t *)malloc(journal.nblks * journal.sz_blk);
+    if (hitszfs_driver_read(journal.offset, log, journal.nblks * journal.sz_blk) != HITSZFS_ERROR_NONE) {
+        free(log);
+        return -HITSZFS_ERROR_IO;
+    }
+    jsb = (struct hitszfs_jsb_d *)log;
+    if (jsb->head.magic != HITSZFS_JOURNAL_MAGIC || jsb->head.type != HITSZFS_JOURNAL_SB ||
+        jsb->nblks != journal.nblks || jsb->start < 1 || jsb->start >= journal.nblks) {
+        HITSZFS_DBG("[%s] bad journal superblock\n", __func__);
+        free(log);
+        return -HITSZFS_ERROR_IO;
+    }
+    pos = jsb->start;
+    seq = jsb->head.seq;
+    while (TRUE)
+    {
+        blks = hitszfs_journal_replay_txn(log, pos, seq);
+        if (blks == 0 && pos != 1) {                  /* 事务放不下时从日志区开头写起 */
+            blks = hitszfs_journal_replay_txn(log, 1, seq);
+            if (blks > 0) {
+                pos = 1;
+            }
+        }
+        if (blks == 0) {
+            break;
+        }
+        pos += blks;
+        seq++;
+        HITSZFS_STAT_INC(journal_replays);
+    }
+    free(log);
+    journal.head      = pos;
+    journal.seq       = seq;
+    journal.start     = pos;
+    journal.start_seq = seq;
+    return hitszfs_journal_write_sb();
+}
+/**
+ * @brief 检查点: 把已提交的块写回原位置，日志清空
+ *
+ * @return int
+ */
+int hitszfs_journal_checkpoint()
+{
+    struct hitszfs_io_batch batch;
+    struct hitszfs_jblock*  jblock;
+    int                     ret;
+    int                     i;
+
+    if (journal.cnt == 0 && journal.used == 0) {
+        return HITSZFS_ERROR_NONE;
+    }
+    hitszfs_batch_init(&batch);
+    for (i = 0; i < HITSZFS_JOURNAL_BUCKETS; i++)
+    {
+        for (jblock = journal.table[i]; jblock != NULL; jblock = jblock->next)
+        {
+            hitszfs_batch_add(&batch, jblock->offset, jblock->buf, journal.sz_blk);
+        }
+    }
+    ret = hitszfs_batch_write(&batch);
+    if (ret != HITSZFS_ERROR_NONE) {
+        return ret;
+    }
+    journal.start     = journal.head;                 /* 原位置已是最新，之前的事务不必再重放 */
+    journal.start_seq = journal.seq;
+    ret = hitszfs_journal_write_sb();
+    if (ret != HITSZFS_ERROR_NONE) {
+        return ret;
+    }
+    hitszfs_journal_destroy();
+    journal.used = 0;
+    HITSZFS_STAT_INC(journal_checkpoints);
+    return HITSZFS_ERROR_NONE;
+}
+/**
+ * @brief 日志占用超过HITSZFS_JOURNAL_CKPT_RATIO时需要做检查点
+ *
+ * @return boolean
+ */
+boolean hitszfs_journal_need_checkpoint()
+{
+    return HITSZFS_JOURNAL() && journal.used * 100 > (journal.nblks - 1) * HITSZFS_JOURNAL_CKPT_RATIO;
+}
+/**
+ * @brief 写请求最多覆盖的日志块数
+ *
+ * @param req
+ * @return int
+ */
+static int hitszfs_journal_req_blks(struct hitszfs_io_req* req)
+{
+    return (req->offset % journal.sz_blk + req->size + journal.sz_blk - 1) / journal.sz_blk;
+}
+/**
+ * @brief cnt个块组成的事务在日志中占用的块数(含描述块与提交块)
+ *
+ * @param cnt
+ * @return int
+ */
+static int hitszfs_journal_txn_blks(int cnt)
+{
+    int per_desc = hitszfs_journal_desc_cap();
+
+    return (cnt + per_desc - 1) / per_desc + cnt + 1;
+}
+/**
+ * @brief 批次比整个日志区还大时，按块拆成若干个放得下的事务依次提交，并释放批次
+ *
+ * 每个事务各自原子，但崩溃后可能只重放了前面几个，拆分计入journal_splits。
+ * 日志区按磁盘大小确定、文件数据不进日志，只有极大的回写才会走到这里
+ *
+ * @param batch
+ * @return int
+ */
+static int hitszfs_journal_commit_split(struct hitszfs_io_batch* batch)
+{
+    struct hitszfs_io_batch part;
+    struct hitszfs_io_req*  req;
+    int                     cap = journal.nblks - 1;
+    int                     ret = HITSZFS_ERROR_NONE;
+    off_t                   blk_ofs, lo, hi;
+    int                     i;
+
+    HITSZFS_DBG("[%s] splitting a transaction of %d requests\n", __func__, batch->cnt);
+    HITSZFS_STAT_INC(journal_splits);
+    hitszfs_batch_init(&part);
+    for (i = 0; i < batch->cnt; i++)
+    {
+        req = &batch->reqs[i];
+        for (blk_ofs = req->offset - req->offset % journal.sz_blk; blk_ofs < req->offset + req->size;
+             blk_ofs += journal.sz_blk)
+        {
+            if (hitszfs_journal_txn_blks(part.cnt + 1) > cap) {
+                ret = ret == HITSZFS_ERROR_NONE ? hitszfs_journal_commit(&part) : ret;
+                hitszfs_batch_free(&part);
+            }
+            lo = req->offset > blk_ofs ? req->offset : blk_ofs;
+            hi = req->offset + req->size < blk_ofs + journal.sz_blk ? req->offset + req->size
+                                                                    : blk_ofs + journal.sz_blk;
+            hitszfs_batch_add(&part, lo, req->buf + lo - req->offset, hi - lo);
+        }
+    }
+    ret = ret == HITSZFS_ERROR_NONE ? hitszfs_journal_commit(&part) : ret;
+    hitszfs_batch_free(&part);
+    hitszfs_batch_free(batch);
+    return ret;
+}
+/**
+ * @brief 将批次中的写请求作为一个事务写入日志，并释放批次
+ *
+ * 写请求按块合并到待检查点块中，同一块在一个事务中只记录一次。
+ * 日志空间不足时先做检查点；整个日志区都放不下时拆成多个事务(见hitszfs_journal_commit_split)
+ *
+ * @param batch
+ * @return int
+ */
+int hitszfs_journal_commit(struct hitszfs_io_batch* batch)
+{
+    struct hitszfs_jblock** txn;
+    struct hitszfs_jblock*  jblock;
+    struct hitszfs_io_req*  req;
+    struct hitszfs_jdesc_d* desc = NULL;
+    struct hitszfs_jcommit_d* commit;
+    uint8_t*                buf;
+    uint32_t                csum = 0;
+    int                     cap = journal.nblks - 1;
+    int                     per_desc = hitszfs_journal_desc_cap();
+    int                     bound = 0, cnt = 0, blks, skip;
+    off_t                   blk_ofs, lo, hi;
+    int                     ret, i, pos;
+
+    if (batch->cnt == 0) {
+        hitszfs_batch_init(batch);
+        return HITSZFS_ERROR_NONE;
+    }
+    for (i = 0; i < batch->cnt; i++)                  /* 按最坏情况估计事务块数 */
+    {
+        bound += hitszfs_journal_req_blks(&batch->reqs[i]);
+    }
+    blks = hitszfs_journal_txn_blks(bound);
+    if (blks > cap) {
+        return hitszfs_journal_commit_split(batch);
+    }
+    skip = journal.head + blks > journal.nblks ? journal.nblks - journal.head : 0;
+    if (journal.used + skip + blks > cap) {           /* 先腾出日志空间，不能在修改待检查点块之后做 */
+        ret = hitszfs_journal_checkpoint();
+        if (ret != HITSZFS_ERROR_NONE) {
+            return ret;
+        }
+    }
+
+    txn = (struct hitszfs_jblock **)malloc(bound * sizeof(struct hitszfs_jblock *));
+    for (i = 0; i < batch->cnt; i++)
+    {
+        req = &batch->reqs[i];
+        for (blk_ofs = req->offset - req->offset % journal.sz_blk; blk_ofs < req->offset + req->size;
+             blk_ofs += journal.sz_blk)
+        {
+            jblock = hitszfs_journal_find(blk_ofs);
+            if (jblock == NULL) {
+                jblock         = (struct hitszfs_jblock *)malloc(sizeof(struct hitszfs_jblock));
+                jblock->offset = blk_ofs;
+                jblock->buf    = (uint8_t *)malloc(journal.sz_blk);
+                jblock->in_txn = FALSE;               /* 请求覆盖整块时不必读出旧内容 */
+                if ((req->offset > blk_ofs || req->offset + req->size < blk_ofs + journal.sz_blk) &&
+                    hitszfs_driver_read(blk_ofs, jblock->buf, journal.sz_blk) != HITSZFS_ERROR_NONE) {
+                    free(jblock->buf);
+                    free(jblock);
+                    free(txn);
+                    return -HITSZFS_ERROR_IO;
+                }
+                jblock->next = *hitszfs_journal_bucket(blk_ofs);
+                *hitszfs_journal_bucket(blk_ofs) = jblock;
+                journal.cnt++;
+            }
+            lo = req->offset > blk_ofs ? req->offset : blk_ofs;
+            hi = req->offset + req->size < blk_ofs + journal.sz_blk ? req->offset + req->size
+                                                                    : blk_ofs + journal.sz_blk;
+            memcpy(jblock->buf + lo - blk_ofs, req->buf + lo - req->offset, hi - lo);
+            if (!jblock->in_txn) {
+                jblock->in_txn = TRUE;
+                txn[cnt++]     = jblock;
+            }
+        }
+        free(req->buf);
+    }
+    free(batch->reqs);
+    hitszfs_batch_init(batch);
+
+    blks = hitszfs_journal_txn_blks(cnt);             /* 不超过按bound估计的块数 */
+    if (journal.head + blks > journal.nblks) {
+        journal.used += journal.nblks - journal.head;
+        journal.head  = 1;
+    }
+                                                      /* 组装整个事务，一次顺序写入 */
+    buf = (uint8_t *)calloc(blks, journal.sz_blk);
+    pos = 0;
+    for (i = 0; i < cnt; i++)
+    {
+        if (i % per_desc == 0) {
+            desc              = (struct hitszfs_jdesc_d *)(buf + pos * journal.sz_blk);
+            desc->head.magic  = HITSZFS_JOURNAL_MAGIC;
+            desc->head.type   = HITSZFS_JOURNAL_DESC;
+            desc->head.seq    = journal.seq;
+            desc->cnt         = cnt - i < per_desc ? cnt - i : per_desc;
+            pos++;
+        }
+        desc->offset[i % per_desc] = txn[i]->offset;
+        memcpy(buf + pos * journal.sz_blk, txn[i]->buf, journal.sz_blk);
+        csum = hitszfs_journal_csum(csum, txn[i]->buf, journal.sz_blk);
+        txn[i]->in_txn = FALSE;
+        pos++;
+    }
+    commit             = (struct hitszfs_jcommit_d *)(buf + pos * journal.sz_blk);
+    commit->head.magic = HITSZFS_JOURNAL_MAGIC;
+    commit->head.type  = HITSZFS_JOURNAL_COMMIT;
+    commit->head.seq   = journal.seq;
+    commit->csum       = csum;
+    commit->blks       = blks;
+    ret = hitszfs_driver_write(hitszfs_journal_blk_ofs(journal.head), buf, blks * journal.sz_blk);
+    free(buf);
+    free(txn);
+    if (ret != HITSZFS_ERROR_NONE) {
+        return -HITSZFS_ERROR_IO;
+    }
+    journal.head += blks;
+    journal.used += blks;
+    if (journal.head == journal.nblks) {              /* 正好写到末尾，下一个事务从日志区开头写起 */
+        journal.head = 1;
+    }
+    journal.seq++;
+    HITSZFS_STAT_INC(journal_commits);
+    HITSZFS_STAT_ADD(journal_blocks, blks);
+    return HITSZFS_ERROR_NONE;
+}
+/**
+ * @brief 读盘后用待检查点块的最新内容覆盖[offset, offset + size)
+ *
+ * @param offset
+ * @param buf
+ * @param size
+ */
+void hitszfs_journal_overlay(off_t offset, uint8_t* buf, int size)
+{
+    struct hitszfs_jblock* jblock;
+    off_t                  blk_ofs, lo, hi;
+
+    if (journal.cnt == 0) {
+        return;
+    }
+    for (blk_ofs = offset - offset % journal.sz_blk; blk_ofs < offset + size; blk_ofs += journal.sz_blk)
+    {
+        jblock = hitszfs_journal_find(blk_ofs);
+        if (jblock == NULL) {
+            continue;
+        }
+        lo = offset > blk_ofs ? offset : blk_ofs;
+        hi = offset + size < blk_ofs + journal.sz_blk ? offset + size : blk_ofs + journal.sz_blk;
+        memcpy(buf + lo - offset, jblock->buf + lo - blk_ofs, hi - lo);
+    }
+}
+/**
+ * @brief [offset, offset + size)中是否有已提交而未检查点的块，有则原位置上是旧内容
+ *
+ * @param offset
+ * @param size
+ * @return boolean
+ */
+boolean hitszfs_journal_pinned(off_t offset, int size)
+{
+    off_t blk_ofs;
+
+    if (journal.cnt == 0) {
+        return FALSE;
+    }
+    for (blk_ofs = offset - offset % journal.sz_blk; blk_ofs < offset + size; blk_ofs += journal.sz_blk)
+    {
+        if (hitszfs_journal_find(blk_ofs) != NULL) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+/**
+ * @brief 丢弃全部待检查点块
+ *
+ */
+void hitszfs_journal_destroy()
+{
+    struct hitszfs_jblock* jblock;
+    int                    i;
+
+    for (i = 0; i < HITSZFS_JOURNAL_BUCKETS; i++)
+    {
+        while (journal.table[i] != NULL)
+        {
+            jblock           = journal.table[i];
+            journal.table[i] = jblock->next;
+            free(jblock->buf);
+            free(jblock);
+        }
+    }
+    journal.cnt = 0;
+}
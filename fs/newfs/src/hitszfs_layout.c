@@ -0,0 +1,96 @@
+#include "../include/hitszfs.h"
+
+/******************************************************************************
+* SECTION: 磁盘布局规划 (mkfs)
+* 
+* 磁盘被划分为若干块组，每个块组的布局相同:
+* | Super(1) | Inode Map(1) | Data Map(1) | Inode(x) | DATA(*) |
+* 块组0的Super为主超级块，其余块组的Super位置存放超级块备份。
+* 每个块组的块数不超过一个位图块能表示的位数，使位图与inode表靠近其管理的数据块。
+* 元数据日志区(若有)位于磁盘末尾、全部块组之后，不占用任何块组的数据位图。
+*******************************************************************************/
+/**
+ * @brief 根据磁盘大小、块大小和每inode字节数规划布局，结果写入super_d
+ * 
+ * @param sz_disk 磁盘大小，块数超过int范围(块号与位图按int计算)时拒绝
+ * @param sz_io 设备IO单位
+ * @param sz_blk 块大小，1024或4096
+ * @param bytes_per_inode 每多少字节数据空间分配一个inode
+ * @param journal_blks 日志区块数，0为不带日志，HITSZFS_JOURNAL_AUTO按磁盘大小确定
+ * @param super_d 输出
+ * @return int 
+ */
+int hitszfs_plan_layout(off_t sz_disk, int sz_io, int sz_blk, int bytes_per_inode, int journal_blks,
+                        struct hitszfs_super_d* super_d) 
+{
+    int total_blks, super_blks, meta_blks, last_blks, last_data;
+    int blks_per_group, inodes_per_group, data_per_group, inode_blks, group_cnt;
+    int super_sz = sizeof(struct hitszfs_super_d);
+    int inode_per_blk;
+
+    if ((sz_blk != 1024 && sz_blk != 4096) || sz_blk % sz_io != 0 || bytes_per_inode < sz_blk) {
+        HITSZFS_DBG("[%s] invalid block size %d / bytes per inode %d\n", __func__, sz_blk, bytes_per_inode);
+        return -HITSZFS_ERROR_INVAL;
+    }
+    if (sz_disk / sz_blk > HITSZFS_MAX_BLKS) {
+        HITSZFS_DBG("[%s] disk too large: %lld bytes\n", __func__, (long long)sz_disk);
+        return -HITSZFS_ERROR_INVAL;
+    }
+    total_blks       = (int)(sz_disk / sz_blk);
+    if (journal_blks == HITSZFS_JOURNAL_AUTO) {       /* 足以容纳一次回写的全部元数据，大磁盘上块组多、位图块多 */
+        journal_blks = total_blks / HITSZFS_JOURNAL_DISK_RATIO;
+        journal_blks = journal_blks > HITSZFS_JOURNAL_MIN_BLKS ? journal_blks : HITSZFS_JOURNAL_MIN_BLKS;
+        journal_blks = journal_blks < total_blks / 4 ? journal_blks : total_blks / 4;
+    }
+    if (journal_blks < 0 || (journal_blks > 0 && (journal_blks < 8 || journal_blks > total_blks / 4)) ||
+        (long long)journal_blks * sz_blk > INT_MAX) {     /* 重放时整个日志区一次读入 */
+        HITSZFS_DBG("[%s] invalid journal size %d blocks\n", __func__, journal_blks);
+        return -HITSZFS_ERROR_INVAL;
+    }
+    total_blks      -= journal_blks;                  /* 日志区放在磁盘末尾 */
+    super_blks       = HITSZFS_ROUND_UP(super_sz, sz_blk) / sz_blk;
+    blks_per_group   = sz_blk * UINT8_BITS < total_blks ? sz_blk * UINT8_BITS : total_blks;
+                                                      /* inode数按字节比例估算，受一个位图块限制 */
+    inodes_per_group = (int)((long long)blks_per_group * sz_blk / bytes_per_inode);
+    inodes_per_group = HITSZFS_ROUND_UP(inodes_per_group, UINT8_BITS);
+    if (inodes_per_group > sz_blk * UINT8_BITS) {
+        inodes_per_group = sz_blk * UINT8_BITS;
+    }
+    inode_per_blk    = sz_blk / HITSZFS_INO_SZ();      /* inode不跨块存放 */
+    inode_blks       = (inodes_per_group + inode_per_blk - 1) / inode_per_blk;
+    meta_blks        = super_blks + 2 + inode_blks;
+    data_per_group   = blks_per_group - meta_blks;
+    if (data_per_group < UINT8_BITS) {
+        HITSZFS_DBG("[%s] disk too small: %d blocks\n", __func__, total_blks);
+        return -HITSZFS_ERROR_NOSPACE;
+    }
+    data_per_group   = HITSZFS_ROUND_DOWN(data_per_group, UINT8_BITS);
+
+    group_cnt        = total_blks / blks_per_group;
+    last_blks        = total_blks % blks_per_group;  /* 末尾不完整的块组，放得下数据时保留 */
+    last_data        = 0;
+    if (last_blks - meta_blks >= UINT8_BITS) {
+        last_data = last_blks - meta_blks < data_per_group ? last_blks - meta_blks : data_per_group;
+        group_cnt++;
+    }
+
+    super_d->sz_blk           = sz_blk;
+    super_d->group_cnt        = group_cnt;
+    super_d->blks_per_group   = blks_per_group;
+    super_d->inodes_per_group = inodes_per_group;
+    super_d->data_per_group   = data_per_group;
+    super_d->inode_blks       = inode_blks;
+    super_d->max_ino          = group_cnt * inodes_per_group;
+    super_d->max_data         = last_data == 0 ? group_cnt * data_per_group
+                                               : (group_cnt - 1) * data_per_group + last_data;
+    super_d->map_inode_blks   = 1;
+    super_d->map_data_blks    = 1;
+    super_d->map_inode_offset = HITSZFS_SUPER_OFS + super_blks * sz_blk;
+    super_d->map_data_offset  = super_d->map_inode_offset + super_d->map_inode_blks * sz_blk;
+    super_d->inode_offset     = super_d->map_data_offset + super_d->map_data_blks * sz_blk;
+    super_d->data_offset      = super_d->inode_offset + inode_blks * sz_blk;
+    super_d->journal_offset   = (int64_t)total_blks * sz_blk;
+    super_d->journal_blks     = journal_blks;
+    super_d->sz_usage         = 0;
+    return HITSZFS_ERROR_NONE;
+}
@@ -0,0 +1,834 @@
+#include "../include/hitszfs.h"
+#include "fuse_lowlevel.h"
+
+/******************************************************************************
+* SECTION: 说明
+*
+* hitszfs的FUSE低层(inode)接口版本，与hitszfs.c共用hitszfs_core，只替换入口。
+* 内核按节点号而不是路径发起请求，节点号即内存inode的地址(根目录为FUSE_ROOT_ID)，
+* 各操作直接在父目录的哈希索引中按名字查找，不再逐级解析路径。
+*
+* lookup/mknod/mkdir/symlink每回复一次目录项，inode->nlookup加一，forget时减去，
+* nlookup非0的inode不会被淘汰，节点号因此一直有效。
+* 删除仍被内核引用或被打开的inode时只从目录摘下(unlinked)，
+* 最后一次forget/release时再归还数据块和inode号(hitszfs_icache_detach)。
+*******************************************************************************/
+
+/******************************************************************************
+* SECTION: 宏定义
+*******************************************************************************/
+#define OPTION(t, p)        { t, offsetof(struct custom_options, p), 1 }
+#define OPTION_OFF(t, p)    { t, offsetof(struct custom_options, p), 0 }
+
+/******************************************************************************
+* SECTION: Global Static Var
+*******************************************************************************/
+static const struct fuse_opt option_spec[] = {		/* 与hitszfs.c相同，另加内核缓存时间 */
+	OPTION("--device=%s", device),
+	OPTION("--blk_sz=%d", blk_sz),
+	OPTION("--bytes_per_inode=%d", bytes_per_inode),
+	OPTION("--dir_index", dir_index),
+	OPTION("--var_dentry", var_dentry),
+	OPTION("--journal_blks=%d", journal_blks),
+	OPTION("--inode_cache=%d", inode_cache),
+	OPTION("--dirty_age=%d", dirty_age),
+	OPTION("--dirty_ratio=%d", dirty_ratio),
+	OPTION("--readahead=%d", readahead),
+	OPTION("entry_timeout=%lf", entry_timeout),
+	OPTION("attr_timeout=%lf", attr_timeout),
+	OPTION("kernel_cache", kernel_cache),
+	OPTION_OFF("nokernel_cache", kernel_cache),
+	FUSE_OPT_END
+};
+
+static struct fuse_session* hitszfs_ll_se;
+
+/******************************************************************************
+* SECTION: 节点号与引用计数
+*******************************************************************************/
+/**
+ * @brief 节点号转为内存inode
+ *
+ * @param ino
+ * @return struct hitszfs_inode*
+ */
+static struct hitszfs_inode* hitszfs_ll_inode(fuse_ino_t ino) {
+	if (ino == FUSE_ROOT_ID) {
+		return hitszfs_super.root_dentry->inode;
+	}
+	return (struct hitszfs_inode*)(uintptr_t)ino;
+}
+
+/**
+ * @brief 填充回复给内核的目录项并增加lookup计数，调用者持锁
+ *
+ * @param inode 为NULL时回复负缓存项(ino为0)
+ * @param e
+ */
+static void hitszfs_ll_entry(struct hitszfs_inode* inode, struct fuse_entry_param* e) {
+	memset(e, 0, sizeof(struct fuse_entry_param));
+	e->entry_timeout = hitszfs_options.entry_timeout;
+	if (inode == NULL) {
+		return;
+	}
+	__atomic_add_fetch(&inode->nlookup, 1, __ATOMIC_RELAXED);
+	e->ino = inode->dentry == hitszfs_super.root_dentry ? FUSE_ROOT_ID : (fuse_ino_t)(uintptr_t)inode;
+	e->attr_timeout = hitszfs_options.attr_timeout;
+	hitszfs_fill_stat(inode, &e->attr);
+}
+
+/******************************************************************************
+* SECTION: 挂载与卸载
+*******************************************************************************/
+/**
+ * @brief 挂载（mount）文件系统
+ *
+ * @param userdata 可忽略
+ * @param conn 可忽略
+ */
+static void hitszfs_ll_init(void* userdata, struct fuse_conn_info* conn) {
+	hitszfs_conn_init(conn);
+	if (hitszfs_mount(hitszfs_options) != HITSZFS_ERROR_NONE) {
+		HITSZFS_DBG("[%s] mount error\n", __func__);
+		fuse_session_exit(hitszfs_ll_se);
+		return;
+	}
+	hitszfs_flusher_start();
+	hitszfs_file_ra_start();
+}
+
+/**
+ * @brief 卸载（umount）文件系统
+ *
+ * @param userdata 可忽略
+ */
+static void hitszfs_ll_destroy(void* userdata) {
+	hitszfs_file_ra_stop();
+	hitszfs_flusher_stop();
+	if (hitszfs_umount() != HITSZFS_ERROR_NONE) {
+		HITSZFS_DBG("[%s] unmount error\n", __func__);
+	}
+}
+
+/******************************************************************************
+* SECTION: 目录项操作
+*******************************************************************************/
+/**
+ * @brief 在父目录中按名字查找，找不到时回复负缓存项
+ *
+ * @param req
+ * @param parent 父目录节点号
+ * @param name
+ */
+static void hitszfs_ll_lookup(fuse_req_t req, fuse_ino_t parent, const char* name) {
+	struct hitszfs_inode*   dir;
+	struct hitszfs_dentry*  dentry;
+	struct fuse_entry_param e;
+
+	HITSZFS_RDLOCK();
+	dir = hitszfs_ll_inode(parent);
+	if (!HITSZFS_IS_DIR(dir)) {
+		HITSZFS_UNLOCK();
+		fuse_reply_err(req, HITSZFS_ERROR_NOTDIR);
+		return;
+	}
+	dentry = hitszfs_dir_lookup(dir, name);
+	hitszfs_ll_entry(dentry != NULL ? hitszfs_dentry_inode(dentry) : NULL, &e);
+	HITSZFS_UNLOCK();
+	fuse_reply_entry(req, &e);
+	hitszfs_icache_balance();
+}
+
+/**
+ * @brief 内核释放节点号的nlookup个引用
+ *
+ * @param req
+ * @param ino
+ * @param nlookup
+ */
+static void hitszfs_ll_forget(fuse_req_t req, fuse_ino_t ino, unsigned long nlookup) {
+	struct hitszfs_inode* inode = hitszfs_ll_inode(ino);
+
+	if (ino != FUSE_ROOT_ID) {
+		hitszfs_icache_unref(inode, &inode->nlookup, (int)nlookup);
+	}
+	fuse_reply_none(req);
+	hitszfs_icache_balance();
+}
+
+/**
+ * @brief 在父目录下创建文件、目录或符号链接，成功时填充回复的目录项
+ *
+ * @param dir 父目录
+ * @param name
+ * @param ftype
+ * @param target 符号链接目标，其余类型为NULL
+ * @param e
+ * @return int 0成功，否则失败
+ */
+static int hitszfs_ll_new_node(struct hitszfs_inode* dir, const char* name, HITSZFS_FILE_TYPE ftype,
+							   const char* target, struct fuse_entry_param* e) {
+	struct hitszfs_dentry* dentry;
+	struct hitszfs_inode*  inode;
+
+	if (strlen(name) >= MAX_NAME_LEN) {
+		return -HITSZFS_ERROR_NAMETOOLONG;
+	}
+	HITSZFS_LOCK();
+	hitszfs_icache_shrink();
+	if (hitszfs_dir_lookup(dir, name) != NULL) {
+		HITSZFS_UNLOCK();
+		return -HITSZFS_ERROR_EXISTS;
+	}
+	dentry = new_dentry((char*)name, ftype);
+	dentry->parent = dir->dentry;
+	inode = hitszfs_alloc_inode(dentry);
+	if (inode == NULL || (target != NULL && hitszfs_reserve_data(inode, strlen(target)) != HITSZFS_ERROR_NONE) ||
+		hitszfs_alloc_dentry(dir, dentry) < 0) {
+		if (inode != NULL) {
+			hitszfs_drop_inode(inode);
+		}
+		hitszfs_free_dentry(dentry);
+		HITSZFS_UNLOCK();
+		return -HITSZFS_ERROR_NOSPACE;
+	}
+	if (target != NULL) {
+		inode->size = strlen(target);
+		memcpy(inode->data, target, inode->size);
+		hitszfs_mark_inode_dirty(inode, HITSZFS_FLAG_BUF_DIRTY | HITSZFS_FLAG_DATA_DIRTY);
+	}
+	hitszfs_ll_entry(inode, e);
+	HITSZFS_UNLOCK();
+	return HITSZFS_ERROR_NONE;
+}
+
+/**
+ * @brief 创建文件
+ *
+ * @param req
+ * @param parent
+ * @param name
+ * @param mode 只支持普通文件和目录
+ * @param rdev 可忽略
+ */
+static void hitszfs_ll_mknod(fuse_req_t req, fuse_ino_t parent, const char* name, mode_t mode, dev_t rdev) {
+	struct fuse_entry_param e;
+	int ret;
+
+	if (!S_ISREG(mode) && !S_ISDIR(mode)) {
+		fuse_reply_err(req, HITSZFS_ERROR_UNSUPPORTED);
+		return;
+	}
+	ret = hitszfs_ll_new_node(hitszfs_ll_inode(parent), name,
+							  S_ISDIR(mode) ? HITSZFS_DIR : HITSZFS_REG_FILE, NULL, &e);
+	if (ret != HITSZFS_ERROR_NONE) {
+		fuse_reply_err(req, -ret);
+		return;
+	}
+	fuse_reply_entry(req, &e);
+}
+
+/**
+ * @brief 创建目录
+ *
+ * @param req
+ * @param parent
+ * @param name
+ * @param mode 可忽略
+ */
+static void hitszfs_ll_mkdir(fuse_req_t req, fuse_ino_t parent, const char* name, mode_t mode) {
+	struct fuse_entry_param e;
+	int ret;
+
+	ret = hitszfs_ll_new_node(hitszfs_ll_inode(parent), name, HITSZFS_DIR, NULL, &e);
+	if (ret != HITSZFS_ERROR_NONE) {
+		fuse_reply_err(req, -ret);
+		return;
+	}
+	fuse_reply_entry(req, &e);
+}
+
+/**
+ * @brief 创建符号链接
+ *
+ * @param req
+ * @param link 链接目标
+ * @param parent
+ * @param name
+ */
+static void hitszfs_ll_symlink(fuse_req_t req, const char* link, fuse_ino_t parent, const char* name) {
+	struct fuse_entry_param e;
+	int ret;
+
+	if (strlen(link) > HITSZFS_BLKS_SZ(HITSZFS_DATA_PER_FILE)) {
+		fuse_reply_err(req, HITSZFS_ERROR_NAMETOOLONG);
+		return;
+	}
+	ret = hitszfs_ll_new_node(hitszfs_ll_inode(parent), name, HITSZFS_SYM_LINK, link, &e);
+	if (ret != HITSZFS_ERROR_NONE) {
+		fuse_reply_err(req, -ret);
+		return;
+	}
+	fuse_reply_entry(req, &e);
+}
+
+/**
+ * @brief 删除文件或空目录
+ *
+ * @param parent
+ * @param name
+ * @param is_dir 为TRUE时是rmdir
+ * @return int 0成功，否则失败
+ */
+static int hitszfs_ll_remove(fuse_ino_t parent, const char* name, boolean is_dir) {
+	struct hitszfs_inode*  dir;
+	struct hitszfs_dentry* dentry;
+	struct hitszfs_inode*  inode;
+	int ret;
+
+	HITSZFS_LOCK();
+	dir    = hitszfs_ll_inode(parent);
+	dentry = hitszfs_dir_lookup(dir, name);
+	if (dentry == NULL) {
+		HITSZFS_UNLOCK();
+		return -HITSZFS_ERROR_NOTFOUND;
+	}
+	inode = hitszfs_dentry_inode(dentry);
+	if (is_dir && !HITSZFS_IS_DIR(inode)) {
+		ret = -HITSZFS_ERROR_NOTDIR;
+	}
+	else if (!is_dir && HITSZFS_IS_DIR(inode)) {
+		ret = -HITSZFS_ERROR_ISDIR;
+	}
+	else if (is_dir && inode->dir_cnt != 0) {
+		ret = -HITSZFS_ERROR_NOTEMPTY;
+	}
+	else {
+		ret = hitszfs_dir_remove(dir, dentry);
+	}
+	if (ret == HITSZFS_ERROR_NONE) {
+		hitszfs_icache_detach(dentry);
+		hitszfs_dcache_invalidate_all();
+	}
+	HITSZFS_UNLOCK();
+	return ret;
+}
+
+/**
+ * @brief 删除文件
+ *
+ * @param req
+ * @param parent
+ * @param name
+ */
+static void hitszfs_ll_unlink(fuse_req_t req, fuse_ino_t parent, const char* name) {
+	fuse_reply_err(req, -hitszfs_ll_remove(parent, name, FALSE));
+}
+
+/**
+ * @brief 删除目录
+ *
+ * @param req
+ * @param parent
+ * @param name
+ */
+static void hitszfs_ll_rmdir(fuse_req_t req, fuse_ino_t parent, const char* name) {
+	fuse_reply_err(req, -hitszfs_ll_remove(parent, name, TRUE));
+}
+
+/**
+ * @brief 重命名，只重新挂接dentry；目标已存在时按删除处理
+ *
+ * @param req
+ * @param parent
+ * @param name
+ * @param newparent
+ * @param newname
+ */
+static void hitszfs_ll_rename(fuse_req_t req, fuse_ino_t parent, const char* name,
+							  fuse_ino_t newparent, const char* newname) {
+	struct hitszfs_inode*  new_dir;
+	struct hitszfs_dentry* src;
+	struct hitszfs_dentry* dst;
+	int ret = HITSZFS_ERROR_NONE;
+
+	if (strlen(newname) >= MAX_NAME_LEN) {
+		fuse_reply_err(req, HITSZFS_ERROR_NAMETOOLONG);
+		return;
+	}
+	HITSZFS_LOCK();
+	new_dir = hitszfs_ll_inode(newparent);
+	src     = hitszfs_dir_lookup(hitszfs_ll_inode(parent), name);
+	dst     = hitszfs_dir_lookup(new_dir, newname);
+	if (src == NULL) {
+		ret = -HITSZFS_ERROR_NOTFOUND;
+	}
+	else if (dst == src) {
+		dst = NULL;
+	}
+	else if (dst != NULL && HITSZFS_IS_DIR(hitszfs_dentry_inode(src)) != HITSZFS_IS_DIR(hitszfs_dentry_inode(dst))) {
+		ret = HITSZFS_IS_DIR(dst->inode) ? -HITSZFS_ERROR_ISDIR : -HITSZFS_ERROR_NOTDIR;
+	}
+	else if (dst != NULL && HITSZFS_IS_DIR(dst->inode) && dst->inode->dir_cnt != 0) {
+		ret = -HITSZFS_ERROR_NOTEMPTY;
+	}
+	else {
+		ret = hitszfs_dir_rename(src, new_dir, newname, dst);
+		if (ret == HITSZFS_ERROR_NONE && dst != NULL) {
+			hitszfs_icache_detach(dst);
+		}
+		hitszfs_dcache_invalidate_all();
+	}
+	HITSZFS_UNLOCK();
+	fuse_reply_err(req, -ret);
+}
+
+/******************************************************************************
+* SECTION: 属性
+*******************************************************************************/
+/**
+ * @brief 获取属性
+ *
+ * @param req
+ * @param ino
+ * @param fi 可忽略
+ */
+static void hitszfs_ll_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+	struct stat st;
+
+	HITSZFS_RDLOCK();
+	hitszfs_fill_stat(hitszfs_ll_inode(ino), &st);
+	HITSZFS_UNLOCK();
+	fuse_reply_attr(req, &st, hitszfs_options.attr_timeout);
+}
+
+/**
+ * @brief 修改属性，支持文件大小(同hitszfs_truncate)、访问时间和修改时间(同hitszfs_utimens)
+ *
+ * @param req
+ * @param ino
+ * @param attr
+ * @param to_set
+ * @param fi
+ */
+static void hitszfs_ll_setattr(fuse_req_t req, fuse_ino_t ino, struct stat* attr, int to_set,
+							   struct fuse_file_info* fi) {
+	struct hitszfs_inode* inode;
+	time_t now = time(NULL);
+	int ret;
+
+	if (to_set & FUSE_SET_ATTR_SIZE) {
+		HITSZFS_LOCK();
+		inode = hitszfs_ll_inode(ino);
+		if (!HITSZFS_IS_REG(inode)) {
+			ret = HITSZFS_IS_DIR(inode) ? -HITSZFS_ERROR_ISDIR : -HITSZFS_ERROR_INVAL;
+		}
+		else {
+			ret = hitszfs_file_truncate(inode, attr->st_size);
+		}
+		HITSZFS_UNLOCK();
+		if (ret != HITSZFS_ERROR_NONE) {
+			fuse_reply_err(req, -ret);
+			return;
+		}
+	}
+	if (to_set & (FUSE_SET_ATTR_ATIME | FUSE_SET_ATTR_MTIME)) {
+		HITSZFS_LOCK();
+		inode = hitszfs_ll_inode(ino);
+		if (to_set & FUSE_SET_ATTR_ATIME) {
+			inode->atime = (to_set & FUSE_SET_ATTR_ATIME_NOW) ? now : attr->st_atime;
+		}
+		if (to_set & FUSE_SET_ATTR_MTIME) {
+			inode->mtime = (to_set & FUSE_SET_ATTR_MTIME_NOW) ? now : attr->st_mtime;
+		}
+		inode->ctime = now;
+		hitszfs_mark_inode_dirty(inode, HITSZFS_FLAG_BUF_DIRTY);
+		HITSZFS_UNLOCK();
+	}
+	hitszfs_ll_getattr(req, ino, fi);
+}
+
+/**
+ * @brief 读取符号链接的目标
+ *
+ * @param req
+ * @param ino
+ */
+static void hitszfs_ll_readlink(fuse_req_t req, fuse_ino_t ino) {
+	struct hitszfs_inode* inode;
+	char* link;
+
+	HITSZFS_RDLOCK();
+	inode = hitszfs_ll_inode(ino);
+	if (!HITSZFS_IS_SYM_LINK(inode)) {
+		HITSZFS_UNLOCK();
+		fuse_reply_err(req, HITSZFS_ERROR_INVAL);
+		return;
+	}
+	link = (char*)malloc(inode->size + 1);
+	memcpy(link, inode->data, inode->size);
+	link[inode->size] = '\0';
+	HITSZFS_UNLOCK();
+	fuse_reply_readlink(req, link);
+	free(link);
+}
+
+/**
+ * @brief 节点存在即可访问，权限固定为HITSZFS_DEFAULT_PERM
+ *
+ * @param req
+ * @param ino
+ * @param mask
+ */
+static void hitszfs_ll_access(fuse_req_t req, fuse_ino_t ino, int mask) {
+	fuse_reply_err(req, HITSZFS_ERROR_NONE);
+}
+
+/**
+ * @brief 查询文件系统容量(df)，由空闲计数直接给出，不加命名空间锁
+ *
+ * @param req
+ * @param ino
+ */
+static void hitszfs_ll_statfs(fuse_req_t req, fuse_ino_t ino) {
+	struct statvfs st;
+
+	hitszfs_fill_statfs(&st);
+	fuse_reply_statfs(req, &st);
+}
+
+/******************************************************************************
+* SECTION: 文件与目录句柄
+*******************************************************************************/
+/**
+ * @brief 打开文件，fh保存文件句柄；节点号有效期间inode不会被淘汰，无需加锁
+ *
+ * @param req
+ * @param ino
+ * @param fi
+ */
+static void hitszfs_ll_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+	struct hitszfs_inode* inode = hitszfs_ll_inode(ino);
+
+	__atomic_add_fetch(&inode->ref, 1, __ATOMIC_RELAXED);
+	fi->fh = (uint64_t)(uintptr_t)hitszfs_file_open(inode);
+	fi->keep_cache = hitszfs_options.kernel_cache;
+	fuse_reply_open(req, fi);
+}
+
+/**
+ * @brief 关闭文件
+ *
+ * @param req
+ * @param ino
+ * @param fi
+ */
+static void hitszfs_ll_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+	struct hitszfs_file_handle* fh = (struct hitszfs_file_handle*)(uintptr_t)fi->fh;
+	struct hitszfs_inode* inode = fh->inode;
+
+	hitszfs_file_close(fh);
+	hitszfs_icache_unref(inode, &inode->ref, 1);
+	fuse_reply_err(req, HITSZFS_ERROR_NONE);
+	hitszfs_icache_balance();
+}
+
+/**
+ * @brief 读文件: 持读锁直到fuse_reply_data完成，内容与磁盘一致时回复镜像文件上的fd段(splice)，
+ * 否则直接借用inode->data而不复制。回复完成前数据块不会被释放重用，inode->data也不会被改写
+ *
+ * @param req
+ * @param ino
+ * @param size
+ * @param off
+ * @param fi fh为open时创建的文件句柄
+ */
+static void hitszfs_ll_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info* fi) {
+	struct hitszfs_file_handle* fh = (struct hitszfs_file_handle*)(uintptr_t)fi->fh;
+	struct fuse_bufvec* buf = NULL;
+	int ret;
+	(void)ino;
+
+	HITSZFS_RDLOCK();
+	ret = hitszfs_file_read_buf(fh, &buf, size, off, TRUE);
+	if (ret != HITSZFS_ERROR_NONE) {
+		HITSZFS_UNLOCK();
+		fuse_reply_err(req, -ret);
+	}
+	else {
+		fuse_reply_data(req, buf, FUSE_BUF_SPLICE_MOVE);
+		HITSZFS_UNLOCK();
+	}
+	free(buf);
+}
+
+/**
+ * @brief 写文件，同hitszfs_write_buf
+ *
+ * @param req
+ * @param ino
+ * @param bufv 启用splice时为FUSE管道
+ * @param off
+ * @param fi fh为open时创建的文件句柄
+ */
+static void hitszfs_ll_write_buf(fuse_req_t req, fuse_ino_t ino, struct fuse_bufvec* bufv, off_t off,
+								 struct fuse_file_info* fi) {
+	struct hitszfs_file_handle* fh = (struct hitszfs_file_handle*)(uintptr_t)fi->fh;
+	int ret;
+	(void)ino;
+
+	HITSZFS_LOCK();
+	ret = hitszfs_file_write(fh->inode, bufv, off);
+	HITSZFS_UNLOCK();
+	if (ret < 0) {
+		fuse_reply_err(req, -ret);
+	}
+	else {
+		fuse_reply_write(req, ret);
+	}
+}
+
+/**
+ * @brief 回写单个inode，先持读锁检查，不脏时不必取写锁
+ *
+ * @param inode
+ * @return int 0成功，否则失败
+ */
+static int hitszfs_ll_sync(struct hitszfs_inode* inode) {
+	boolean is_clean;
+	int ret;
+
+	HITSZFS_RDLOCK();
+	is_clean = inode->flags == 0 && !(hitszfs_super.flags & HITSZFS_FLAG_BUF_DIRTY);
+	HITSZFS_UNLOCK();
+	if (is_clean) {
+		return HITSZFS_ERROR_NONE;
+	}
+	HITSZFS_LOCK();
+	ret = hitszfs_sync_inode(inode);
+	HITSZFS_UNLOCK();
+	return ret;
+}
+
+/**
+ * @brief close时回写该文件
+ *
+ * @param req
+ * @param ino
+ * @param fi
+ */
+static void hitszfs_ll_flush(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+	fuse_reply_err(req, -hitszfs_ll_sync(hitszfs_ll_inode(ino)));
+}
+
+/**
+ * @brief fsync，回写该文件
+ *
+ * @param req
+ * @param ino
+ * @param datasync
+ * @param fi
+ */
+static void hitszfs_ll_fsync(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info* fi) {
+	fuse_reply_err(req, -hitszfs_ll_sync(hitszfs_ll_inode(ino)));
+}
+
+/**
+ * @brief 打开目录，fh保存目录句柄
+ *
+ * @param req
+ * @param ino
+ * @param fi
+ */
+static void hitszfs_ll_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+	struct hitszfs_inode* inode = hitszfs_ll_inode(ino);
+
+	__atomic_add_fetch(&inode->ref, 1, __ATOMIC_RELAXED);
+	fi->fh = (uint64_t)(uintptr_t)hitszfs_dir_open(inode);
+	fuse_reply_open(req, fi);
+}
+
+/**
+ * @brief 按目录快照填满size字节的缓冲区，off为快照下标，与hitszfs_readdir相同
+ *
+ * @param req
+ * @param ino
+ * @param size
+ * @param off
+ * @param fi
+ */
+static void hitszfs_ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+							   struct fuse_file_info* fi) {
+	struct hitszfs_dir_handle* dh = (struct hitszfs_dir_handle*)(uintptr_t)fi->fh;
+	struct stat st;
+	char*  buf;
+	size_t used = 0;
+	size_t len;
+	int    ret = HITSZFS_ERROR_NONE;
+	int    i;
+
+	if (off == 0 || dh->ents == NULL) {
+		HITSZFS_RDLOCK();
+		ret = hitszfs_dir_snapshot(dh);
+		HITSZFS_UNLOCK();
+	}
+	if (ret != HITSZFS_ERROR_NONE) {
+		fuse_reply_err(req, -ret);
+		return;
+	}
+	buf = (char*)malloc(size);
+	memset(&st, 0, sizeof(struct stat));
+	for (i = off; i < dh->cnt; i++)
+	{
+		st.st_ino  = dh->ents[i].ino;
+		st.st_mode = hitszfs_ftype_mode(dh->ents[i].ftype);
+		len = fuse_add_direntry(req, buf + used, size - used, dh->names + dh->ents[i].name_ofs, &st, i + 1);
+		if (len > size - used) {
+			break;										/* 缓冲区已满，下次从第i项续读 */
+		}
+		used += len;
+	}
+	fuse_reply_buf(req, buf, used);
+	free(buf);
+}
+
+/**
+ * @brief 关闭目录
+ *
+ * @param req
+ * @param ino
+ * @param fi
+ */
+static void hitszfs_ll_releasedir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+	struct hitszfs_dir_handle* dh    = (struct hitszfs_dir_handle*)(uintptr_t)fi->fh;
+	struct hitszfs_inode*      inode = dh->inode;
+
+	hitszfs_dir_close(dh);
+	hitszfs_icache_unref(inode, &inode->ref, 1);
+	fuse_reply_err(req, HITSZFS_ERROR_NONE);
+	hitszfs_icache_balance();
+}
+
+/**
+ * @brief ioctl，与hitszfs_ioctl相同支持HITSZFS_IOC_STATS与HITSZFS_IOC_DEFRAG
+ *
+ * @param req
+ * @param ino
+ * @param cmd
+ * @param arg
+ * @param fi
+ * @param flags
+ * @param in_buf
+ * @param in_bufsz
+ * @param out_bufsz
+ */
+static void hitszfs_ll_ioctl(fuse_req_t req, fuse_ino_t ino, int cmd, void* arg, struct fuse_file_info* fi,
+							 unsigned flags, const void* in_buf, size_t in_bufsz, size_t out_bufsz) {
+	struct hitszfs_stats stats;
+	struct hitszfs_defrag_report rep;
+	int ret;
+
+	switch ((unsigned int)cmd)
+	{
+	case HITSZFS_IOC_STATS:
+		HITSZFS_RDLOCK();
+		memcpy(&stats, &hitszfs_stats, sizeof(struct hitszfs_stats));
+		HITSZFS_UNLOCK();
+		fuse_reply_ioctl(req, 0, &stats, sizeof(struct hitszfs_stats));
+		break;
+	case HITSZFS_IOC_DEFRAG:
+		memset(&rep, 0, sizeof(struct hitszfs_defrag_report));
+		HITSZFS_LOCK();
+		ret = hitszfs_defrag_tree(hitszfs_ll_inode(ino), &rep);
+		HITSZFS_UNLOCK();
+		if (ret != HITSZFS_ERROR_NONE) {
+			fuse_reply_err(req, -ret);
+		}
+		else {
+			fuse_reply_ioctl(req, 0, &rep, sizeof(struct hitszfs_defrag_report));
+		}
+		hitszfs_icache_balance();
+		break;
+	default:
+		fuse_reply_err(req, HITSZFS_ERROR_INVAL);
+		break;
+	}
+}
+
+/******************************************************************************
+* SECTION: FUSE操作定义
+*******************************************************************************/
+static const struct fuse_lowlevel_ops operations = {
+	.init = hitszfs_ll_init,					 /* mount文件系统 */
+	.destroy = hitszfs_ll_destroy,				 /* umount文件系统 */
+	.lookup = hitszfs_ll_lookup,				 /* 按名字查找，nlookup加一 */
+	.forget = hitszfs_ll_forget,				 /* 内核释放节点号 */
+	.getattr = hitszfs_ll_getattr,
+	.setattr = hitszfs_ll_setattr,
+	.statfs = hitszfs_ll_statfs,
+	.readlink = hitszfs_ll_readlink,
+	.mknod = hitszfs_ll_mknod,
+	.mkdir = hitszfs_ll_mkdir,
+	.unlink = hitszfs_ll_unlink,
+	.rmdir = hitszfs_ll_rmdir,
+	.symlink = hitszfs_ll_symlink,
+	.rename = hitszfs_ll_rename,
+	.open = hitszfs_ll_open,
+	.read = hitszfs_ll_read,					 /* 内容与磁盘一致时splice镜像文件 */
+	.write_buf = hitszfs_ll_write_buf,			 /* 从FUSE管道直接复制到inode缓存 */
+	.flush = hitszfs_ll_flush,
+	.release = hitszfs_ll_release,
+	.fsync = hitszfs_ll_fsync,
+	.opendir = hitszfs_ll_opendir,
+	.readdir = hitszfs_ll_readdir,
+	.releasedir = hitszfs_ll_releasedir,
+	.access = hitszfs_ll_access,
+	.ioctl = hitszfs_ll_ioctl,
+};
+
+/******************************************************************************
+* SECTION: FUSE入口
+*******************************************************************************/
+int main(int argc, char **argv)
+{
+	struct fuse_args  args = FUSE_ARGS_INIT(argc, argv);
+	struct fuse_chan* ch;
+	char* mountpoint;
+	int   multithreaded, foreground;
+	int   ret = -1;
+
+	hitszfs_options.device = strdup("/home/students/200111205/ddriver");
+	hitszfs_options.blk_sz          = HITSZFS_DEFAULT_BLK_SZ;
+	hitszfs_options.bytes_per_inode = HITSZFS_DEFAULT_BPI;
+	hitszfs_options.journal_blks    = HITSZFS_DEFAULT_JOURNAL_BLKS;
+	hitszfs_options.inode_cache = HITSZFS_DEFAULT_INODE_CACHE;
+	hitszfs_options.dirty_age   = HITSZFS_DEFAULT_DIRTY_AGE;
+	hitszfs_options.dirty_ratio = HITSZFS_DEFAULT_DIRTY_RATIO;
+	hitszfs_options.readahead   = HITSZFS_DEFAULT_READAHEAD;
+	hitszfs_options.entry_timeout = HITSZFS_DEFAULT_TIMEOUT;
+	hitszfs_options.attr_timeout  = HITSZFS_DEFAULT_TIMEOUT;
+	hitszfs_options.kernel_cache  = TRUE;
+
+	if (fuse_opt_parse(&args, &hitszfs_options, option_spec, NULL) == -1 ||
+		fuse_parse_cmdline(&args, &mountpoint, &multithreaded, &foreground) == -1)
+		return -1;
+
+	ch = fuse_mount(mountpoint, &args);
+	if (ch != NULL) {
+		hitszfs_ll_se = fuse_lowlevel_new(&args, &operations, sizeof(operations), NULL);
+		if (hitszfs_ll_se != NULL) {
+			if (fuse_set_signal_handlers(hitszfs_ll_se) != -1) {
+				fuse_session_add_chan(hitszfs_ll_se, ch);
+				fuse_daemonize(foreground);
+				ret = multithreaded ? fuse_session_loop_mt(hitszfs_ll_se) : fuse_session_loop(hitszfs_ll_se);
+				fuse_remove_signal_handlers(hitszfs_ll_se);
+				fuse_session_remove_chan(ch);
+			}
+			fuse_session_destroy(hitszfs_ll_se);
+		}
+		fuse_unmount(mountpoint, ch);
+	}
+	free(mountpoint);
+	fuse_opt_free_args(&args);
+	return ret == 0 ? 0 : 1;
+}
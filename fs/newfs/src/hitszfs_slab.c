@@ -0,0 +1,210 @@
+#include "../include/hitszfs.h"
+
+/******************************************************************************
+* SECTION: slab对象缓存
+*
+* inode和dentry按类型从各自的slab中分配: 每次向系统申请一整块(HITSZFS_SLAB_CHUNK_SZ)
+* 切成等大对象挂入空闲链表，释放的对象回到空闲链表，整块内存只在卸载时归还。
+* 对象内存因此是类型稳定的，活跃对象数与占用字节数记入hitszfs_stats。
+* 每个slab自带一把锁，读锁下并发读入inode/目录项的线程可以同时分配。
+*******************************************************************************/
+/**
+ * @brief 初始化一个slab
+ *
+ * @param slab
+ * @param name 名字，仅用于调试输出
+ * @param obj_sz 对象大小
+ * @param live 活跃对象计数器
+ */
+void hitszfs_slab_init(struct hitszfs_slab* slab, const char* name, int obj_sz, uint64_t* live)
+{
+    slab->name           = name;
+    slab->obj_sz         = HITSZFS_ROUND_UP(obj_sz, HITSZFS_SLAB_ALIGN);
+    slab->objs_per_chunk = (HITSZFS_SLAB_CHUNK_SZ - HITSZFS_SLAB_ALIGN) / slab->obj_sz;
+    slab->free_list      = NULL;
+    slab->chunks         = NULL;
+    slab->live           = live;
+    *slab->live          = 0;
+    pthread_mutex_init(&slab->lock, NULL);
+}
+/**
+ * @brief 申请一整块并切分为对象挂入空闲链表
+ *
+ * @param slab
+ * @return int
+ */
+static int hitszfs_slab_grow(struct hitszfs_slab* slab)
+{
+    uint8_t* chunk = (uint8_t *)malloc(HITSZFS_SLAB_CHUNK_SZ);
+    uint8_t* obj;
+    int      i;
+
+    if (chunk == NULL) {
+        return -HITSZFS_ERROR_NOSPACE;
+    }
+    *(void **)chunk = slab->chunks;                   /* 块首留出一个对齐单位串起所有块 */
+    slab->chunks    = chunk;
+    for (i = slab->objs_per_chunk - 1; i >= 0; i--)
+    {
+        obj              = chunk + HITSZFS_SLAB_ALIGN + i * slab->obj_sz;
+        *(void **)obj    = slab->free_list;
+        slab->free_list  = obj;
+    }
+    HITSZFS_STAT_ADD(slab_bytes, HITSZFS_SLAB_CHUNK_SZ);
+    return HITSZFS_ERROR_NONE;
+}
+/**
+ * @brief 从slab分配一个清零的对象
+ *
+ * @param slab
+ * @return void*
+ */
+void* hitszfs_slab_alloc(struct hitszfs_slab* slab)
+{
+    void* obj;
+
+    pthread_mutex_lock(&slab->lock);
+    if (slab->free_list == NULL && hitszfs_slab_grow(slab) != HITSZFS_ERROR_NONE) {
+        pthread_mutex_unlock(&slab->lock);
+        return NULL;
+    }
+    obj             = slab->free_list;
+    slab->free_list = *(void **)obj;
+    (*slab->live)++;
+    pthread_mutex_unlock(&slab->lock);
+    memset(obj, 0, slab->obj_sz);
+    return obj;
+}
+/**
+ * @brief 将对象放回slab的空闲链表
+ *
+ * @param slab
+ * @param obj
+ */
+void hitszfs_slab_free(struct hitszfs_slab* slab, void* obj)
+{
+    pthread_mutex_lock(&slab->lock);
+    *(void **)obj   = slab->free_list;
+    slab->free_list = obj;
+    (*slab->live)--;
+    pthread_mutex_unlock(&slab->lock);
+}
+/**
+ * @brief 归还slab的全部内存
+ *
+ * @param slab
+ */
+void hitszfs_slab_destroy(struct hitszfs_slab* slab)
+{
+    void* chunk = slab->chunks;
+    void* next;
+
+    while (chunk != NULL)
+    {
+        next = *(void **)chunk;
+        free(chunk);
+        HITSZFS_STAT_SUB(slab_bytes, HITSZFS_SLAB_CHUNK_SZ);
+        chunk = next;
+    }
+    slab->chunks    = NULL;
+    slab->free_list = NULL;
+    *slab->live     = 0;
+    pthread_mutex_destroy(&slab->lock);
+}
+
+/******************************************************************************
+* SECTION: dentry / inode 对象
+*******************************************************************************/
+/**
+ * @brief 创建dentry，短文件名直接存放在dentry内，长文件名单独申请
+ *
+ * @param fname
+ * @param ftype
+ * @return struct hitszfs_dentry*
+ */
+struct hitszfs_dentry* new_dentry(char * fname, HITSZFS_FILE_TYPE ftype)
+{
+    struct hitszfs_dentry* dentry = (struct hitszfs_dentry *)hitszfs_slab_alloc(&hitszfs_super.dentry_slab);
+    int                    len    = strlen(fname);
+
+    if (len < HITSZFS_DNAME_INLINE_LEN) {
+        dentry->fname = dentry->fname_inline;
+    }
+    else {
+        dentry->fname = (char *)malloc(len + 1);
+    }
+    memcpy(dentry->fname, fname, len + 1);
+    dentry->ftype    = ftype;
+    dentry->ino      = -1;
+    dentry->inode    = NULL;
+    dentry->parent   = NULL;
+    dentry->brother  = NULL;
+    dentry->pbrother = NULL;
+    dentry->slot     = -1;
+    dentry->pos      = -1;
+    return dentry;
+}
+/**
+ * @brief 更换dentry的文件名(rename)，按新名字长短决定内联或单独申请
+ *
+ * @param dentry 须已从目录索引中摘除
+ * @param fname
+ */
+void hitszfs_dentry_set_fname(struct hitszfs_dentry* dentry, const char* fname)
+{
+    int len = strlen(fname);
+
+    if (dentry->fname != dentry->fname_inline) {
+        free(dentry->fname);
+    }
+    if (len < HITSZFS_DNAME_INLINE_LEN) {
+        dentry->fname = dentry->fname_inline;
+    }
+    else {
+        dentry->fname = (char *)malloc(len + 1);
+    }
+    memcpy(dentry->fname, fname, len + 1);
+}
+/**
+ * @brief 释放dentry
+ *
+ * @param dentry
+ */
+void hitszfs_free_dentry(struct hitszfs_dentry* dentry)
+{
+    if (dentry->fname != dentry->fname_inline) {
+        free(dentry->fname);
+    }
+    hitszfs_slab_free(&hitszfs_super.dentry_slab, dentry);
+}
+/**
+ * @brief 从slab分配一个清零的内存inode
+ *
+ * @return struct hitszfs_inode*
+ */
+struct hitszfs_inode* hitszfs_new_inode()
+{
+    struct hitszfs_inode* inode = (struct hitszfs_inode *)hitszfs_slab_alloc(&hitszfs_super.inode_slab);
+
+    pthread_rwlock_init(&inode->rwlock, NULL);
+    hitszfs_icache_add(inode);
+    return inode;
+}
+/**
+ * @brief 释放内存inode及其数据缓存、目录索引
+ *
+ * @param inode
+ */
+void hitszfs_free_inode(struct hitszfs_inode* inode)
+{
+    if (inode->dindex != NULL) {
+        free(inode->dindex->buckets);
+        free(inode->dindex->slots);
+        free(inode->dindex);
+    }
+    free(inode->data);
+    free(inode->frees.ents);
+    hitszfs_icache_del(inode);
+    pthread_rwlock_destroy(&inode->rwlock);
+    hitszfs_slab_free(&hitszfs_super.inode_slab, inode);
+}
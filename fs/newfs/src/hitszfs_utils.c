@@ -1,5 +1,12 @@
 #include "../include/hitszfs.h"
 
+/******************************************************************************
+* SECTION: global region
+*******************************************************************************/
+struct hitszfs_super    hitszfs_super; 
+struct custom_options   hitszfs_options;
+struct hitszfs_stats    hitszfs_stats;
+
 /**
  * @brief 获取文件名
  * 
@@ -40,233 +47,1423 @@ int hitszfs_calc_lvl(const char * path)
     return lvl;
 }
 /**
- * @brief 驱动读
+ * @brief 驱动读，调用者需持有io_lock
  * 
  * @param offset 
  * @param out_content 
  * @param size 
  * @return int 
  */
-int hitszfs_driver_read(int offset, uint8_t *out_content, int size) 
+static int hitszfs_driver_read_locked(off_t offset, uint8_t *out_content, int size) 
 {
-    int      offset_aligned = HITSZFS_ROUND_DOWN(offset, HITSZFS_IO_SZ());
+    off_t    offset_aligned = HITSZFS_ROUND_DOWN(offset, HITSZFS_IO_SZ());
     int      bias           = offset - offset_aligned;
     int      size_aligned   = HITSZFS_ROUND_UP((size + bias), HITSZFS_IO_SZ());
-    uint8_t* temp_content   = (uint8_t*)malloc(size_aligned);
+    boolean  direct         = bias == 0 && size_aligned == size;   /* 对齐时直接读入out_content */
+    uint8_t* temp_content   = direct ? out_content : (uint8_t*)malloc(size_aligned);
     uint8_t* cur            = temp_content;
     // lseek(HITSZFS_DRIVER(), offset_aligned, SEEK_SET);
     ddriver_seek(HITSZFS_DRIVER(), offset_aligned, SEEK_SET);
     while (size_aligned != 0)
     {
-        // read(HITSZFS_DRIVER(), cur, HITSZFS_IO_SZ());
-        ddriver_read(HITSZFS_DRIVER(), (char*)cur, HITSZFS_IO_SZ());
-        cur          += HITSZFS_IO_SZ();
-        size_aligned -= HITSZFS_IO_SZ();   
+        // read(HITSZFS_DRIVER(), cur, HITSZFS_IO_SZ());
+        ddriver_read(HITSZFS_DRIVER(), (char*)cur, HITSZFS_IO_SZ());
+        cur          += HITSZFS_IO_SZ();
+        size_aligned -= HITSZFS_IO_SZ();   
+    }
+    if (!direct) {
+        memcpy(out_content, temp_content + bias, size);
+        free(temp_content);
+    }
+    return HITSZFS_ERROR_NONE;
+}
+/**
+ * @brief 驱动读
+ * 
+ * @param offset 
+ * @param out_content 
+ * @param size 
+ * @return int 
+ */
+int hitszfs_driver_read(off_t offset, uint8_t *out_content, int size) 
+{
+    int ret;
+
+    pthread_mutex_lock(&hitszfs_super.io_lock);       /* seek与read之间不能插入其他线程的IO */
+    ret = hitszfs_driver_read_locked(offset, out_content, size);
+    pthread_mutex_unlock(&hitszfs_super.io_lock);
+    hitszfs_journal_overlay(offset, out_content, size); /* 已提交未检查点的块以日志中为准 */
+    return ret;
+}
+/**
+ * @brief 驱动写
+ * 
+ * @param offset 
+ * @param in_content 
+ * @param size 
+ * @return int 
+ */
+int hitszfs_driver_write(off_t offset, uint8_t *in_content, int size) 
+{
+    off_t    offset_aligned = HITSZFS_ROUND_DOWN(offset, HITSZFS_IO_SZ());
+    int      bias           = offset - offset_aligned;
+    int      size_aligned   = HITSZFS_ROUND_UP((size + bias), HITSZFS_IO_SZ());
+    boolean  direct         = bias == 0 && size_aligned == size;   /* 对齐时无需读-改-写 */
+    uint8_t* temp_content   = direct ? in_content : (uint8_t*)malloc(size_aligned);
+    uint8_t* cur            = temp_content;
+    pthread_mutex_lock(&hitszfs_super.io_lock);
+    if (!direct) {
+        hitszfs_driver_read_locked(offset_aligned, temp_content, size_aligned);
+        memcpy(temp_content + bias, in_content, size);
+    }
+    
+    // lseek(HITSZ_DRIVER(), offset_aligned, SEEK_SET);
+    ddriver_seek(HITSZFS_DRIVER(), offset_aligned, SEEK_SET);
+    while (size_aligned != 0)
+    {
+        // write(HITSZFS_DRIVER(), cur, HITSZ_IO_SZ());
+        ddriver_write(HITSZFS_DRIVER(), (char*)cur, HITSZFS_IO_SZ());
+        cur          += HITSZFS_IO_SZ();
+        size_aligned -= HITSZFS_IO_SZ();   
+    }
+    pthread_mutex_unlock(&hitszfs_super.io_lock);
+
+    if (!direct) {
+        free(temp_content);
+    }
+    return HITSZFS_ERROR_NONE;
+}
+/**
+ * @brief 为一个inode分配dentry，采用头插法
+ * 
+ * 目录项按槽位追加到目录的数据块中，槽位跨入新块时再分配数据块；
+ * 变长目录项格式下由hitszfs_dirent_insert在目录块中找空间
+ * 
+ * @param inode 
+ * @param dentry 
+ * @return int 
+ */
+int hitszfs_alloc_dentry(struct hitszfs_inode* inode, struct hitszfs_dentry* dentry) 
+{
+    int slot    = inode->dir_cnt;
+    int blk_idx = slot / HITSZFS_DENTRY_PER_BLK();
+
+    if (!HITSZFS_VAR_DENTRY() && blk_idx >= HITSZFS_DATA_PER_FILE) 
+    {
+        return -HITSZFS_ERROR_NOSPACE;
+    }
+    if (hitszfs_dir_load(inode) != HITSZFS_ERROR_NONE)  /* 写目录块前须读入全部目录项 */
+    {
+        return -HITSZFS_ERROR_IO;
+    }
+    if (HITSZFS_VAR_DENTRY()) 
+    {                                                 /* 变长格式: 在目录块中原地插入记录 */
+        if (hitszfs_dirent_insert(inode, dentry) != HITSZFS_ERROR_NONE) 
+        {
+            return -HITSZFS_ERROR_NOSPACE;
+        }
+    }
+    else if (inode->data_blk[blk_idx] == HITSZFS_BLK_NONE) 
+    {
+        inode->data_blk[blk_idx] = hitszfs_alloc_data_blk();
+        if (inode->data_blk[blk_idx] < 0) 
+        {
+            inode->data_blk[blk_idx] = HITSZFS_BLK_NONE;
+            return -HITSZFS_ERROR_NOSPACE;
+        }
+    }
+
+    dentry->slot   = slot;
+    dentry->flags |= HITSZFS_FLAG_BUF_DIRTY;
+    hitszfs_dindex_insert(inode, dentry);
+    inode->dir_cnt++;
+    inode->mtime = inode->ctime = time(NULL);
+    hitszfs_mark_inode_dirty(inode, HITSZFS_FLAG_BUF_DIRTY | HITSZFS_FLAG_DENTRYS_DIRTY);
+    return inode->dir_cnt;
+}
+/**
+ * @brief 标记inode为脏，首次变脏时挂入超级块的脏链表
+ * 
+ * @param inode 
+ * @param flags HITSZFS_FLAG_BUF_DIRTY / HITSZFS_FLAG_DENTRYS_DIRTY / HITSZFS_FLAG_DATA_DIRTY
+ */
+void hitszfs_mark_inode_dirty(struct hitszfs_inode* inode, flag16 flags) 
+{
+    if (inode->flags == 0) 
+    {
+        inode->dirty_next        = hitszfs_super.dirty_list;
+        inode->dirtied_when      = time(NULL);
+        hitszfs_super.dirty_list = inode;
+        hitszfs_super.dirty_cnt++;
+        /* 脏inode足够多且比例超过阈值，唤醒后台线程立即回写 */
+        if (hitszfs_super.dirty_cnt >= HITSZFS_WB_CHUNK &&
+            hitszfs_super.dirty_cnt * 100 > hitszfs_options.dirty_ratio * hitszfs_super.inode_cnt) {
+            hitszfs_flusher_kick();
+        }
+    }
+    inode->flags |= flags;
+}
+static inline boolean hitszfs_data_used(int blk) 
+{
+    return (hitszfs_super.map_data[blk / UINT8_BITS] & (0x1 << (blk % UINT8_BITS))) != 0;
+}
+/**
+ * @brief 在位图的[start, end)中找第一个0位，按64位字跳过全部占用的区域
+ * 
+ * @param map 
+ * @param start 
+ * @param end 
+ * @return int 位号，没有时返回-1
+ */
+static int hitszfs_map_find_zero(const uint8_t* map, int start, int end) 
+{
+    uint64_t word;
+    int      bit = start;
+
+    while (bit < end)
+    {
+        if (bit % 64 == 0 && bit + 64 <= end) {
+            memcpy(&word, map + bit / UINT8_BITS, sizeof(uint64_t));
+            if (word == ~0ULL) {
+                bit += 64;
+                continue;
+            }
+            return bit + __builtin_ctzll(~word);      /* 位图按字节小端排列，字内最低位即最小的位号 */
+        }
+        if ((map[bit / UINT8_BITS] & (0x1 << (bit % UINT8_BITS))) == 0) {
+            return bit;
+        }
+        bit++;
+    }
+    return -1;
+}
+/**
+ * @brief 块组数据块的范围[*start, *end)，最后一个块组可能不满
+ * 
+ * @param group 
+ * @param start 
+ * @param end 
+ */
+static void hitszfs_group_data_range(int group, int* start, int* end) 
+{
+    *start = group * hitszfs_super.data_per_group;
+    *end   = *start + hitszfs_super.data_per_group;
+    if (*end > HITSZFS_MAX_DATA()) {
+        *end = HITSZFS_MAX_DATA();
+    }
+}
+/**
+ * @brief 扫描块组的data位图，返回最长空闲区间的长度
+ * 
+ * @param group 
+ * @return int 
+ */
+static int hitszfs_group_max_extent(int group) 
+{
+    int blk, start, end, run = 0, longest = 0;
+
+    hitszfs_group_data_range(group, &start, &end);
+    for (blk = start; blk < end; blk++)
+    {
+        run     = hitszfs_data_used(blk) ? 0 : run + 1;
+        longest = run > longest ? run : longest;
+    }
+    return longest;
+}
+/**
+ * @brief 在data位图中找一段空闲块并占用，调用者持bitmap_lock
+ * 
+ * goal起的want块都空闲时直接占用；否则取第一段不短于want的空闲区间，
+ * 没有时取找到的最长区间。区间不跨块组(相邻块组的数据块在磁盘上不相邻)，
+ * 按块组摘要跳过没有空闲块或不可能有更长区间的块组
+ * 
+ * @param goal 期望的起始块号，<0不指定
+ * @param want 
+ * @param len 输出，实际占用的块数
+ * @return int 起始块号，没有空闲块时返回-HITSZFS_ERROR_NOSPACE
+ */
+static int hitszfs_alloc_data_run(int goal, int want, int* len) 
+{
+    struct hitszfs_group_sum* sum;
+    int best = -HITSZFS_ERROR_NOSPACE, best_len = 0;
+    int group, blk, start, end, run, longest;
+
+    if (goal >= 0 && goal < HITSZFS_MAX_DATA() && !hitszfs_data_used(goal)) 
+    {
+        for (blk = goal + 1; blk - goal < want && blk < HITSZFS_MAX_DATA() && 
+             blk % hitszfs_super.data_per_group != 0 && !hitszfs_data_used(blk); blk++);
+        if (blk - goal == want) {
+            best     = goal;
+            best_len = want;
+        }
+    }
+    for (group = 0; best_len < want && group < hitszfs_super.group_cnt; group++)
+    {
+        sum = &hitszfs_super.groups[group];
+        if (sum->free_data == 0 || sum->max_extent <= best_len) {
+            continue;
+        }
+        hitszfs_group_data_range(group, &start, &end);
+        longest = 0;
+        for (blk = start; blk < end; blk++)
+        {
+            blk = hitszfs_map_find_zero(hitszfs_super.map_data, blk, end);
+            if (blk < 0) {                            /* 其余部分已全部占用 */
+                blk = end;
+                break;
+            }
+            for (run = 1; blk + 1 < end && !hitszfs_data_used(blk + 1); blk++, run++);
+            longest = run > longest ? run : longest;
+            if (run > best_len) {
+                best     = blk + 1 - run;
+                best_len = run < want ? run : want;
+            }
+            if (best_len == want) {
+                break;
+            }
+        }
+        if (blk >= end) {                             /* 整组扫描过，摘要变为精确值 */
+            sum->max_extent = longest;
+        }
+    }
+    for (blk = best; blk >= 0 && blk < best + best_len; blk++)
+    {
+        hitszfs_super.map_data[blk / UINT8_BITS] |= (0x1 << (blk % UINT8_BITS));
+    }
+    if (best_len > 0) {                               /* 区间不跨块组 */
+        hitszfs_super.groups[best / hitszfs_super.data_per_group].free_data -= best_len;
+        hitszfs_super.groups[best / hitszfs_super.data_per_group].flags     |= HITSZFS_FLAG_DMAP_DIRTY;
+        hitszfs_super.data_free -= best_len;
+        hitszfs_super.flags     |= HITSZFS_FLAG_BUF_DIRTY;
+        HITSZFS_STAT_INC(alloc_calls);
+        HITSZFS_STAT_ADD(alloc_blocks, best_len);
+    }
+    *len = best_len;
+    return best;
+}
+/**
+ * @brief 分配一个数据块，已为延迟分配预留的块不可占用
+ * 
+ * 从上次分配处向后找所在块组的空闲块(目录块等单块分配大多相继发生)，
+ * 块组内没有时再由hitszfs_alloc_data_run按摘要找
+ * 
+ * @return 返回块号
+ */
+int
+hitszfs_alloc_data_blk()
+{
+    int blk = -HITSZFS_ERROR_NOSPACE;
+    int goal, start, end;
+    int len;
+
+    pthread_mutex_lock(&hitszfs_super.bitmap_lock);
+    if (hitszfs_super.data_free > hitszfs_super.data_delalloc) {
+        goal = -1;
+        if (hitszfs_super.data_cursor < HITSZFS_MAX_DATA()) {
+            hitszfs_group_data_range(hitszfs_super.data_cursor / hitszfs_super.data_per_group, &start, &end);
+            goal = hitszfs_map_find_zero(hitszfs_super.map_data, hitszfs_super.data_cursor, end);
+        }
+        blk = hitszfs_alloc_data_run(goal, 1, &len);
+        if (blk >= 0) {
+            hitszfs_super.data_cursor = blk + 1;
+        }
+    }
+    pthread_mutex_unlock(&hitszfs_super.bitmap_lock);
+    return blk;
+}
+/**
+ * @brief 数据块归还位图并更新空闲计数与摘要，调用者持bitmap_lock
+ * 
+ * @param blk 
+ */
+static void hitszfs_data_blk_put(int blk) 
+{
+    struct hitszfs_group_sum* sum;
+    int                       start, end, lo, hi;
+
+    hitszfs_super.map_data[blk / UINT8_BITS] &= ~(0x1 << (blk % UINT8_BITS));
+    hitszfs_super.data_free++;
+    hitszfs_group_data_range(blk / hitszfs_super.data_per_group, &start, &end);
+    for (lo = blk; lo > start && !hitszfs_data_used(lo - 1); lo--);
+    for (hi = blk + 1; hi < end && !hitszfs_data_used(hi); hi++);
+    sum = &hitszfs_super.groups[blk / hitszfs_super.data_per_group];
+    sum->free_data++;
+    if (hi - lo > sum->max_extent) {                  /* 与两侧空闲区间合并 */
+        sum->max_extent = hi - lo;
+    }
+}
+/**
+ * @brief inode号归还位图并更新空闲计数，调用者持bitmap_lock
+ * 
+ * @param ino 
+ */
+static void hitszfs_ino_put(int ino) 
+{
+    hitszfs_super.map_inode[ino / UINT8_BITS] &= ~(0x1 << (ino % UINT8_BITS));
+    hitszfs_super.inode_free++;
+    hitszfs_super.groups[ino / hitszfs_super.inodes_per_group].free_inode++;
+}
+/**
+ * @brief 立即释放一个数据块，归还位图；延迟分配的块只取消预留
+ * 
+ * 只用于尚未被任何已提交的元数据引用的块(如分配后未用上就归还)，
+ * 其余的释放经hitszfs_defer_free等到事务提交
+ * 
+ * @param blk 块号或HITSZFS_BLK_DELAY
+ */
+void hitszfs_free_data_blk(int blk) 
+{
+    pthread_mutex_lock(&hitszfs_super.bitmap_lock);
+    if (blk == HITSZFS_BLK_DELAY) {
+        hitszfs_super.data_delalloc--;
+        HITSZFS_STAT_INC(delalloc_dropped);
+    }
+    else {
+        hitszfs_data_blk_put(blk);
+        hitszfs_super.groups[blk / hitszfs_super.data_per_group].flags |= HITSZFS_FLAG_DMAP_DIRTY;
+        hitszfs_super.flags |= HITSZFS_FLAG_BUF_DIRTY;
+    }
+    pthread_mutex_unlock(&hitszfs_super.bitmap_lock);
+}
+/**
+ * @brief 向待释放表追加一项
+ * 
+ * @param list 
+ * @param no 
+ * @param is_ino 
+ */
+static void hitszfs_free_list_add(struct hitszfs_free_list* list, int no, boolean is_ino) 
+{
+    if (list->cnt == list->cap) 
+    {
+        list->cap  = list->cap == 0 ? 16 : list->cap * 2;
+        list->ents = (struct hitszfs_free_ent*)realloc(list->ents, 
+                                                       list->cap * sizeof(struct hitszfs_free_ent));
+    }
+    list->ents[list->cnt].no     = no;
+    list->ents[list->cnt].is_ino = is_ino;
+    list->cnt++;
+}
+/**
+ * @brief 释放由owner的修改不再引用的数据块或inode号，owner提交之后才归还位图
+ * 
+ * 提交之前磁盘上的inode或目录项仍引用它们，若同一次回写中分给了别的文件，
+ * 崩溃后两者会共用一块(同jbd)。owner被置脏，保证之后会被提交；
+ * owner为NULL(inode已不在任何目录中)时记到orphan_frees，等脏链表清空的那个事务
+ * 
+ * @param owner 
+ * @param no 块号(HITSZFS_BLK_DELAY只取消预留)或inode号
+ * @param is_ino 
+ */
+void hitszfs_defer_free(struct hitszfs_inode* owner, int no, boolean is_ino) 
+{
+    if (!is_ino && no == HITSZFS_BLK_DELAY) {
+        hitszfs_free_data_blk(no);
+        return;
+    }
+    if (is_ino) {
+        hitszfs_super.inode_freeing++;
+    }
+    else {
+        hitszfs_super.data_freeing++;
+    }
+    if (owner == NULL) {
+        hitszfs_free_list_add(&hitszfs_super.orphan_frees, no, is_ino);
+        return;
+    }
+    hitszfs_free_list_add(&owner->frees, no, is_ino);
+    hitszfs_mark_inode_dirty(owner, HITSZFS_FLAG_BUF_DIRTY);
+}
+/**
+ * @brief 把src中待释放的项移入事务dst，位图随该事务写出
+ * 
+ * @param dst 
+ * @param src 
+ */
+static void hitszfs_free_list_move(struct hitszfs_free_list* dst, struct hitszfs_free_list* src) 
+{
+    int i;
+
+    if (src->cnt == 0) {
+        return;
+    }
+    for (i = 0; i < src->cnt; i++)
+    {
+        hitszfs_free_list_add(dst, src->ents[i].no, src->ents[i].is_ino);
+    }
+    free(src->ents);
+    memset(src, 0, sizeof(struct hitszfs_free_list));
+    pthread_mutex_lock(&hitszfs_super.bitmap_lock);
+    hitszfs_super.flags |= HITSZFS_FLAG_BUF_DIRTY;
+    pthread_mutex_unlock(&hitszfs_super.bitmap_lock);
+}
+/**
+ * @brief 事务提交后归还其中释放的块与inode号，之后才可重新分配
+ * 
+ * 磁盘上的位图已随事务写出，这里只更新内存中的位图与计数；
+ * 事务没有提交时不归还，磁盘上的元数据可能仍引用它们，宁可泄漏由fsck回收
+ * 
+ * @param list 
+ * @param committed 
+ */
+static void hitszfs_free_list_release(struct hitszfs_free_list* list, boolean committed) 
+{
+    int i;
+
+    pthread_mutex_lock(&hitszfs_super.bitmap_lock);
+    for (i = 0; i < list->cnt; i++)
+    {
+        if (list->ents[i].is_ino) {
+            hitszfs_super.inode_freeing--;
+            if (committed) {
+                hitszfs_ino_put(list->ents[i].no);
+            }
+        }
+        else {
+            hitszfs_super.data_freeing--;
+            if (committed) {
+                hitszfs_data_blk_put(list->ents[i].no);
+            }
+        }
+    }
+    pthread_mutex_unlock(&hitszfs_super.bitmap_lock);
+    free(list->ents);
+    memset(list, 0, sizeof(struct hitszfs_free_list));
+}
+/**
+ * @brief 空间不足而有已释放、待提交的inode号或数据块时，提交整条脏链表使它们归还
+ * 
+ * 调用者持写锁，且不在修改目录的中途(提交的须是一个一致的状态)
+ * 
+ * @param is_ino 
+ * @return boolean 空闲数是否增加，是则调用者可重试
+ */
+boolean hitszfs_reclaim_frees(boolean is_ino) 
+{
+    int before = is_ino ? hitszfs_super.inode_free : hitszfs_super.data_free;
+
+    if ((is_ino ? hitszfs_super.inode_freeing : hitszfs_super.data_freeing) == 0) {
+        return FALSE;
+    }
+    hitszfs_sync_dirty();
+    return (is_ino ? hitszfs_super.inode_free : hitszfs_super.data_free) > before;
+}
+/**
+ * @brief list中属于块组group的项数
+ * 
+ * @param list 
+ * @param group 
+ * @param is_ino 
+ * @return int 
+ */
+static int hitszfs_free_list_count(struct hitszfs_free_list* list, int group, boolean is_ino) 
+{
+    int per = is_ino ? hitszfs_super.inodes_per_group : hitszfs_super.data_per_group;
+    int cnt = 0;
+    int i;
+
+    for (i = 0; i < list->cnt; i++)
+    {
+        cnt += list->ents[i].is_ino == is_ino && list->ents[i].no / per == group;
+    }
+    return cnt;
+}
+/**
+ * @brief 分配cnt个连续的数据块，没有足够长的空闲区间时不分配
+ * 
+ * @param cnt 
+ * @return int 起始块号，失败返回-HITSZFS_ERROR_NOSPACE
+ */
+int hitszfs_alloc_data_blks(int cnt) 
+{
+    int blk = -HITSZFS_ERROR_NOSPACE;
+    int len = 0, i;
+
+    pthread_mutex_lock(&hitszfs_super.bitmap_lock);
+    if (hitszfs_super.data_free - hitszfs_super.data_delalloc >= cnt) {
+        blk = hitszfs_alloc_data_run(-1, cnt, &len);
+    }
+    pthread_mutex_unlock(&hitszfs_super.bitmap_lock);
+    if (blk >= 0 && len < cnt) {                      /* 只找到较短的区间，归还 */
+        for (i = 0; i < len; i++)
+        {
+            hitszfs_free_data_blk(blk + i);
+        }
+        blk = -HITSZFS_ERROR_NOSPACE;
+    }
+    return blk;
+}
+/**
+ * @brief 分配一个inode，占用位图；目录同时分配第一个数据块
+ * 
+ * @param dentry 该dentry指向分配的inode
+ * @return hitszfs_inode，inode已用完或目录分配不到数据块时返回NULL
+ */
+struct hitszfs_inode* hitszfs_alloc_inode(struct hitszfs_dentry * dentry) 
+{
+    struct hitszfs_inode* inode;
+    int ino_cursor = -1;
+    int blk = HITSZFS_BLK_NONE;
+    int group, first, start, end, i;
+
+    // 删除释放的inode号和块要等提交后才能重用，不够时先提交；新建最多还需要目录自己的第一块
+    // 和父目录的一个新目录块
+    if (hitszfs_super.inode_free == 0) {
+        hitszfs_reclaim_frees(TRUE);
+    }
+    if (hitszfs_super.data_free - hitszfs_super.data_delalloc < (dentry->ftype == HITSZFS_DIR ? 2 : 1)) {
+        hitszfs_reclaim_frees(FALSE);
+    }
+    // 在inode位图上从上次分配处向后寻找未使用的inode节点，跳过没有空闲inode的块组，
+    // 找到末尾后回到开头，最后补扫起点所在块组中起点之前的部分
+    pthread_mutex_lock(&hitszfs_super.bitmap_lock);
+    if (hitszfs_super.inode_free == 0) {
+        pthread_mutex_unlock(&hitszfs_super.bitmap_lock);
+        return NULL;
+    }
+    if (hitszfs_super.ino_cursor >= HITSZFS_MAX_INO()) {
+        hitszfs_super.ino_cursor = 0;
+    }
+    first = hitszfs_super.ino_cursor / hitszfs_super.inodes_per_group;
+    for (i = 0; ino_cursor < 0 && i <= hitszfs_super.group_cnt; i++)
+    {
+        group = (first + i) % hitszfs_super.group_cnt;
+        start = i == 0 ? hitszfs_super.ino_cursor : group * hitszfs_super.inodes_per_group;
+        end   = i == hitszfs_super.group_cnt ? hitszfs_super.ino_cursor : (group + 1) * hitszfs_super.inodes_per_group;
+        if (hitszfs_super.groups[group].free_inode > 0 && start < end) {
+            ino_cursor = hitszfs_map_find_zero(hitszfs_super.map_inode, start, end);
+        }
+    }
+    hitszfs_super.map_inode[ino_cursor / UINT8_BITS] |= (0x1 << (ino_cursor % UINT8_BITS));
+    hitszfs_super.flags     |= HITSZFS_FLAG_BUF_DIRTY;
+    hitszfs_super.ino_cursor = ino_cursor + 1;
+    hitszfs_super.inode_free--;
+    hitszfs_super.groups[ino_cursor / hitszfs_super.inodes_per_group].free_inode--;
+    hitszfs_super.groups[ino_cursor / hitszfs_super.inodes_per_group].flags |= HITSZFS_FLAG_IMAP_DIRTY;
+    pthread_mutex_unlock(&hitszfs_super.bitmap_lock);
+
+    if (dentry->ftype == HITSZFS_DIR) 
+    {                                                 /* 文件与符号链接先内联，超出时才分配数据块 */
+        blk = hitszfs_alloc_data_blk();
+        if (blk < 0) {                                /* 没有数据块，归还刚占用的inode号 */
+            pthread_mutex_lock(&hitszfs_super.bitmap_lock);
+            hitszfs_ino_put(ino_cursor);
+            pthread_mutex_unlock(&hitszfs_super.bitmap_lock);
+            return NULL;
+        }
+    }
+
+    // 为目录项分配inode节点并建立他们之间的连接
+
+    inode = hitszfs_new_inode();
+    inode->ino  = ino_cursor; 
+    inode->size = 0;
+                                                      /* dentry指向inode */
+    dentry->inode = inode;
+    dentry->ino   = inode->ino;
+                                                      /* inode指回dentry */
+    inode->dentry = dentry;
+    
+    inode->dir_cnt = 0;
+    inode->dentrys = NULL;
+    inode->dindex  = NULL;
+    inode->dentrys_loaded = TRUE;
+    inode->index_blk = HITSZFS_BLK_NONE;
+    inode->data    = NULL;
+    inode->data_valid = HITSZFS_DATA_ALL;             /* 新文件没有要从磁盘读入的内容 */
+    inode->data_ra = 0;
+    inode->flags   = 0;
+    inode->dirty_blks = 0;
+    inode->atime   = inode->mtime = inode->ctime = time(NULL);
+    for (int i = 0; i < HITSZFS_DATA_PER_FILE; i++)
+    {
+        inode->data_blk[i] = HITSZFS_BLK_NONE;
+    }
+    inode->data_blk[0] = blk;
+    
+    if (HITSZFS_IS_REG(inode) || HITSZFS_IS_SYM_LINK(inode)) 
+    {
+        inode->data = (uint8_t *)malloc(HITSZFS_BLKS_SZ(HITSZFS_DATA_PER_FILE));
+        memset(inode->data, 0, HITSZFS_BLKS_SZ(HITSZFS_DATA_PER_FILE));
+    }
+    else if (HITSZFS_IS_DIR(inode) && HITSZFS_VAR_DENTRY()) 
+    {                                                 /* 变长格式的目录块镜像常驻内存 */
+        inode->data = (uint8_t *)calloc(HITSZFS_DATA_PER_FILE, HITSZFS_BLK_SZ());
+        hitszfs_dirent_init_blk(inode, 0);
+        hitszfs_mark_inode_dirty(inode, HITSZFS_FLAG_DENTRYS_DIRTY);
+    }
+    hitszfs_mark_inode_dirty(inode, HITSZFS_FLAG_BUF_DIRTY);
+
+    return inode;
+}
+/**
+ * @brief 保证inode有足以存放size字节内容的数据块
+ * 
+ * 内联的文件不超过HITSZFS_INLINE_SZ时不分配；超出时按size预留数据块(HITSZFS_BLK_DELAY)，
+ * 回写时才由hitszfs_alloc_delayed按最终大小分配一段连续的块，
+ * 已有内容随inode->data一起写入数据块，inode不再内联
+ * 
+ * @param inode 普通文件或符号链接
+ * @param size 
+ * @return int 
+ */
+int hitszfs_reserve_data(struct hitszfs_inode* inode, int size) 
+{
+    int blks = (size + HITSZFS_BLK_SZ() - 1) / HITSZFS_BLK_SZ();
+    int need = 0;
+    int i;
+
+    if (size > HITSZFS_BLKS_SZ(HITSZFS_DATA_PER_FILE)) {
+        return -HITSZFS_ERROR_NOSPACE;
+    }
+    if (HITSZFS_IS_INLINE(inode) && size <= HITSZFS_INLINE_SZ) {
+        return HITSZFS_ERROR_NONE;
+    }
+    for (i = 0; i < blks; i++)
+    {
+        need += inode->data_blk[i] == HITSZFS_BLK_NONE;
+    }
+    if (need > 0) 
+    {
+        if (hitszfs_super.data_free - hitszfs_super.data_delalloc < need) {
+            hitszfs_reclaim_frees(FALSE);             /* 刚释放的块提交后才可用 */
+        }
+        pthread_mutex_lock(&hitszfs_super.bitmap_lock);
+        if (hitszfs_super.data_free - hitszfs_super.data_delalloc < need) {
+            pthread_mutex_unlock(&hitszfs_super.bitmap_lock);
+            return -HITSZFS_ERROR_NOSPACE;
+        }
+        hitszfs_super.data_delalloc += need;
+        pthread_mutex_unlock(&hitszfs_super.bitmap_lock);
+        for (i = 0; i < blks; i++)
+        {
+            if (inode->data_blk[i] == HITSZFS_BLK_NONE) {
+                inode->data_blk[i] = HITSZFS_BLK_DELAY;
+            }
+        }
+    }
+    hitszfs_mark_inode_dirty(inode, HITSZFS_FLAG_BUF_DIRTY | HITSZFS_FLAG_DATA_DIRTY);
+    return HITSZFS_ERROR_NONE;
+}
+/**
+ * @brief 为inode中延迟分配的块分配磁盘块，每段连续的预留块分配一次，
+ * 优先紧接在前一个已分配块之后
+ * 
+ * @param inode 
+ * @return int 
+ */
+static int hitszfs_alloc_delayed(struct hitszfs_inode* inode) 
+{
+    int i, j, want, goal, blk, len;
+
+    for (i = 0; i < HITSZFS_DATA_PER_FILE; i += len)
+    {
+        len = 1;
+        if (inode->data_blk[i] != HITSZFS_BLK_DELAY) {
+            continue;
+        }
+        for (want = 1; i + want < HITSZFS_DATA_PER_FILE && 
+             inode->data_blk[i + want] == HITSZFS_BLK_DELAY; want++);
+        goal = i > 0 ? inode->data_blk[i - 1] + 1 : -1;
+        pthread_mutex_lock(&hitszfs_super.bitmap_lock);
+        blk = hitszfs_alloc_data_run(goal, want, &len);
+        if (blk >= 0) {
+            hitszfs_super.data_delalloc -= len;
+        }
+        pthread_mutex_unlock(&hitszfs_super.bitmap_lock);
+        if (blk < 0) {                                /* 预留保证了空间，不应发生 */
+            HITSZFS_DBG("[%s] no space for reserved blocks\n", __func__);
+            return -HITSZFS_ERROR_NOSPACE;
+        }
+        for (j = 0; j < len; j++)
+        {
+            inode->data_blk[i + j] = blk + j;
+        }
+    }
+    return HITSZFS_ERROR_NONE;
+}
+/**
+ * @brief 初始化一个写批次
+ * 
+ * @param batch 
+ */
+void hitszfs_batch_init(struct hitszfs_io_batch* batch) 
+{
+    batch->reqs = NULL;
+    batch->cnt  = 0;
+    batch->cap  = 0;
+    memset(&batch->frees, 0, sizeof(struct hitszfs_free_list));
+}
+/**
+ * @brief 向批次中加入一个写请求，内容会被拷贝
+ * 
+ * @param batch 
+ * @param offset 磁盘偏移
+ * @param content 
+ * @param size 
+ * @return int 
+ */
+int hitszfs_batch_add(struct hitszfs_io_batch* batch, off_t offset, uint8_t* content, int size) 
+{
+    struct hitszfs_io_req* req;
+    if (batch->cnt == batch->cap) 
+    {
+        batch->cap  = batch->cap == 0 ? 16 : batch->cap * 2;
+        batch->reqs = (struct hitszfs_io_req*)realloc(batch->reqs, 
+                                                      batch->cap * sizeof(struct hitszfs_io_req));
+    }
+    req         = &batch->reqs[batch->cnt++];
+    req->offset = offset;
+    req->size   = size;
+    req->seq    = batch->cnt - 1;
+    req->buf    = (uint8_t*)malloc(size);
+    memcpy(req->buf, content, size);
+    return HITSZFS_ERROR_NONE;
+}
+
+static int hitszfs_io_req_cmp(const void* a, const void* b) 
+{
+    const struct hitszfs_io_req* ra = (const struct hitszfs_io_req*)a;
+    const struct hitszfs_io_req* rb = (const struct hitszfs_io_req*)b;
+    if (ra->offset != rb->offset) {                  /* 偏移是off_t，不能直接相减 */
+        return ra->offset < rb->offset ? -1 : 1;
+    }
+    return ra->seq - rb->seq;
+}
+
+static int hitszfs_io_req_seq_cmp(const void* a, const void* b) 
+{
+    return ((const struct hitszfs_io_req*)a)->seq - ((const struct hitszfs_io_req*)b)->seq;
+}
+/**
+ * @brief 将reqs[0, cnt)合并为一段连续的设备请求写出，调用者需持有io_lock
+ * 
+ * 请求已按偏移排序，且相互重叠、相邻或落在同一个IO单位内。
+ * 请求完整覆盖这段IO单位时不必先读，否则整段读一次再修改
+ * 
+ * @param reqs 
+ * @param cnt 
+ * @param lo 这段请求覆盖的起始偏移
+ * @param hi 这段请求覆盖的结束偏移
+ * @return int 
+ */
+static int hitszfs_driver_write_run(struct hitszfs_io_req* reqs, int cnt, off_t lo, off_t hi) 
+{
+    off_t    offset_aligned = HITSZFS_ROUND_DOWN(lo, HITSZFS_IO_SZ());
+    off_t    end_aligned    = HITSZFS_ROUND_UP(hi, HITSZFS_IO_SZ());
+    int      size_aligned   = (int)(end_aligned - offset_aligned);
+    uint8_t* temp_content   = (uint8_t*)malloc(size_aligned);
+    uint8_t* cur            = temp_content;
+    off_t    covered        = offset_aligned;
+    int      i;
+
+    for (i = 0; i < cnt && reqs[i].offset <= covered; i++)
+    {
+        if (reqs[i].offset + reqs[i].size > covered) {
+            covered = reqs[i].offset + reqs[i].size;
+        }
+    }
+    if (covered < end_aligned) {
+        hitszfs_driver_read_locked(offset_aligned, temp_content, size_aligned);
+    }
+    qsort(reqs, cnt, sizeof(struct hitszfs_io_req), hitszfs_io_req_seq_cmp);
+    for (i = 0; i < cnt; i++)                         /* 按加入顺序覆盖，重叠部分以后加入的为准 */
+    {
+        memcpy(temp_content + reqs[i].offset - offset_aligned, reqs[i].buf, reqs[i].size);
+    }
+
+    ddriver_seek(HITSZFS_DRIVER(), offset_aligned, SEEK_SET);
+    while (size_aligned != 0)
+    {
+        ddriver_write(HITSZFS_DRIVER(), (char*)cur, HITSZFS_IO_SZ());
+        cur          += HITSZFS_IO_SZ();
+        size_aligned -= HITSZFS_IO_SZ();   
+    }
+    free(temp_content);
+    return HITSZFS_ERROR_NONE;
+}
+/**
+ * @brief 将批次中的写请求写到原位置，并释放批次
+ * 
+ * 请求按磁盘偏移排序后，重叠、相邻或共用IO单位的请求合并为最长的连续段，
+ * 每段只seek一次、连续写出，seek次数与磁盘上的连续段数相同而与请求数无关
+ * 
+ * @param batch 
+ * @return int 
+ */
+int hitszfs_batch_write(struct hitszfs_io_batch* batch) 
+{
+    int   ret = HITSZFS_ERROR_NONE;
+    int   start, end;
+    off_t lo, hi;
+
+    qsort(batch->reqs, batch->cnt, sizeof(struct hitszfs_io_req), hitszfs_io_req_cmp);
+    pthread_mutex_lock(&hitszfs_super.io_lock);
+    for (start = 0; start < batch->cnt; start = end)
+    {
+        lo = batch->reqs[start].offset;
+        hi = lo + batch->reqs[start].size;
+        for (end = start + 1; end < batch->cnt; end++)
+        {
+            if (HITSZFS_ROUND_DOWN(batch->reqs[end].offset, HITSZFS_IO_SZ()) > 
+                HITSZFS_ROUND_UP(hi, HITSZFS_IO_SZ())) {
+                break;
+            }
+            if (batch->reqs[end].offset + batch->reqs[end].size > hi) {
+                hi = batch->reqs[end].offset + batch->reqs[end].size;
+            }
+        }
+        if (ret == HITSZFS_ERROR_NONE &&
+            hitszfs_driver_write_run(batch->reqs + start, end - start, lo, hi) != HITSZFS_ERROR_NONE) {
+            HITSZFS_DBG("[%s] io error\n", __func__);
+            ret = -HITSZFS_ERROR_IO;
+        }
+    }
+    pthread_mutex_unlock(&hitszfs_super.io_lock);
+    hitszfs_batch_free(batch);
+    return ret;
+}
+/**
+ * @brief 不写出，直接释放批次中的写请求
+ * 
+ * @param batch 
+ */
+void hitszfs_batch_free(struct hitszfs_io_batch* batch) 
+{
+    int i;
+
+    for (i = 0; i < batch->cnt; i++)
+    {
+        free(batch->reqs[i].buf);
+    }
+    free(batch->reqs);
+    free(batch->frees.ents);
+    hitszfs_batch_init(batch);
+}
+/**
+ * @brief 提交批次，启用日志时作为一个事务写入日志，否则直接写回原位置
+ * 
+ * 提交成功后批次中释放的块与inode号才归还位图
+ * 
+ * @param batch 元数据
+ * @param data 文件数据，先于元数据写回原位置；可以为NULL或与batch相同
+ * @return int 
+ */
+int hitszfs_batch_submit(struct hitszfs_io_batch* batch, struct hitszfs_io_batch* data) 
+{
+    struct hitszfs_free_list frees = batch->frees;
+    int                      ret   = HITSZFS_ERROR_NONE;
+
+    memset(&batch->frees, 0, sizeof(struct hitszfs_free_list));
+    if (data != NULL && data != batch) {
+        ret = hitszfs_batch_write(data);
+    }
+    if (ret != HITSZFS_ERROR_NONE) {                  /* 数据没有写完，不能提交引用它的元数据 */
+        hitszfs_batch_free(batch);
+    }
+    else {
+        ret = HITSZFS_JOURNAL() ? hitszfs_journal_commit(batch) : hitszfs_batch_write(batch);
+    }
+    hitszfs_free_list_release(&frees, ret == HITSZFS_ERROR_NONE);
+    return ret;
+}
+/**
+ * @brief 将inode中的脏部分（inode本身、含脏目录项的目录块、文件数据）加入批次，并清除脏标记
+ * 
+ * 文件数据加入data批次，启用日志时在元数据事务提交之前直接写回原位置(ordered模式)，不进入日志；
+ * 原位置仍有待检查点的日志块(刚释放的元数据块被重新分配为数据块)时随元数据一起记日志，
+ * 否则检查点或重放会用旧内容覆盖它。不带日志时两者可以是同一个批次
+ * 
+ * 调用者已将inode从脏链表摘下；延迟分配失败时inode保持脏标记重新挂回脏链表，
+ * dirty_cnt不变，空间释放后再由下一次回写处理。由inode的修改释放的块随本事务生效，
+ * 移入batch->frees，提交后归还
+ * 
+ * @param inode 
+ * @param batch 元数据
+ * @param data 文件数据
+ * @return int 延迟分配不到数据块时返回-HITSZFS_ERROR_NOSPACE
+ */
+static int hitszfs_stage_inode(struct hitszfs_inode * inode, struct hitszfs_io_batch* batch,
+                               struct hitszfs_io_batch* data) 
+{
+    struct hitszfs_inode_d  inode_d;
+    struct hitszfs_dentry*  dentry_cursor;
+    struct hitszfs_dentry_d* dentry_d;
+    uint8_t*                blks;
+    boolean                 blk_dirty[HITSZFS_DATA_PER_FILE] = { FALSE };
+    int                     slot_in_blk;
+    int                     i, run;
+
+    inode->flags &= ~HITSZFS_FLAG_STAGING;
+    if (HITSZFS_IS_DIR(inode) && (inode->flags & HITSZFS_FLAG_DENTRYS_DIRTY)) 
+    {                                                 /* 可能分配索引块，须先于inode写入 */
+        hitszfs_dx_stage(inode, batch);
+    }
+    if (!HITSZFS_IS_DIR(inode) && hitszfs_alloc_delayed(inode) != HITSZFS_ERROR_NONE) 
+    {                                                 /* 延迟分配的块同样须先于inode确定 */
+        inode->dirty_next        = hitszfs_super.dirty_list;
+        hitszfs_super.dirty_list = inode;
+        return -HITSZFS_ERROR_NOSPACE;
+    }
+    if ((inode->flags & HITSZFS_FLAG_BUF_DIRTY) || 
+        (HITSZFS_IS_INLINE(inode) && (inode->flags & HITSZFS_FLAG_DATA_DIRTY))) 
+    {
+        memset(&inode_d, 0, sizeof(struct hitszfs_inode_d));
+        inode_d.ino         = inode->ino;
+        inode_d.size        = inode->size;
+        inode_d.ftype       = inode->dentry->ftype;
+        inode_d.dir_cnt     = inode->dir_cnt;
+        for (i = 0; i < HITSZFS_DATA_PER_FILE; i++)
+        {
+            inode_d.data_blk[i] = inode->data_blk[i];
+        }
+        inode_d.index_blk   = inode->index_blk;
+        inode_d.atime       = inode->atime;
+        inode_d.mtime       = inode->mtime;
+        inode_d.ctime       = inode->ctime;
+        if (HITSZFS_IS_INLINE(inode) && inode->data != NULL && inode->size <= HITSZFS_INLINE_SZ) {
+            memcpy(inode_d.inline_data, inode->data, inode->size);
+        }
+        hitszfs_batch_add(batch, HITSZFS_INO_OFS(inode->ino), (uint8_t *)&inode_d, 
+                          sizeof(struct hitszfs_inode_d));
+        hitszfs_itable_update(&inode_d);
+    }
+                                                      /* 变长格式直接写回被修改的目录块镜像 */
+    if (HITSZFS_IS_DIR(inode) && HITSZFS_VAR_DENTRY() && (inode->flags & HITSZFS_FLAG_DENTRYS_DIRTY)) 
+    {
+        for (i = 0; i < HITSZFS_DATA_PER_FILE; i++)
+        {
+            if ((inode->dirty_blks & (1 << i)) && inode->data_blk[i] != HITSZFS_BLK_NONE) {
+                hitszfs_batch_add(batch, HITSZFS_DATA_OFS(inode->data_blk[i]), 
+                                  inode->data + HITSZFS_BLKS_SZ(i), HITSZFS_BLK_SZ());
+            }
+        }
+        inode->dirty_blks = 0;
+        for (dentry_cursor = inode->dentrys; dentry_cursor != NULL; dentry_cursor = dentry_cursor->brother)
+        {
+            dentry_cursor->flags &= ~HITSZFS_FLAG_BUF_DIRTY;
+        }
+    }
+                                                      /* 只写回含有脏目录项的目录块 */
+    else if (HITSZFS_IS_DIR(inode) && (inode->flags & HITSZFS_FLAG_DENTRYS_DIRTY)) 
+    {
+        blks = (uint8_t *)malloc(HITSZFS_BLKS_SZ(HITSZFS_DATA_PER_FILE));
+        memset(blks, 0, HITSZFS_BLKS_SZ(HITSZFS_DATA_PER_FILE));
+        dentry_cursor = inode->dentrys;
+        while (dentry_cursor != NULL)
+        {
+            i           = dentry_cursor->slot / HITSZFS_DENTRY_PER_BLK();
+            slot_in_blk = dentry_cursor->slot % HITSZFS_DENTRY_PER_BLK();
+            dentry_d    = (struct hitszfs_dentry_d *)(blks + HITSZFS_BLKS_SZ(i)) + slot_in_blk;
+            strncpy(dentry_d->fname, dentry_cursor->fname, MAX_NAME_LEN - 1);
+            dentry_d->ftype = dentry_cursor->ftype;
+            dentry_d->ino   = dentry_cursor->ino;
+            if (HITSZFS_IS_DIRTY(dentry_cursor)) {
+                blk_dirty[i] = TRUE;
+                dentry_cursor->flags &= ~HITSZFS_FLAG_BUF_DIRTY;
+            }
+            dentry_cursor = dentry_cursor->brother;
+        }
+        for (i = 0; i < HITSZFS_DATA_PER_FILE; i++)
+        {
+            if (blk_dirty[i] && inode->data_blk[i] != HITSZFS_BLK_NONE) {
+                hitszfs_batch_add(batch, HITSZFS_DATA_OFS(inode->data_blk[i]), 
+                                  blks + HITSZFS_BLKS_SZ(i), HITSZFS_BLK_SZ());
+            }
+        }
+        free(blks);
+    }
+    else if (!HITSZFS_IS_DIR(inode) && !HITSZFS_IS_INLINE(inode) && (inode->flags & HITSZFS_FLAG_DATA_DIRTY)) 
+    {                                                 /* 内联内容已随inode写入，物理上连续的块作为一个请求 */
+        for (i = 0; i < HITSZFS_DATA_PER_FILE; i += run)
+        {
+            run = 1;
+            if (inode->data_blk[i] == HITSZFS_BLK_NONE) {
+                continue;
+            }
+            while (i + run < HITSZFS_DATA_PER_FILE && inode->data_blk[i + run] != HITSZFS_BLK_NONE &&
+                   HITSZFS_DATA_OFS(inode->data_blk[i + run]) == 
+                   HITSZFS_DATA_OFS(inode->data_blk[i]) + HITSZFS_BLKS_SZ(run))
+            {
+                run++;
+            }
+            hitszfs_batch_add(hitszfs_journal_pinned(HITSZFS_DATA_OFS(inode->data_blk[i]), HITSZFS_BLKS_SZ(run)) 
+                              ? batch : data, HITSZFS_DATA_OFS(inode->data_blk[i]), 
+                              inode->data + HITSZFS_BLKS_SZ(i), HITSZFS_BLKS_SZ(run));
+        }
+    }
+    if (inode->flags != 0) {
+        hitszfs_super.dirty_cnt--;
+    }
+    inode->flags = 0;
+    hitszfs_free_list_move(&batch->frees, &inode->frees);
+    return HITSZFS_ERROR_NONE;
+}
+/**
+ * @brief 将主超级块及位图脏的块组的位图块加入批次
+ * 
+ * 超级块备份(带各自块组的空闲摘要)只在HITSZFS_FLAG_BACKUP_DIRTY时写回，即格式化、卸载与fsck修复后；
+ * 平时只写主超级块并清除其中的HITSZFS_SUPER_CLEAN，表示备份中的摘要可能已过时。
+ * batch->frees中的块与inode号在写出的位图与空闲计数中已归还，内存中的位图等提交后再归还
+ * 
+ * @param batch 
+ * @return int 
+ */
+static int hitszfs_stage_super(struct hitszfs_io_batch* batch) 
+{
+    struct hitszfs_super_d  hitszfs_super_d; 
+    struct hitszfs_group_sum* sum;
+    struct hitszfs_free_ent* ent;
+    uint8_t*                imap_blk;
+    uint8_t*                dmap_blk;
+    boolean                 backup;
+    int                     free_inode, free_data, grp_data;
+    int                     group, bit, run, i;
+
+    memset(&hitszfs_super_d, 0, sizeof(struct hitszfs_super_d));
+    hitszfs_super_d.magic_num           = HITSZFS_MAGIC_NUM;
+    // inode位图
+    hitszfs_super_d.map_inode_blks      = hitszfs_super.map_inode_blks;
+    hitszfs_super_d.map_inode_offset    = hitszfs_super.map_inode_offset;
+
+    // data位图
+    hitszfs_super_d.map_data_blks       = hitszfs_super.map_data_blks;
+    hitszfs_super_d.map_data_offset     = hitszfs_super.map_data_offset;
+
+    hitszfs_super_d.inode_offset        = hitszfs_super.inode_offset;
+    hitszfs_super_d.data_offset         = hitszfs_super.data_offset;
+    hitszfs_super_d.max_ino             = hitszfs_super.max_ino;
+    hitszfs_super_d.max_data            = hitszfs_super.max_data;
+    hitszfs_super_d.features            = hitszfs_super.features;
+    // 块组
+    hitszfs_super_d.sz_blk              = hitszfs_super.sz_blk;
+    hitszfs_super_d.group_cnt           = hitszfs_super.group_cnt;
+    hitszfs_super_d.blks_per_group      = hitszfs_super.blks_per_group;
+    hitszfs_super_d.inodes_per_group    = hitszfs_super.inodes_per_group;
+    hitszfs_super_d.data_per_group      = hitszfs_super.data_per_group;
+    hitszfs_super_d.inode_blks          = hitszfs_super.inode_blks;
+    hitszfs_super_d.journal_offset      = hitszfs_super.journal_offset;
+    hitszfs_super_d.journal_blks        = hitszfs_super.journal_blks;
+
+    imap_blk = (uint8_t *)malloc(HITSZFS_BLK_SZ());
+    dmap_blk = (uint8_t *)malloc(HITSZFS_BLK_SZ());
+    pthread_mutex_lock(&hitszfs_super.bitmap_lock);
+    backup = (hitszfs_super.flags & HITSZFS_FLAG_BACKUP_DIRTY) != 0;
+    free_inode = hitszfs_super.inode_free;
+    free_data  = hitszfs_super.data_free;
+    for (i = 0; i < batch->frees.cnt; i++)             /* 本事务释放的块在写出的位图中已空闲 */
+    {
+        ent = &batch->frees.ents[i];
+        if (ent->is_ino) {
+            hitszfs_super.groups[ent->no / hitszfs_super.inodes_per_group].flags |= HITSZFS_FLAG_IMAP_DIRTY;
+            free_inode++;
+        }
+        else {
+            hitszfs_super.groups[ent->no / hitszfs_super.data_per_group].flags |= HITSZFS_FLAG_DMAP_DIRTY;
+            free_data++;
+        }
+    }
+    hitszfs_super_d.sz_usage            = (int64_t)HITSZFS_BLK_SZ() * (hitszfs_super.max_data - free_data);
+    hitszfs_super_d.free_inode          = free_inode;
+    hitszfs_super_d.free_data           = free_data;
+    hitszfs_super_d.state               = backup ? HITSZFS_SUPER_CLEAN : 0;
+    for (group = 0; group < hitszfs_super.group_cnt; group++)
+    {
+        sum = &hitszfs_super.groups[group];
+        // inode位图
+        if (sum->flags & HITSZFS_FLAG_IMAP_DIRTY) {
+            memset(imap_blk, 0, HITSZFS_BLK_SZ());
+            memcpy(imap_blk, hitszfs_super.map_inode + group * HITSZFS_GROUP_MAP_INODE_SZ(), 
+                   HITSZFS_GROUP_MAP_INODE_SZ());
+        }
+        // data位图
+        if (sum->flags & HITSZFS_FLAG_DMAP_DIRTY) {
+            memset(dmap_blk, 0, HITSZFS_BLK_SZ());
+            memcpy(dmap_blk, hitszfs_super.map_data + group * HITSZFS_GROUP_MAP_DATA_SZ(), 
+                   HITSZFS_GROUP_MAP_DATA_SZ());
+        }
+        for (i = 0; i < batch->frees.cnt; i++)
+        {
+            ent = &batch->frees.ents[i];
+            bit = ent->no - group * (ent->is_ino ? hitszfs_super.inodes_per_group : hitszfs_super.data_per_group);
+            if (bit >= 0 && bit < (ent->is_ino ? hitszfs_super.inodes_per_group : hitszfs_super.data_per_group)) {
+                (ent->is_ino ? imap_blk : dmap_blk)[bit / UINT8_BITS] &= ~(0x1 << (bit % UINT8_BITS));
+            }
+        }
+        // 超级块(块组0)或其备份，各带本块组的空闲摘要
+        if (group == 0 || backup) {
+            grp_data = hitszfs_free_list_count(&batch->frees, group, FALSE);
+            hitszfs_super_d.grp_free_inode  = sum->free_inode + hitszfs_free_list_count(&batch->frees, group, TRUE);
+            hitszfs_super_d.grp_free_data   = sum->free_data + grp_data;
+            hitszfs_super_d.grp_max_extent  = sum->max_extent;
+            for (bit = 0, run = 0; grp_data > 0 && bit < hitszfs_super.data_per_group && 
+                 group * hitszfs_super.data_per_group + bit < HITSZFS_MAX_DATA(); bit++)
+            {                                         /* 释放的块可能连起两侧的空闲区间，按写出的位图重新计算 */
+                run = (dmap_blk[bit / UINT8_BITS] & (0x1 << (bit % UINT8_BITS))) ? 0 : run + 1;
+                hitszfs_super_d.grp_max_extent = run > hitszfs_super_d.grp_max_extent ? run 
+                                                                                      : hitszfs_super_d.grp_max_extent;
+            }
+            hitszfs_batch_add(batch, HITSZFS_GROUP_OFS(group) + HITSZFS_SUPER_OFS, (uint8_t *)&hitszfs_super_d, 
+                              sizeof(struct hitszfs_super_d));
+        }
+        if (sum->flags & HITSZFS_FLAG_IMAP_DIRTY) {
+            hitszfs_batch_add(batch, HITSZFS_GROUP_OFS(group) + hitszfs_super.map_inode_offset, imap_blk, 
+                              HITSZFS_BLK_SZ());
+        }
+        if (sum->flags & HITSZFS_FLAG_DMAP_DIRTY) {
+            hitszfs_batch_add(batch, HITSZFS_GROUP_OFS(group) + hitszfs_super.map_data_offset, dmap_blk, 
+                              HITSZFS_BLK_SZ());
+        }
+        sum->flags = 0;
+    }
+    hitszfs_super.flags &= ~(HITSZFS_FLAG_BUF_DIRTY | HITSZFS_FLAG_BACKUP_DIRTY);
+    pthread_mutex_unlock(&hitszfs_super.bitmap_lock);
+    free(imap_blk);
+    free(dmap_blk);
+    return HITSZFS_ERROR_NONE;
+}
+/**
+ * @brief 标记全部块组的位图块与超级块备份待写回，用于格式化和fsck替换位图之后
+ * 
+ * 调用者持bitmap_lock或尚未开始并发访问
+ */
+void hitszfs_group_dirty_all() 
+{
+    int group;
+
+    for (group = 0; group < hitszfs_super.group_cnt; group++)
+    {
+        hitszfs_super.groups[group].flags |= HITSZFS_FLAG_IMAP_DIRTY | HITSZFS_FLAG_DMAP_DIRTY;
+    }
+    hitszfs_super.flags |= HITSZFS_FLAG_BUF_DIRTY | HITSZFS_FLAG_BACKUP_DIRTY;
+}
+/**
+ * @brief 将inode从脏链表中摘除
+ * 
+ * @param inode 
+ */
+static void hitszfs_dirty_list_del(struct hitszfs_inode * inode) 
+{
+    struct hitszfs_inode** pprev = &hitszfs_super.dirty_list;
+    while (*pprev != NULL && *pprev != inode)
+    {
+        pprev = &(*pprev)->dirty_next;
+    }
+    if (*pprev == inode) {
+        *pprev = inode->dirty_next;
+    }
+    inode->dirty_next = NULL;
+}
+/**
+ * @brief 删除文件或空目录的inode: 数据块、索引块和inode号待父目录提交后归还位图，
+ * 从脏链表摘除(不再回写)，并释放内存中的inode
+ * 
+ * 删除随父目录中目录项的变化一起生效，释放记在父目录上(见hitszfs_defer_free)；
+ * inode自己尚未提交的释放一并转过去。已从目录摘下(dentry->parent为NULL)时没有父目录可依
+ * 
+ * @param inode 调用者持超级块写锁，且inode已不在任何目录中
+ */
+void hitszfs_drop_inode(struct hitszfs_inode * inode) 
+{
+    struct hitszfs_inode* owner = NULL;
+    int i;
+
+    if (inode->dentry != NULL && inode->dentry->parent != NULL) {
+        owner = inode->dentry->parent->inode;
+    }
+    if (inode->flags != 0) {
+        hitszfs_dirty_list_del(inode);
+        hitszfs_super.dirty_cnt--;
+        inode->flags = 0;
+    }
+    for (i = 0; i < HITSZFS_DATA_PER_FILE; i++)
+    {
+        if (inode->data_blk[i] != HITSZFS_BLK_NONE) {
+            hitszfs_defer_free(owner, inode->data_blk[i], FALSE);
+        }
+    }
+    if (inode->index_blk != HITSZFS_BLK_NONE) {
+        hitszfs_defer_free(owner, inode->index_blk, FALSE);
+    }
+    hitszfs_defer_free(owner, inode->ino, TRUE);
+    for (i = 0; i < inode->frees.cnt; i++)
+    {
+        hitszfs_defer_free(owner, inode->frees.ents[i].no, inode->frees.ents[i].is_ino);
+    }
+    if (inode->dentry != NULL) {
+        inode->dentry->inode = NULL;
+    }
+    hitszfs_free_inode(inode);
+}
+/**
+ * @brief 标记inode与提交它时必须同在一个事务中的inode，返回FALSE表示需要整条脏链表
+ * 
+ * 目录中尚未写入的目录项(新建、移入或换了槽位)指向的脏inode一起提交，
+ * 否则崩溃后目录项会指向磁盘上尚未写入的inode。跨目录rename的两端无法只凭一端找到另一端，
+ * 遇到时退回整条脏链表
+ * 
+ * @param inode 
+ * @return boolean 
+ */
+static boolean hitszfs_deps_mark_tree(struct hitszfs_inode * inode) 
+{
+    struct hitszfs_dentry* dentry;
+
+    if (inode->flags & HITSZFS_FLAG_XRENAME) {
+        return FALSE;
+    }
+    if (inode->flags & HITSZFS_FLAG_STAGING) {
+        return TRUE;
+    }
+    inode->flags |= HITSZFS_FLAG_STAGING;
+    if (!HITSZFS_IS_DIR(inode) || !(inode->flags & HITSZFS_FLAG_DENTRYS_DIRTY)) {
+        return TRUE;
+    }
+    for (dentry = inode->dentrys; dentry != NULL; dentry = dentry->brother)
+    {
+        if ((dentry->flags & HITSZFS_FLAG_BUF_DIRTY) && dentry->inode != NULL && dentry->inode->flags != 0 &&
+            !hitszfs_deps_mark_tree(dentry->inode)) {
+            return FALSE;
+        }
     }
-    memcpy(out_content, temp_content + bias, size);
-    free(temp_content);
-    return HITSZFS_ERROR_NONE;
+    return TRUE;
 }
 /**
- * @brief 驱动写
+ * @brief 选入inode及其依赖: inode的目录项尚未写入时先上溯到目录项已写入的祖先(或不脏的父目录)，
+ * 再标记其下的闭包，见hitszfs_deps_mark_tree
  * 
- * @param offset 
- * @param in_content 
- * @param size 
- * @return int 
+ * @param inode 脏inode
+ * @return boolean 
  */
-int hitszfs_driver_write(int offset, uint8_t *in_content, int size) 
+static boolean hitszfs_deps_mark(struct hitszfs_inode * inode) 
 {
-    int      offset_aligned = HITSZFS_ROUND_DOWN(offset, HITSZFS_IO_SZ());
-    int      bias           = offset - offset_aligned;
-    int      size_aligned   = HITSZFS_ROUND_UP((size + bias), HITSZFS_IO_SZ());
-    uint8_t* temp_content   = (uint8_t*)malloc(size_aligned);
-    uint8_t* cur            = temp_content;
-    hitszfs_driver_read(offset_aligned, temp_content, size_aligned);
-    memcpy(temp_content + bias, in_content, size);
-    
-    // lseek(HITSZ_DRIVER(), offset_aligned, SEEK_SET);
-    ddriver_seek(HITSZFS_DRIVER(), offset_aligned, SEEK_SET);
-    while (size_aligned != 0)
+    struct hitszfs_dentry* parent;
+
+    while ((inode->dentry->flags & HITSZFS_FLAG_BUF_DIRTY) && (parent = inode->dentry->parent) != NULL &&
+           parent->inode != NULL && parent->inode->flags != 0)
     {
-        // write(HITSZFS_DRIVER(), cur, HITSZ_IO_SZ());
-        ddriver_write(HITSZFS_DRIVER(), (char*)cur, HITSZFS_IO_SZ());
-        cur          += HITSZFS_IO_SZ();
-        size_aligned -= HITSZFS_IO_SZ();   
+        inode = parent->inode;
     }
-
-    free(temp_content);
-    return HITSZFS_ERROR_NONE;
+    return hitszfs_deps_mark_tree(inode);
 }
 /**
- * @brief 为一个inode分配dentry，采用头插法
+ * @brief 把已标记HITSZFS_FLAG_STAGING的inode与脏位图作为一个事务提交
+ * 
+ * 提交后脏链表为空时，已不在目录中的inode释放的块(orphan_frees)也随之归还
  * 
- * @param inode 
- * @param dentry 
  * @return int 
  */
-int hitszfs_alloc_dentry(struct hitszfs_inode* inode, struct hitszfs_dentry* dentry) 
+static int hitszfs_sync_marked() 
 {
-    if (inode->dentrys == NULL) 
+    struct hitszfs_io_batch batch;
+    struct hitszfs_io_batch data;
+    struct hitszfs_io_batch* pdata = HITSZFS_JOURNAL() ? &data : &batch;
+    struct hitszfs_inode**  pprev = &hitszfs_super.dirty_list;
+    struct hitszfs_inode*   list  = NULL;
+    struct hitszfs_inode*   inode;
+    int                     ret = HITSZFS_ERROR_NONE;
+    int                     err;
+
+    hitszfs_batch_init(&batch);
+    hitszfs_batch_init(&data);
+    while (*pprev != NULL)                            /* 先全部摘下，写不回的inode会重新挂到表头 */
     {
-        inode->dentrys = dentry;
+        inode = *pprev;
+        if (!(inode->flags & HITSZFS_FLAG_STAGING)) {
+            pprev = &inode->dirty_next;
+            continue;
+        }
+        *pprev            = inode->dirty_next;
+        inode->dirty_next = list;                     /* 脏链表新的在前，倒过来按变脏的先后分配延迟块 */
+        list              = inode;
     }
-    else 
+    while (list != NULL)
     {
-        dentry->brother = inode->dentrys;
-        inode->dentrys = dentry;
+        inode             = list;
+        list              = inode->dirty_next;
+        inode->dirty_next = NULL;
+        err = hitszfs_stage_inode(inode, &batch, pdata);
+        if (err != HITSZFS_ERROR_NONE) {
+            ret = err;
+        }
     }
-    inode->dir_cnt++;
-    return inode->dir_cnt;
+    if (hitszfs_super.dirty_list == NULL) {
+        hitszfs_free_list_move(&batch.frees, &hitszfs_super.orphan_frees);
+    }
+    if (hitszfs_super.flags & HITSZFS_FLAG_BUF_DIRTY) {
+        hitszfs_stage_super(&batch);
+    }
+    err = hitszfs_batch_submit(&batch, pdata);
+    return err != HITSZFS_ERROR_NONE ? err : ret;
 }
 /**
- * @brief 分配一个数据块
+ * @brief 只将一个inode及其依赖的脏部分刷回磁盘，位图脏时一并写回
  * 
- * @return 返回块号
+ * 启用日志时作为一个事务提交。新建的文件连同父目录中它所在的目录块一起提交(父目录块中
+ * 其他新建的目录项也一起带上它们的inode)，其余脏inode留在脏链表上，由后台回写或sync组提交
+ * 
+ * @param inode 
+ * @return int 
  */
-int
-hitszfs_alloc_data_blk()
+int hitszfs_sync_inode(struct hitszfs_inode * inode) 
 {
-    int byte_cursor = 0; 
-    int bit_cursor  = 0; 
-    int data_blk_cursor  = 0;
-    boolean is_find_free_blk = FALSE;
-    for (byte_cursor = 0; byte_cursor < HITSZFS_MAX_DATA()/UINT8_BITS; byte_cursor++)
-    {
-        for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++) {
-            if((hitszfs_super.map_data[byte_cursor] & (0x1 << bit_cursor)) == 0) {    
-                                                      /* 当前data_blk_cursor位置空闲 */
-                hitszfs_super.map_data[byte_cursor] |= (0x1 << bit_cursor);
-                is_find_free_blk = TRUE;           
-                break;
-            }
-            data_blk_cursor++;
-        }
-        if (is_find_free_blk) {
-            return data_blk_cursor;
-        }
+    if (inode->flags == 0 && !(hitszfs_super.flags & HITSZFS_FLAG_BUF_DIRTY)) {
+        return HITSZFS_ERROR_NONE;
+    }
+    if (inode->flags != 0 && !hitszfs_deps_mark(inode)) {
+        return hitszfs_sync_dirty();
     }
-    return -HITSZFS_ERROR_NOSPACE;
+    return hitszfs_sync_marked();
 }
 /**
- * @brief 分配一个inode，占用位图
+ * @brief 回写在expire之前变脏的inode，单次最多选max_cnt个，连同它们的依赖作为一个事务提交，
+ * 用于后台回写
  * 
- * @param dentry 该dentry指向分配的inode
- * @return hitszfs_inode
+ * @param expire 变脏时间不晚于该时刻的inode会被回写
+ * @param max_cnt 
+ * @return int 选中的到期inode数，出错返回负值
  */
-struct hitszfs_inode* hitszfs_alloc_inode(struct hitszfs_dentry * dentry) 
+int hitszfs_writeback(time_t expire, int max_cnt) 
 {
     struct hitszfs_inode* inode;
-    int byte_cursor = 0; 
-    int bit_cursor  = 0; 
-    int ino_cursor  = 0;
-    boolean is_find_free_entry = FALSE;
-
-    // 在inode位图上寻找未使用的inode节点
-    // for (byte_cursor = 0; byte_cursor < HITSZFS_BLKS_SZ(hitszfs_super.map_inode_blks); 
-    //      byte_cursor++)
-    for (byte_cursor = 0; byte_cursor < HITSZFS_MAX_INO() / UINT8_BITS; byte_cursor++)
-    {
-        for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++) {
-            if((hitszfs_super.map_inode[byte_cursor] & (0x1 << bit_cursor)) == 0) {    
-                                                      /* 当前ino_cursor位置空闲 */
-                hitszfs_super.map_inode[byte_cursor] |= (0x1 << bit_cursor);
-                is_find_free_entry = TRUE;           
-                break;
-            }
-            ino_cursor++;
+    int                   cnt = 0;
+    int                   ret;
+
+    for (inode = hitszfs_super.dirty_list; inode != NULL && cnt < max_cnt; inode = inode->dirty_next)
+    {
+        if (inode->dirtied_when > expire || (inode->flags & HITSZFS_FLAG_STAGING)) {
+            continue;
         }
-        if (is_find_free_entry) {
-            break;
+        if (!hitszfs_deps_mark(inode)) {              /* 有跨目录rename，整条脏链表一起提交 */
+            cnt = hitszfs_super.dirty_cnt;
+            ret = hitszfs_sync_dirty();
+            return ret == HITSZFS_ERROR_NONE ? cnt : ret;
         }
+        cnt++;
     }
-
-    // 为目录项分配inode节点并建立他们之间的连接
-    // if (!is_find_free_entry || ino_cursor == hitszfs_super.max_ino)
-    //     return -HITSZFS_ERROR_NOSPACE;
-
-    inode = (struct hitszfs_inode*)malloc(sizeof(struct hitszfs_inode));
-    inode->ino  = ino_cursor; 
-    inode->size = 0;
-                                                      /* dentry指向inode */
-    dentry->inode = inode;
-    dentry->ino   = inode->ino;
-                                                      /* inode指回dentry */
-    inode->dentry = dentry;
-    
-    inode->dir_cnt = 0;
-    inode->dentrys = NULL;
-    inode->data_blk[0] = hitszfs_alloc_data_blk();
-    
-    if (HITSZFS_IS_REG(inode)) 
-    {
-        inode->data = (uint8_t *)malloc(HITSZFS_BLKS_SZ(1));
+    if (cnt == 0) {
+        return 0;
     }
-
-    return inode;
+    ret = hitszfs_sync_marked();
+    return ret == HITSZFS_ERROR_NONE ? cnt : ret;
 }
 /**
- * @brief 将内存inode及其下方结构全部刷回磁盘
+ * @brief 将脏链表上的所有inode以及脏位图按磁盘偏移排序后一次性刷回
+ * 
+ * 卸载耗时只与修改量有关，与目录树大小无关。启用日志时文件数据先写回原位置，
+ * 元数据作为一个事务提交。延迟分配失败的inode留在脏链表上，其余照常写回
  * 
- * @param inode 
  * @return int 
  */
-int hitszfs_sync_inode(struct hitszfs_inode * inode) 
+int hitszfs_sync_dirty() 
 {
-    struct hitszfs_inode_d  inode_d;
-    struct hitszfs_dentry*  dentry_cursor;
-    struct hitszfs_dentry_d dentry_d;
-    int ino             = inode->ino;
-    inode_d.ino         = ino;
-    inode_d.size        = inode->size;
-    inode_d.ftype       = inode->dentry->ftype;
-    inode_d.dir_cnt     = inode->dir_cnt;
-    int offset;
-    
-    for(int i = 0; i < HITSZFS_DATA_PER_FILE; i++)
-    {
-        inode_d.data_blk[i] = (uint16_t)inode->data_blk[i];
-    }
-    if (hitszfs_driver_write(HITSZFS_INO_OFS(ino), (uint8_t *)&inode_d, 
-                     sizeof(struct hitszfs_inode_d)) != HITSZFS_ERROR_NONE) {
-        HITSZFS_DBG("[%s] io error\n", __func__);
-        return -HITSZFS_ERROR_IO;
-    }
-                                                      /* Cycle 1: 写 INODE */
-                                                      /* Cycle 2: 写 数据 */
-    if (HITSZFS_IS_DIR(inode)) 
-    {                          
-        dentry_cursor = inode->dentrys;
-        // offset        = HITSZFS_DATA_OFS(ino);
-        offset           = HITSZFS_DATA_OFS(inode->data_blk[0]);
-        while (dentry_cursor != NULL)
-        {
-            memcpy(dentry_d.fname, dentry_cursor->fname, HITSZFS_MAX_FILE_NAME);
-            dentry_d.ftype = dentry_cursor->ftype;
-            dentry_d.ino = dentry_cursor->ino;
-            if (hitszfs_driver_write(offset, (uint8_t *)&dentry_d, 
-                                 sizeof(struct hitszfs_dentry_d)) != HITSZFS_ERROR_NONE) {
-                HITSZFS_DBG("[%s] io error\n", __func__);
-                return -HITSZFS_ERROR_IO;                     
-            }
-            // 递归写回各个子目录项的inode
-            if (dentry_cursor->inode != NULL) {
-                hitszfs_sync_inode(dentry_cursor->inode);
-            }
+    struct hitszfs_inode* inode;
 
-            dentry_cursor = dentry_cursor->brother;
-            offset += sizeof(struct hitszfs_dentry_d);
-        }
-    }
-    else if (HITSZFS_IS_REG(inode)) 
+    for (inode = hitszfs_super.dirty_list; inode != NULL; inode = inode->dirty_next)
     {
-        if (hitszfs_driver_write(HITSZFS_DATA_OFS(inode->data_blk[0]), inode->data, 
-                             HITSZFS_BLKS_SZ(HITSZFS_DATA_PER_FILE)) != HITSZFS_ERROR_NONE) {
-            HITSZFS_DBG("[%s] io error\n", __func__);
-            return -HITSZFS_ERROR_IO;
-        }
+        inode->flags |= HITSZFS_FLAG_STAGING;
     }
-    return HITSZFS_ERROR_NONE;
+    return hitszfs_sync_marked();
 }
 /**
  * @brief 
@@ -277,15 +1474,13 @@ int hitszfs_sync_inode(struct hitszfs_inode * inode)
  */
 struct hitszfs_inode* hitszfs_read_inode(struct hitszfs_dentry * dentry, int ino) 
 {
-    struct hitszfs_inode* inode = (struct hitszfs_inode*)malloc(sizeof(struct hitszfs_inode));
+    struct hitszfs_inode* inode = hitszfs_new_inode();
     struct hitszfs_inode_d inode_d;
-    struct hitszfs_dentry* sub_dentry;
-    struct hitszfs_dentry_d dentry_d;
-    int    dir_cnt = 0, i;
-    // 通过磁盘驱动来将磁盘中ino号的inode读入内存
-    if (hitszfs_driver_read(HITSZFS_INO_OFS(ino), (uint8_t *)&inode_d, 
-                        sizeof(struct hitszfs_inode_d)) != HITSZFS_ERROR_NONE) {
+    int    i;
+    // 通过inode表块缓存将磁盘中ino号的inode读入内存
+    if (hitszfs_itable_read(ino, &inode_d) != HITSZFS_ERROR_NONE) {
         HITSZFS_DBG("[%s] io error\n", __func__);
+        hitszfs_free_inode(inode);                    /* 归还slab，inode计数随之恢复 */
         return NULL;                    
     }
     inode->dir_cnt = 0;
@@ -293,58 +1488,187 @@ struct hitszfs_inode* hitszfs_read_inode(struct hitszfs_dentry * dentry, int ino
     inode->size = inode_d.size;
     inode->dentry = dentry;
     inode->dentrys = NULL;
+    inode->dindex = NULL;
+    inode->dentrys_loaded = TRUE;
+    inode->index_blk = inode_d.index_blk;
+    inode->data = NULL;
+    inode->data_valid = 0;
+    inode->data_ra = 0;
+    inode->flags = 0;
+    inode->dirty_blks = 0;
+    inode->dirty_next = NULL;
+    inode->atime = inode_d.atime;
+    inode->mtime = inode_d.mtime;
+    inode->ctime = inode_d.ctime;
+    for (i = 0; i < HITSZFS_DATA_PER_FILE; i++)
+    {
+        inode->data_blk[i] = inode_d.data_blk[i];
+    }
     /**
      * 判断inode的文件类型
-     * 如果是目录类型则需要读取每一个目录项并建立连接
+     * 如果是目录类型，目录项推迟到查找或遍历时再按块读入(hitszfs_dir_load)
      */
     if (HITSZFS_IS_DIR(inode)) 
     {
-        dir_cnt = inode_d.dir_cnt;
-        for (i = 0; i < dir_cnt; i++)
-        {
-            if (hitszfs_driver_read(HITSZFS_DATA_OFS(ino) + i * sizeof(struct hitszfs_dentry_d), 
-                                (uint8_t *)&dentry_d, 
-                                sizeof(struct hitszfs_dentry_d)) != HITSZFS_ERROR_NONE) {
-                HITSZFS_DBG("[%s] io error\n", __func__);
-                return NULL;                    
-            }
-            sub_dentry = new_dentry(dentry_d.fname, dentry_d.ftype);
-            sub_dentry->parent = inode->dentry;
-            sub_dentry->ino    = dentry_d.ino; 
-            hitszfs_alloc_dentry(inode, sub_dentry);
-        }
+        inode->dir_cnt        = inode_d.dir_cnt;
+        inode->dentrys_loaded = FALSE;
     }
-    // 如果是文件类型直接读取数据即可
-    else if (HITSZFS_IS_REG(inode)) 
+    // 内联的内容就在inode中；普通文件的数据块推迟到读写时按需读入(hitszfs_file_fill)，符号链接直接读入
+    else if (HITSZFS_IS_REG(inode) || HITSZFS_IS_SYM_LINK(inode)) 
     {
         inode->data = (uint8_t *)malloc(HITSZFS_BLKS_SZ(HITSZFS_DATA_PER_FILE));
-        if (hitszfs_driver_read(HITSZFS_DATA_OFS(ino), (uint8_t *)inode->data, 
-                            HITSZFS_BLKS_SZ(HITSZFS_DATA_PER_FILE)) != HITSZFS_ERROR_NONE) {
+        memset(inode->data, 0, HITSZFS_BLKS_SZ(HITSZFS_DATA_PER_FILE));
+        if (HITSZFS_IS_INLINE(inode)) {
+            if (inode->size <= HITSZFS_INLINE_SZ) {
+                memcpy(inode->data, inode_d.inline_data, inode->size);
+            }
+            inode->data_valid = HITSZFS_DATA_ALL;
+        }
+        if (HITSZFS_IS_SYM_LINK(inode) &&
+            hitszfs_file_fill(inode, 0, HITSZFS_DATA_PER_FILE - 1, FALSE) != HITSZFS_ERROR_NONE) {
             HITSZFS_DBG("[%s] io error\n", __func__);
+            hitszfs_free_inode(inode);
             return NULL;                    
         }
     }
     return inode;
 }
+/**
+ * @brief 取dentry对应的内存inode，尚未读入(或已被淘汰)时从磁盘读入
+ * 
+ * 持读锁的多个线程可能同时读入同一个inode，由attach_lock保证只读入一次
+ * 
+ * @param dentry 
+ * @return struct hitszfs_inode* 
+ */
+struct hitszfs_inode* hitszfs_dentry_inode(struct hitszfs_dentry * dentry) 
+{
+    struct hitszfs_inode* inode = __atomic_load_n(&dentry->inode, __ATOMIC_ACQUIRE);
+
+    if (inode != NULL) {
+        return inode;
+    }
+    pthread_mutex_lock(&hitszfs_super.attach_lock);
+    inode = dentry->inode;
+    if (inode == NULL) {
+        inode = hitszfs_read_inode(dentry, dentry->ino);
+        __atomic_store_n(&dentry->inode, inode, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&hitszfs_super.attach_lock);
+    return inode;
+}
+/**
+ * @brief 文件类型对应的st_mode
+ * 
+ * @param ftype 
+ * @return mode_t 
+ */
+mode_t hitszfs_ftype_mode(HITSZFS_FILE_TYPE ftype) 
+{
+    switch (ftype)
+    {
+    case HITSZFS_DIR:
+        return S_IFDIR | HITSZFS_DEFAULT_PERM;
+    case HITSZFS_SYM_LINK:
+        return S_IFLNK | HITSZFS_DEFAULT_PERM;
+    default:
+        return S_IFREG | HITSZFS_DEFAULT_PERM;
+    }
+}
+/**
+ * @brief 按inode填充stat，getattr与低层接口的lookup/getattr共用
+ * 
+ * @param inode 
+ * @param st 
+ */
+void hitszfs_fill_stat(struct hitszfs_inode * inode, struct stat * st) 
+{
+    memset(st, 0, sizeof(struct stat));
+    st->st_ino     = inode->ino;
+    st->st_mode    = hitszfs_ftype_mode(inode->dentry->ftype);
+    if (HITSZFS_IS_DIR(inode)) {
+        st->st_size = inode->dir_cnt * sizeof(struct hitszfs_dentry_d);
+    }
+    else {
+        st->st_size = inode->size;
+    }
+    st->st_nlink   = 1;
+    st->st_uid     = getuid();
+    st->st_gid     = getgid();
+    st->st_atime   = inode->atime;
+    st->st_mtime   = inode->mtime;
+    st->st_ctime   = inode->ctime;
+    st->st_blksize = HITSZFS_BLK_SZ();
+    if (inode->dentry == hitszfs_super.root_dentry) {
+        st->st_size   = HITSZFS_BLKS_SZ(hitszfs_super.max_data - hitszfs_super.data_free + 
+                                        hitszfs_super.data_delalloc);  /* 已用(含预留)空间 */
+        st->st_blocks = HITSZFS_DISK_SZ() / HITSZFS_BLK_SZ();
+        st->st_nlink  = 2;                            /* !特殊，根目录link数为2 */
+    }
+}
+/**
+ * @brief 按空闲计数填充statvfs，O(1)，高层与低层接口的statfs共用
+ * 
+ * 延迟分配预留的块视为已用
+ * 
+ * @param st 
+ */
+void hitszfs_fill_statfs(struct statvfs * st) 
+{
+    memset(st, 0, sizeof(struct statvfs));
+    pthread_mutex_lock(&hitszfs_super.bitmap_lock);
+    st->f_bsize   = HITSZFS_BLK_SZ();
+    st->f_frsize  = HITSZFS_BLK_SZ();
+    st->f_blocks  = hitszfs_super.max_data;
+    st->f_bfree   = hitszfs_super.data_free - hitszfs_super.data_delalloc;
+    st->f_bavail  = st->f_bfree;
+    st->f_files   = hitszfs_super.max_ino;
+    st->f_ffree   = hitszfs_super.inode_free;
+    st->f_favail  = st->f_ffree;
+    st->f_fsid    = HITSZFS_MAGIC_NUM;
+    st->f_namemax = MAX_NAME_LEN - 1;
+    pthread_mutex_unlock(&hitszfs_super.bitmap_lock);
+}
+/**
+ * @brief 协商FUSE连接参数: 异步读、大块写，单个读写请求和预读窗口放大到HITSZFS_MAX_IO，
+ * 顺序读写不再被切成4KiB的请求；内核支持时读写请求经由管道splice，目录上也可发ioctl(碎片整理)
+ * 
+ * @param conn 
+ */
+void hitszfs_conn_init(struct fuse_conn_info * conn) 
+{
+    conn->async_read    = 1;
+    conn->want         |= (FUSE_CAP_ASYNC_READ | FUSE_CAP_BIG_WRITES | FUSE_CAP_SPLICE_READ |
+                           FUSE_CAP_SPLICE_WRITE | FUSE_CAP_SPLICE_MOVE | FUSE_CAP_IOCTL_DIR) & conn->capable;
+    conn->max_write     = HITSZFS_MAX_IO;
+    conn->max_readahead = HITSZFS_MAX_IO;
+}
 /**
  * @brief 找到inode的第dir条目录项
  * 
+ * 目录项已读入时持目录的读锁，否则持写锁读入
+ * 
  * @param inode 
  * @param dir [0...]
  * @return struct hitszfs_dentry* 
  */
 struct hitszfs_dentry* hitszfs_get_dentry(struct hitszfs_inode * inode, int dir) {
-    struct hitszfs_dentry* dentry_cursor = inode->dentrys;
-    int    cnt = 0;
-    while (dentry_cursor)
-    {
-        if (dir == cnt) {
-            return dentry_cursor;
-        }
-        cnt++;
-        dentry_cursor = dentry_cursor->brother;
+    struct hitszfs_dentry* dentry = NULL;
+
+    pthread_rwlock_rdlock(&inode->rwlock);
+    if (inode->dentrys_loaded) {
+        dentry = hitszfs_dindex_at(inode, dir);
+        pthread_rwlock_unlock(&inode->rwlock);
+        return dentry;
+    }
+    pthread_rwlock_unlock(&inode->rwlock);
+
+    pthread_rwlock_wrlock(&inode->rwlock);
+    if (hitszfs_dir_load(inode) == HITSZFS_ERROR_NONE) {
+        dentry = hitszfs_dindex_at(inode, dir);
     }
-    return NULL;
+    pthread_rwlock_unlock(&inode->rwlock);
+    return dentry;
 }
 /**
  * @brief 找到路径所对应的目录项，或者返回上一级目录项
@@ -364,15 +1688,24 @@ struct hitszfs_dentry* hitszfs_get_dentry(struct hitszfs_inode * inode, int dir)
 struct hitszfs_dentry* hitszfs_lookup(const char * path, boolean* is_find, boolean* is_root) 
 {
     struct hitszfs_dentry* dentry_cursor = hitszfs_super.root_dentry;
-    struct hitszfs_dentry* dentry_ret = NULL;
+    struct hitszfs_dentry* dentry_ret;
     struct hitszfs_inode*  inode; 
     int   total_lvl = hitszfs_calc_lvl(path);
     int   lvl = 0;
     boolean is_hit;
     char* fname = NULL;
-    char* path_cpy = (char*)malloc(sizeof(path));
+    char* path_cpy;
+    char* save_ptr;
+
+    dentry_ret = hitszfs_dcache_lookup(path, is_find, is_root);
+    if (dentry_ret != NULL) 
+    {                                                 /* dcache命中 */
+        hitszfs_icache_touch(hitszfs_dentry_inode(dentry_ret));
+        return dentry_ret;
+    }
+    path_cpy = strdup(path);
     *is_root = FALSE;
-    strcpy(path_cpy, path);
+    *is_find = FALSE;
 
     if (total_lvl == 0) 
     {                           /* 根目录 */
@@ -384,34 +1717,22 @@ struct hitszfs_dentry* hitszfs_lookup(const char * path, boolean* is_find, boole
      * 从根目录开始，依次匹配路径中的目录项，直到找到文件所对应的目录项。
      * 如果没找到则返回最后一次匹配的目录项。
      * */  
-    fname = strtok(path_cpy, "/");     
+    fname = strtok_r(path_cpy, "/", &save_ptr);     
     while (fname)
     {   
         lvl++;
-        if (dentry_cursor->inode == NULL) {           /* Cache机制 */
-            hitszfs_read_inode(dentry_cursor, dentry_cursor->ino);
-        }
-
-        inode = dentry_cursor->inode;
-        // 到了某个层级发现不是文件夹而是文件，返回这个文件的dentry
-        if (HITSZFS_IS_REG(inode) && lvl < total_lvl) {
+        inode = hitszfs_dentry_inode(dentry_cursor);  /* Cache机制 */
+        hitszfs_icache_touch(inode);
+        // 路径还没走完就遇到了非目录(如/file/x中的file)，返回这个文件的dentry
+        if (!HITSZFS_IS_DIR(inode)) {
             HITSZFS_DBG("[%s] not a dir\n", __func__);
             dentry_ret = inode->dentry;
             break;
         }
         if (HITSZFS_IS_DIR(inode)) { /*目录类型的文件需要将目录项和路径名进行比较*/
-            dentry_cursor = inode->dentrys;
-            is_hit        = FALSE;
-
-            while (dentry_cursor)
-            {
-                // 遍历同级目录，找到名字匹配的文件夹
-                if (memcmp(dentry_cursor->fname, fname, strlen(fname)) == 0) {
-                    is_hit = TRUE;
-                    break;
-                }
-                dentry_cursor = dentry_cursor->brother;
-            }
+            // 在目录哈希索引中查找名字完全匹配的目录项
+            dentry_cursor = hitszfs_dir_lookup(inode, fname);
+            is_hit        = dentry_cursor != NULL;
             // 没有找到匹配的文件（夹）名，返回上一级的dentry
             if (!is_hit) {
                 *is_find = FALSE;
@@ -426,24 +1747,126 @@ struct hitszfs_dentry* hitszfs_lookup(const char * path, boolean* is_find, boole
                 break;
             }
         }
-        fname = strtok(NULL, "/"); 
+        fname = strtok_r(NULL, "/", &save_ptr); 
     }
 
-    if (dentry_ret->inode == NULL) {
-        dentry_ret->inode = hitszfs_read_inode(dentry_ret, dentry_ret->ino);
-    }
+    hitszfs_icache_touch(hitszfs_dentry_inode(dentry_ret));
+    free(path_cpy);
+    hitszfs_dcache_insert(path, dentry_ret, *is_find, *is_root);
     
     return dentry_ret;
 }
+/**
+ * @brief 创建时查找父目录及其中的同名项
+ * 
+ * 创建只使负缓存项失效，父目录的正缓存项一直有效，在同一目录下连续创建时
+ * 父目录直接命中dcache，文件名再由父目录的哈希索引查找，不必逐级解析完整路径
+ * 
+ * @param path 
+ * @param is_find 输出，父目录中已有同名项
+ * @return struct hitszfs_dentry* 父目录的dentry(可能不是目录)，父目录不存在时返回NULL
+ */
+struct hitszfs_dentry* hitszfs_lookup_parent(const char * path, boolean* is_find) 
+{
+    struct hitszfs_dentry* parent;
+    char*                  fname = hitszfs_get_fname(path);
+    char*                  parent_path;
+    boolean                is_parent_find, is_root;
+
+    *is_find    = FALSE;
+    parent_path = strndup(path, fname - path - 1);
+    parent      = hitszfs_lookup(parent_path[0] == '\0' ? "/" : parent_path, &is_parent_find, &is_root);
+    free(parent_path);
+    if (!is_parent_find) {
+        return NULL;
+    }
+    if (HITSZFS_IS_DIR(parent->inode)) {
+        *is_find = hitszfs_dir_lookup(parent->inode, fname) != NULL;
+    }
+    return parent;
+}
+/**
+ * @brief 由读入的位图统计空闲inode与数据块，建立各块组的空闲摘要
+ * 
+ * 挂载时位图已全部读入内存，重新统计不需要额外读盘，也不受非正常卸载影响；
+ * fsck修复位图后也由此重新统计
+ */
+void hitszfs_group_sum_init() 
+{
+    struct hitszfs_group_sum* sum;
+    int                       group, ino, blk, start, end;
+
+    hitszfs_super.groups        = (struct hitszfs_group_sum *)calloc(hitszfs_super.group_cnt, 
+                                                                     sizeof(struct hitszfs_group_sum));
+    hitszfs_super.inode_free    = 0;
+    hitszfs_super.data_free     = 0;
+    hitszfs_super.data_delalloc = 0;
+    for (group = 0; group < hitszfs_super.group_cnt; group++)
+    {
+        sum = &hitszfs_super.groups[group];
+        for (ino = group * hitszfs_super.inodes_per_group; 
+             ino < (group + 1) * hitszfs_super.inodes_per_group; ino++)
+        {
+            sum->free_inode += !(hitszfs_super.map_inode[ino / UINT8_BITS] & (0x1 << (ino % UINT8_BITS)));
+        }
+        hitszfs_group_data_range(group, &start, &end);
+        for (blk = start; blk < end; blk++)
+        {
+            sum->free_data += !hitszfs_data_used(blk);
+        }
+        sum->max_extent = hitszfs_group_max_extent(group);
+        hitszfs_super.inode_free += sum->free_inode;
+        hitszfs_super.data_free  += sum->free_data;
+    }
+}
+/**
+ * @brief 主超级块无效时在各块组的超级块位置找一份有效的备份
+ * 
+ * 布局未知，按可选的块大小推算块组位置(每组的块数为一个位图块的位数，见hitszfs_plan_layout)，
+ * 幻数、块大小与块组大小都相符、且声明的块组数包含该组时认为有效。只有一个块组的磁盘没有备份
+ * 
+ * @param super_d 输出，找到的备份
+ * @param super_ofs 输出，备份在磁盘上的偏移
+ * @return int 0成功，找不到时返回-HITSZFS_ERROR_INVAL
+ */
+static int hitszfs_super_backup(struct hitszfs_super_d* super_d, off_t* super_ofs) 
+{
+    static const int sz_blks[] = { 1024, 4096 };
+    off_t            ofs;
+    int              group, i;
+
+    for (i = 0; i < (int)(sizeof(sz_blks) / sizeof(sz_blks[0])); i++)
+    {
+        for (group = 1; ; group++)
+        {
+            ofs = (off_t)group * sz_blks[i] * UINT8_BITS * sz_blks[i] + HITSZFS_SUPER_OFS;
+            if (ofs + (off_t)sizeof(struct hitszfs_super_d) > HITSZFS_DISK_SZ()) {
+                break;
+            }
+            if (hitszfs_driver_read(ofs, (uint8_t *)super_d, sizeof(struct hitszfs_super_d)) != HITSZFS_ERROR_NONE) {
+                return -HITSZFS_ERROR_IO;
+            }
+            if (super_d->magic_num == HITSZFS_MAGIC_NUM && super_d->sz_blk == sz_blks[i] &&
+                super_d->blks_per_group == sz_blks[i] * UINT8_BITS && super_d->group_cnt > group) {
+                HITSZFS_DBG("[%s] primary super block invalid, using backup in group %d\n", __func__, group);
+                hitszfs_super.super_backup = group;
+                *super_ofs = ofs;
+                return HITSZFS_ERROR_NONE;
+            }
+        }
+    }
+    return -HITSZFS_ERROR_INVAL;
+}
 /**
  * @brief 挂载hitszfs, Layout如下
  * 
- * Layout
+ * Layout (每个块组)
  * | Super | Inode Map | Data Map | Inode | Data |
  * 
- * BLK_SZ = 2 * IO_SZ
+ * 第一次挂载(或options.format)时按磁盘大小规划布局，见hitszfs_plan_layout。
+ * options.no_format时(fsck、碎片整理等离线工具)从不格式化: 主超级块无效时改用块组中的备份，
+ * 没有有效的备份则挂载失败；卸载时重写主超级块
  * 
- * 每个Inode占用一个Blk
  * @param options
  * @return int
 */
@@ -452,20 +1875,40 @@ int hitszfs_mount(struct custom_options options)
     /*定义磁盘各部分结构*/
     int                         ret = HITSZFS_ERROR_NONE;
     int                         driver_fd;
+    int                         sz_disk;
     struct hitszfs_super_d      hitszfs_super_d;
+    off_t                       super_ofs = HITSZFS_SUPER_OFS;
     struct hitszfs_dentry*      root_dentry;
     struct hitszfs_inode*       root_inode;
-
-    int                         inode_num;
-    int                         map_inode_blks;
-    // 数据位图
-    int                         map_data_blks;      
-    int                         inode_blks;
-
-    int                         super_blks;
+    uint8_t*                    map_blk;
+    int                         group;
     boolean                     is_init = FALSE;
+    pthread_rwlockattr_t        rwlock_attr;
 
     hitszfs_super.is_mounted = FALSE;
+    hitszfs_super.super_backup = 0;
+    hitszfs_super.flags      = 0;
+    hitszfs_super.dirty_list = NULL;
+    hitszfs_super.dirty_cnt  = 0;
+    hitszfs_super.inode_cnt  = 0;
+    hitszfs_super.lru_head   = NULL;
+    hitszfs_super.lru_tail   = NULL;
+    hitszfs_super.ino_cursor  = 0;
+    hitszfs_super.data_cursor = 0;
+    pthread_rwlockattr_init(&rwlock_attr);             /* 读者很多时避免写者(创建、回写)饿死 */
+    pthread_rwlockattr_setkind_np(&rwlock_attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&hitszfs_super.lock, &rwlock_attr);
+    pthread_rwlockattr_destroy(&rwlock_attr);
+    pthread_mutex_init(&hitszfs_super.attach_lock, NULL);
+    pthread_mutex_init(&hitszfs_super.icache_lock, NULL);
+    pthread_mutex_init(&hitszfs_super.itable_lock, NULL);
+    pthread_mutex_init(&hitszfs_super.bitmap_lock, NULL);
+    pthread_mutex_init(&hitszfs_super.io_lock, NULL);
+    hitszfs_dcache_init();
+    hitszfs_slab_init(&hitszfs_super.inode_slab, "inode", sizeof(struct hitszfs_inode), 
+                      &hitszfs_stats.inodes_live);
+    hitszfs_slab_init(&hitszfs_super.dentry_slab, "dentry", sizeof(struct hitszfs_dentry), 
+                      &hitszfs_stats.dentries_live);
 
     /*打开驱动*/
     driver_fd = ddriver_open(options.device);
@@ -477,10 +1920,15 @@ int hitszfs_mount(struct custom_options options)
 
     /*向内存超级块中标记驱动并写入磁盘大小和单次IO大小*/
     hitszfs_super.fd = driver_fd;
-    ddriver_ioctl(HITSZFS_DRIVER(), IOC_REQ_DEVICE_SIZE,  &hitszfs_super.sz_disk);
+    ddriver_ioctl(HITSZFS_DRIVER(), IOC_REQ_DEVICE_SIZE,  &sz_disk);
     ddriver_ioctl(HITSZFS_DRIVER(), IOC_REQ_DEVICE_IO_SZ, &hitszfs_super.sz_io);
-    // 块大小
-    hitszfs_super.sz_blk = 1024;
+    if (sz_disk <= 0 || hitszfs_super.sz_io <= 0)     /* ddriver以int报告大小，超出时已溢出 */
+    {
+        HITSZFS_DBG("[%s] device size %d not addressable\n", __func__, sz_disk);
+        ddriver_close(driver_fd);
+        return -HITSZFS_ERROR_INVAL;
+    }
+    hitszfs_super.sz_disk = sz_disk;
 
     /*创建根目录并读取磁盘超级块到内存*/
     root_dentry = new_dentry("/", HITSZFS_DIR);
@@ -490,53 +1938,66 @@ int hitszfs_mount(struct custom_options options)
     {
         return -HITSZFS_ERROR_IO;
     }  
+    if (hitszfs_super_d.magic_num != HITSZFS_MAGIC_NUM && options.no_format) 
+    {
+        ret = hitszfs_super_backup(&hitszfs_super_d, &super_ofs);
+        if (ret != HITSZFS_ERROR_NONE) 
+        {
+            ddriver_close(driver_fd);
+            return ret;
+        }
+    }
 
     /**
      * 根据超级块幻数判断是否为第一次启动磁盘
      * 如果是第一次启动磁盘，则需要建立磁盘超级块的布局
     */
-   if (hitszfs_super_d.magic_num != HITSZFS_MAGIC_NUM) 
-   {        
-        /* 幻数无 */
-        /* 估算各部分大小 */
-        super_blks = HITSZFS_ROUND_UP(sizeof(struct hitszfs_super_d), HITSZFS_IO_SZ()) / HITSZFS_IO_SZ();
-
-        inode_num = 512;
-
-        // map_inode_blks = HITSZFS_ROUND_UP(HITSZFS_ROUND_UP(inode_num, UINT32_BITS), HITSZFS_IO_SZ()) 
-        //                  / HITSZFS_IO_SZ();
-        map_inode_blks = 1;
-        
-        // 数据位图块
-        map_data_blks = 1;
-
-        // inode块数
-        inode_blks = HITSZFS_ROUND_UP(sizeof(struct hitszfs_inode_d) * inode_num, HITSZFS_BLK_SZ()) / HITSZFS_BLK_SZ();
-
-                                                      /* 布局layout */
-        // hitszfs_super.max_ino = (inode_num - super_blks - map_inode_blks); 
-        hitszfs_super_d.max_ino             = inode_num;
-        hitszfs_super_d.max_data            = HITSZFS_DISK_SZ() / HITSZFS_BLK_SZ() - super_blks - map_inode_blks - map_data_blks - inode_blks;
-        hitszfs_super_d.map_inode_offset    = HITSZFS_SUPER_OFS + HITSZFS_BLKS_SZ(super_blks);
-        hitszfs_super_d.map_data_offset     = hitszfs_super_d.map_inode_offset + HITSZFS_BLKS_SZ(map_inode_blks);
-        hitszfs_super_d.inode_offset        = hitszfs_super_d.map_data_offset + HITSZFS_BLKS_SZ(map_data_blks);
-        hitszfs_super_d.data_offset         = hitszfs_super_d.inode_offset + HITSZFS_BLKS_SZ(inode_blks);
-        hitszfs_super_d.map_inode_blks      = map_inode_blks;
-        hitszfs_super_d.map_data_blks       = map_data_blks;
-        hitszfs_super_d.sz_usage            = 0;
-        HITSZFS_DBG("inode map blocks: %d\n", map_inode_blks);
+    if (hitszfs_super_d.magic_num != HITSZFS_MAGIC_NUM || options.format) 
+    {        
+        /* 幻数无，按磁盘大小规划布局 */
+        memset(&hitszfs_super_d, 0, sizeof(struct hitszfs_super_d));
+        ret = hitszfs_plan_layout(HITSZFS_DISK_SZ(), HITSZFS_IO_SZ(), options.blk_sz, 
+                                  options.bytes_per_inode, options.journal_blks, &hitszfs_super_d);
+        if (ret != HITSZFS_ERROR_NONE) 
+        {
+            return ret;
+        }
+        hitszfs_super_d.features            = (options.dir_index ? HITSZFS_FEATURE_DIR_INDEX : 0) |
+                                              (options.var_dentry ? HITSZFS_FEATURE_VAR_DENTRY : 0) |
+                                              (hitszfs_super_d.journal_blks > 0 ? HITSZFS_FEATURE_JOURNAL : 0);
         is_init = TRUE;
     }
+    else if (hitszfs_super_d.features & HITSZFS_FEATURE_JOURNAL) 
+    {
+        /* 重放日志中已提交的事务，超级块本身也可能被重放 */
+        ret = hitszfs_journal_load(&hitszfs_super_d);
+        if (ret != HITSZFS_ERROR_NONE ||
+            hitszfs_driver_read(super_ofs, (uint8_t *)(&hitszfs_super_d), 
+                                sizeof(struct hitszfs_super_d)) != HITSZFS_ERROR_NONE) 
+        {
+            return -HITSZFS_ERROR_IO;
+        }
+    }
 
     /*初始化内存中的超级块和根目录项*/
-    hitszfs_super.sz_usage                  = hitszfs_super_d.sz_usage;      /* 建立 in-memory 结构 */
+    hitszfs_super.sz_blk                    = hitszfs_super_d.sz_blk;      /* 建立 in-memory 结构 */
     hitszfs_super.max_ino                   = hitszfs_super_d.max_ino;
     hitszfs_super.max_data                  = hitszfs_super_d.max_data;
+    hitszfs_super.features                  = hitszfs_super_d.features;
+    hitszfs_super.group_cnt                 = hitszfs_super_d.group_cnt;
+    hitszfs_super.blks_per_group            = hitszfs_super_d.blks_per_group;
+    hitszfs_super.inodes_per_group          = hitszfs_super_d.inodes_per_group;
+    hitszfs_super.data_per_group            = hitszfs_super_d.data_per_group;
+    hitszfs_super.inode_blks                = hitszfs_super_d.inode_blks;
+    hitszfs_super.journal_offset            = hitszfs_super_d.journal_offset;
+    hitszfs_super.journal_blks              = hitszfs_super_d.journal_blks;
+    hitszfs_super.itable                    = (uint8_t **)calloc(hitszfs_super.group_cnt * hitszfs_super.inode_blks, 
+                                                                 sizeof(uint8_t *));
 
-    hitszfs_super.map_inode                 = (uint8_t *)malloc(HITSZFS_BLKS_SZ(hitszfs_super_d.map_inode_blks));
+    hitszfs_super.map_inode                 = (uint8_t *)malloc(HITSZFS_MAP_INODE_SZ());
     hitszfs_super.map_inode_blks            = hitszfs_super_d.map_inode_blks;
     hitszfs_super.map_inode_offset          = hitszfs_super_d.map_inode_offset;
-    hitszfs_super.map_data                  = (uint8_t *)malloc(HITSZFS_BLKS_SZ(hitszfs_super_d.map_data_blks));
+    hitszfs_super.map_data                  = (uint8_t *)malloc(HITSZFS_MAP_DATA_SZ());
     hitszfs_super.map_data_blks             = hitszfs_super_d.map_data_blks;
     hitszfs_super.map_data_offset           = hitszfs_super_d.map_data_offset;
     hitszfs_super.inode_offset              = hitszfs_super_d.inode_offset;
@@ -545,22 +2006,50 @@ int hitszfs_mount(struct custom_options options)
     if (is_init) 
     {
         // 初始化位图
-        memset(hitszfs_super.map_inode, 0, HITSZFS_BLKS_SZ(hitszfs_super_d.map_inode_blks));
-        memset(hitszfs_super.map_data, 0, HITSZFS_BLKS_SZ(hitszfs_super_d.map_data_blks));
+        memset(hitszfs_super.map_inode, 0, HITSZFS_MAP_INODE_SZ());
+        memset(hitszfs_super.map_data, 0, HITSZFS_MAP_DATA_SZ());
     } 
     else 
     {
-        // 读入inode位图
-        if (hitszfs_driver_read(hitszfs_super_d.map_inode_offset, (uint8_t *)(hitszfs_super.map_inode), 
-                HITSZFS_BLKS_SZ(hitszfs_super_d.map_inode_blks)) != HITSZFS_ERROR_NONE)
+        // 逐个块组读入inode位图和data位图
+        map_blk = (uint8_t *)malloc(HITSZFS_BLK_SZ());
+        for (group = 0; group < hitszfs_super.group_cnt; group++)
         {
-            return -HITSZFS_ERROR_IO;
-        }
-        // 读入data位图
-        if (hitszfs_driver_read(hitszfs_super_d.map_data_offset, (uint8_t *)(hitszfs_super.map_data),
-                HITSZFS_BLKS_SZ(hitszfs_super_d.map_data_blks)) != HITSZFS_ERROR_NONE){
-            return -HITSZFS_ERROR_IO;
+            if (hitszfs_driver_read(HITSZFS_GROUP_OFS(group) + hitszfs_super.map_inode_offset, map_blk, 
+                    HITSZFS_BLK_SZ()) != HITSZFS_ERROR_NONE)
+            {
+                free(map_blk);
+                return -HITSZFS_ERROR_IO;
+            }
+            memcpy(hitszfs_super.map_inode + group * HITSZFS_GROUP_MAP_INODE_SZ(), map_blk, 
+                   HITSZFS_GROUP_MAP_INODE_SZ());
+            if (hitszfs_driver_read(HITSZFS_GROUP_OFS(group) + hitszfs_super.map_data_offset, map_blk,
+                    HITSZFS_BLK_SZ()) != HITSZFS_ERROR_NONE)
+            {
+                free(map_blk);
+                return -HITSZFS_ERROR_IO;
+            }
+            memcpy(hitszfs_super.map_data + group * HITSZFS_GROUP_MAP_DATA_SZ(), map_blk, 
+                   HITSZFS_GROUP_MAP_DATA_SZ());
         }
+        free(map_blk);
+    }
+    hitszfs_group_sum_init();
+    if (is_init) {                                    /* 位图与全部超级块备份都要写出 */
+        hitszfs_group_dirty_all();
+    }
+    if (!is_init && hitszfs_super_d.free_data + hitszfs_super_d.free_inode != 0 && 
+        (hitszfs_super_d.free_data != hitszfs_super.data_free || 
+         hitszfs_super_d.free_inode != hitszfs_super.inode_free)) 
+    {                                                 /* 不带日志时非正常卸载，以位图为准 */
+        HITSZFS_DBG("[%s] stale free counts in super block: inodes %d/%d, data %d/%d\n", __func__,
+                    hitszfs_super_d.free_inode, hitszfs_super.inode_free, 
+                    hitszfs_super_d.free_data, hitszfs_super.data_free);
+    }
+
+    if (is_init && HITSZFS_JOURNAL() && hitszfs_journal_format(&hitszfs_super_d) != HITSZFS_ERROR_NONE) 
+    {
+        return -HITSZFS_ERROR_IO;
     }
 
     if (is_init) 
@@ -568,6 +2057,11 @@ int hitszfs_mount(struct custom_options options)
         /* 分配根节点 */
         root_inode = hitszfs_alloc_inode(root_dentry);
         hitszfs_sync_inode(root_inode);
+        /* 超级块须在原位置，否则崩溃后再挂载会因找不到幻数而重新格式化 */
+        if (HITSZFS_JOURNAL() && hitszfs_journal_checkpoint() != HITSZFS_ERROR_NONE) 
+        {
+            return -HITSZFS_ERROR_IO;
+        }
     }
 
     root_inode                  = hitszfs_read_inode(root_dentry, HITSZFS_ROOT_INO);
@@ -584,46 +2078,34 @@ int hitszfs_mount(struct custom_options options)
  * @return int 
  */
 int hitszfs_umount() {
-    struct hitszfs_super_d  hitszfs_super_d; 
-
     if (!hitszfs_super.is_mounted) {
         return HITSZFS_ERROR_NONE;
     }
 
-    hitszfs_sync_inode(hitszfs_super.root_dentry->inode);     /* 从根节点向下刷写节点 */
-                                                    
-    hitszfs_super_d.magic_num           = HITSZFS_MAGIC_NUM;
-    // inode位图
-    hitszfs_super_d.map_inode_blks      = hitszfs_super.map_inode_blks;
-    hitszfs_super_d.map_inode_offset    = hitszfs_super.map_inode_offset;
-
-    // data位图
-    hitszfs_super_d.map_data_blks       = hitszfs_super.map_data_blks;
-    hitszfs_super_d.map_data_offset     = hitszfs_super.map_data_offset;
-
-    hitszfs_super_d.inode_offset        = hitszfs_super.inode_offset;
-    hitszfs_super_d.data_offset         = hitszfs_super.data_offset;
-    hitszfs_super_d.sz_usage            = hitszfs_super.sz_usage;
-    hitszfs_super_d.max_ino             = hitszfs_super.max_ino;
-    hitszfs_super_d.max_data            = hitszfs_super.max_data;
-    // 写回超级块
-    if (hitszfs_driver_write(HITSZFS_SUPER_OFS, (uint8_t *)&hitszfs_super_d, 
-                     sizeof(struct hitszfs_super_d)) != HITSZFS_ERROR_NONE) {
-        return -HITSZFS_ERROR_IO;
-    }
-    // 写回inode位图
-    if (hitszfs_driver_write(hitszfs_super_d.map_inode_offset, (uint8_t *)(hitszfs_super.map_inode), 
-                         HITSZFS_BLKS_SZ(hitszfs_super_d.map_inode_blks)) != HITSZFS_ERROR_NONE) {
+    hitszfs_super.flags |= HITSZFS_FLAG_BUF_DIRTY |   /* 超级块及其备份总是写回 */
+                           HITSZFS_FLAG_BACKUP_DIRTY;
+    if (hitszfs_sync_dirty() != HITSZFS_ERROR_NONE) { /* 只刷写脏inode、脏目录块与位图 */
         return -HITSZFS_ERROR_IO;
     }
-    // 写回data位图
-    if (hitszfs_driver_write(hitszfs_super_d.map_data_offset, (uint8_t *)(hitszfs_super.map_data), 
-                         HITSZFS_BLKS_SZ(hitszfs_super_d.map_data_blks)) != HITSZFS_ERROR_NONE) {
-        return -HITSZFS_ERROR_IO;
+    if (HITSZFS_JOURNAL()) {                          /* 卸载后磁盘不依赖日志 */
+        if (hitszfs_journal_checkpoint() != HITSZFS_ERROR_NONE) {
+            return -HITSZFS_ERROR_IO;
+        }
+        hitszfs_journal_destroy();
     }
 
+#ifdef HITSZFS_DEBUG
+    hitszfs_dump_stats();                             /* 平时通过HITSZFS_IOC_STATS读取 */
+#endif
+    hitszfs_dcache_destroy();
+    hitszfs_itable_destroy();
+    hitszfs_slab_destroy(&hitszfs_super.inode_slab);
+    hitszfs_slab_destroy(&hitszfs_super.dentry_slab);
     free(hitszfs_super.map_inode);
+    free(hitszfs_super.map_data);
+    free(hitszfs_super.groups);
     ddriver_close(HITSZFS_DRIVER());
+    hitszfs_super.is_mounted = FALSE;
 
     return HITSZFS_ERROR_NONE;
 }
\ No newline at end of file
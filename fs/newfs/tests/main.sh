@@ -3,8 +3,8 @@ POINTS=0
 TOTAL_POINTS=0
 TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh)
 # mount.sh mkdir.sh touch.sh ls.sh remount.sh (read.sh write.sh cp.sh)
-ALL_TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh rw.sh cp.sh)
-ALL_TEST_SCORES=(1 4 5 4 16 2 2)
+ALL_TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh rw.sh cp.sh crash.sh rm.sh mv.sh fsck.sh)
+ALL_TEST_SCORES=(1 4 5 4 16 2 2 8 5 4 5)
 MNTPOINT='./mnt'
 PROJECT_NAME="hitszfs"
 
@@ -35,6 +35,10 @@ elif [[ "${LEVEL}" == "6" ]]; then
     echo "开始mount, mkdir, touch, ls, read&write, cp, umount测试"
     TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh rw.sh cp.sh)
     sleep 1
+elif [[ "${LEVEL}" == "7" ]]; then
+    echo "开始mount, mkdir, touch, ls, read&write, cp, rm, mv, umount, 崩溃恢复, fsck测试"
+    TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh rw.sh cp.sh rm.sh mv.sh crash.sh fsck.sh)
+    sleep 1
 else
     echo "未知测试参数"
     exit 1
@@ -150,6 +154,32 @@ function touch_and_check () {
     fi
 }
 
+ERR_OK=0
+INODE_MAP_ERR=1
+DATA_MAP_ERR=2
+LAYOUT_FILE_ERR=3
+GOLDEN_LAYOUT_MISMATCH=4
+
+function check_bm() {
+    _PARAM=$1
+    _TEST_CASE=$2
+    ROOT_PARENT_PATH=$(cd $(dirname $ROOT_PATH); pwd)
+    python3 "$ROOT_PATH"/checkbm/checkbm.py -l "$ROOT_PARENT_PATH"/include/fs.layout -r "$ROOT_PARENT_PATH"/tests/checkbm/golden.json > /dev/null
+    RET=$?
+    if (( RET == ERR_OK )); then
+        return 0
+    elif (( RET == INODE_MAP_ERR )); then
+        fail "$_TEST_CASE: Inode位图错误, 请使用checkbm.py和ddriver工具自行检查. 注: 在命令行输入ddriver -d并且安装HexEditor插件即可查看当前ddriver介质情况"
+    elif (( RET == DATA_MAP_ERR )); then
+        fail "$_TEST_CASE: 数据位图错误, 请使用checkbm.py和ddriver工具自行检查. 注: 在命令行输入ddriver -d并且安装HexEditor插件即可查看当前ddriver介质情况"
+    elif (( RET == LAYOUT_FILE_ERR )); then
+        fail "$_TEST_CASE: .layout文件有误, 请结合报错信息自行检查"
+    elif (( RET == GOLDEN_LAYOUT_MISMATCH )); then
+        fail "$_TEST_CASE: .layout文件与golden.json信息不一致, 请结合报错信息自行检查"
+    fi
+    return 1
+}
+
 # Test
 function register_testcase() {
     for target_test_case in "${TEST_CASES[@]}"; do
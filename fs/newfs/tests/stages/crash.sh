@@ -0,0 +1,94 @@
+#!/bin/bash
+
+TEST_CASE="case 8 - crash"
+
+GOLDEN="Lorem ipsum dolor sit amet, consectetur adipisicing elit, sed do eiusmod tempor incididunt ut labore et dolore magna aliqua. Ut enim ad minim veniam, quis nostrud exercitation ullamco laboris nisi ut aliquip ex ea commodo consequat. Duis aute irure dolor in reprehenderit in voluptate velit esse cillum dolore eu fugiat nulla pariatur. Excepteur sint occaecat cupidatat non proident, sunt in culpa qui officia deserunt mollit anim id est laborum."
+
+# 写入并fsync之后直接杀掉守护进程(不经umount)，重新挂载后fsync过的内容必须还在，
+# 删除文件并正常umount后位图与只有/hello时一致
+
+function check_fsync () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    if ! echo "$_PARAM" | tee "${MNTPOINT}"/hello/file0 > /dev/null; then
+        fail "$_TEST_CASE: 写入$_PARAM到文件${MNTPOINT}/hello/file0失败"
+        return 1
+    fi
+    if ! sync "${MNTPOINT}"/hello/file0; then
+        fail "$_TEST_CASE: fsync文件${MNTPOINT}/hello/file0失败"
+        return 1
+    fi
+    return 0
+}
+
+function check_kill () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    PID=$(pgrep -f "build/${PROJECT_NAME} --device")
+    if [[ -z "${PID}" ]]; then
+        fail "$_TEST_CASE: 没有找到$PROJECT_NAME守护进程"
+        return 1
+    fi
+    kill -9 $PID
+    while kill -0 $PID 2>/dev/null; do
+        sleep 0.1
+    done
+    # 守护进程已退出，挂载点只剩下断开的连接
+    umount -l "${MNTPOINT}"
+    if ! mount_fuse || ! check_mount; then
+        fail "$_TEST_CASE: 杀掉守护进程后重新挂载失败"
+        return 1
+    fi
+    return 0
+}
+
+function check_recover () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    OUTPUT=$(cat "${MNTPOINT}"/hello/file0)
+    if [[ "${OUTPUT}" != "${_PARAM}" ]]; then
+        fail "$_TEST_CASE: 重新挂载后${MNTPOINT}/hello/file0内容不正确, 应该为: $_PARAM"
+        return 1
+    fi
+    return 0
+}
+
+function check_clean_umount () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    if ! rm "${MNTPOINT}"/hello/file0; then
+        fail "$_TEST_CASE: 删除文件${MNTPOINT}/hello/file0失败"
+        return 1
+    fi
+    sleep 1
+    umount "${MNTPOINT}"
+    if check_mount; then
+        fail "$_TEST_CASE: $PROJECT_NAME文件系统仍然在挂载点${MNTPOINT}"
+        return 1
+    fi
+    return 0
+}
+
+clean_mount
+clean_ddriver
+
+try_mount_or_fail
+
+mkdir_and_check "${MNTPOINT}/hello"
+
+TEST_CASE="case 8.1 - write and fsync ${MNTPOINT}/hello/file0"
+core_tester echo "$GOLDEN" check_fsync "$TEST_CASE"
+
+TEST_CASE="case 8.2 - kill $PROJECT_NAME and mount again"
+core_tester echo "$TEST_CASE" check_kill "$TEST_CASE"
+
+TEST_CASE="case 8.3 - read ${MNTPOINT}/hello/file0 after recovery"
+core_tester echo "$GOLDEN" check_recover "$TEST_CASE"
+
+TEST_CASE="case 8.4 - remove ${MNTPOINT}/hello/file0 and umount"
+core_tester echo "$TEST_CASE" check_clean_umount "$TEST_CASE"
+
+sleep 1
+
+TEST_CASE="case 8.5 - check bitmap"
+core_tester ls "${MNTPOINT}" check_bm "$TEST_CASE" 4
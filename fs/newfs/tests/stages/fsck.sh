@@ -0,0 +1,137 @@
+#!/bin/bash
+
+TEST_CASE="case 11 - fsck"
+
+GOLDEN="Lorem ipsum dolor sit amet, consectetur adipisicing elit, sed do eiusmod tempor incididunt ut labore et dolore magna aliqua."
+
+# 卸载后离线运行fsck.hitszfs，返回值同e2fsck: 0一致，1已修复，4仍有未修复的问题，8检查失败。
+# 布局见include/fs.layout: 块大小1024B，块1为inode位图，块2为数据位图
+
+FSCK="$ROOT_PATH"/../build/fsck.${PROJECT_NAME}
+BSIZE=1024
+DATA_MAP_BLK=2
+
+function run_fsck () {
+    "$FSCK" --device="$HOME"/ddriver "$@" > /dev/null 2>&1
+    return $?
+}
+
+function check_fsck_clean () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    run_fsck
+    RET=$?
+    if (( RET != 0 )); then
+        fail "$_TEST_CASE: 正常卸载后fsck.${PROJECT_NAME}返回$RET, 应该为0"
+        return 1
+    fi
+    # 保存正确的位图，用于检查修复结果
+    dd if="$HOME"/ddriver of=/tmp/${PROJECT_NAME}_fsck_maps bs=$BSIZE skip=1 count=2 2>/dev/null
+    return 0
+}
+
+function check_fsck_leak () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    # 把数据位图中尚未使用的第800~807块标记为占用(泄漏)
+    printf '\xff' | dd of="$HOME"/ddriver bs=1 seek=$((DATA_MAP_BLK * BSIZE + 100)) conv=notrunc 2>/dev/null
+    cp "$HOME"/ddriver /tmp/${PROJECT_NAME}_fsck_img
+    run_fsck
+    RET=$?
+    if (( RET != 4 )); then
+        fail "$_TEST_CASE: 位图损坏且未指定--repair时fsck.${PROJECT_NAME}返回$RET, 应该为4"
+        return 1
+    fi
+    if ! cmp -s "$HOME"/ddriver /tmp/${PROJECT_NAME}_fsck_img; then
+        fail "$_TEST_CASE: 未指定--repair时fsck.${PROJECT_NAME}修改了磁盘"
+        return 1
+    fi
+    return 0
+}
+
+function check_fsck_repair () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    run_fsck --repair
+    RET=$?
+    if (( RET != 1 )); then
+        fail "$_TEST_CASE: fsck.${PROJECT_NAME} --repair返回$RET, 应该为1"
+        return 1
+    fi
+    dd if="$HOME"/ddriver of=/tmp/${PROJECT_NAME}_fsck_repaired bs=$BSIZE skip=1 count=2 2>/dev/null
+    if ! cmp -s /tmp/${PROJECT_NAME}_fsck_maps /tmp/${PROJECT_NAME}_fsck_repaired; then
+        fail "$_TEST_CASE: 修复后的位图与损坏前不一致"
+        return 1
+    fi
+    run_fsck
+    RET=$?
+    if (( RET != 0 )); then
+        fail "$_TEST_CASE: 修复后再次运行fsck.${PROJECT_NAME}返回$RET, 应该为0"
+        return 1
+    fi
+    return 0
+}
+
+function check_remount () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    if ! mount_fuse || ! check_mount; then
+        fail "$_TEST_CASE: 修复后挂载失败"
+        return 1
+    fi
+    OUTPUT=$(cat "${MNTPOINT}"/hello/file0)
+    sleep 1
+    umount "${MNTPOINT}"
+    if [[ "${OUTPUT}" != "${_PARAM}" ]]; then
+        fail "$_TEST_CASE: 修复后${MNTPOINT}/hello/file0内容不正确, 应该为: $_PARAM"
+        return 1
+    fi
+    return 0
+}
+
+function check_fsck_nosuper () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    sleep 1
+    # 清零主超级块；默认大小的磁盘只有一个块组，没有超级块备份
+    dd if=/dev/zero of="$HOME"/ddriver bs=$BSIZE count=1 conv=notrunc 2>/dev/null
+    cp "$HOME"/ddriver /tmp/${PROJECT_NAME}_fsck_img
+    run_fsck --repair
+    RET=$?
+    if (( RET != 8 )); then
+        fail "$_TEST_CASE: 没有有效的超级块时fsck.${PROJECT_NAME}返回$RET, 应该为8"
+        return 1
+    fi
+    if ! cmp -s "$HOME"/ddriver /tmp/${PROJECT_NAME}_fsck_img; then
+        fail "$_TEST_CASE: fsck.${PROJECT_NAME}重新格式化或修改了磁盘"
+        return 1
+    fi
+    return 0
+}
+
+clean_mount
+clean_ddriver
+
+try_mount_or_fail
+
+mkdir_and_check "${MNTPOINT}/hello"
+echo "$GOLDEN" > "${MNTPOINT}"/hello/file0
+sleep 1
+umount "${MNTPOINT}"
+
+TEST_CASE="case 11.1 - fsck a cleanly unmounted image"
+core_tester echo "$TEST_CASE" check_fsck_clean "$TEST_CASE"
+
+TEST_CASE="case 11.2 - fsck leaked blocks without --repair"
+core_tester echo "$TEST_CASE" check_fsck_leak "$TEST_CASE"
+
+TEST_CASE="case 11.3 - fsck --repair restores the bitmaps"
+core_tester echo "$TEST_CASE" check_fsck_repair "$TEST_CASE"
+
+TEST_CASE="case 11.4 - mount and read ${MNTPOINT}/hello/file0 after repair"
+core_tester echo "$GOLDEN" check_remount "$TEST_CASE"
+
+TEST_CASE="case 11.5 - fsck an image without a valid super block"
+core_tester echo "$TEST_CASE" check_fsck_nosuper "$TEST_CASE"
+
+rm -f /tmp/${PROJECT_NAME}_fsck_maps /tmp/${PROJECT_NAME}_fsck_repaired /tmp/${PROJECT_NAME}_fsck_img
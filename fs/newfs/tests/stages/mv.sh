@@ -0,0 +1,93 @@
+#!/bin/bash
+
+TEST_CASE="case 10 - mv"
+
+GOLDEN="Lorem ipsum dolor sit amet, consectetur adipisicing elit, sed do eiusmod tempor incididunt ut labore et dolore magna aliqua."
+
+function check_moved () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    if ! mv "${MNTPOINT}"/file0 "$_PARAM"; then
+        fail "$_TEST_CASE: 重命名${MNTPOINT}/file0为$_PARAM失败, 返回值非0"
+        return 1
+    fi
+    if stat "${MNTPOINT}"/file0 > /dev/null 2>&1; then
+        fail "$_TEST_CASE: 重命名后${MNTPOINT}/file0仍然存在"
+        return 1
+    fi
+    OUTPUT=$(cat "$_PARAM")
+    if [[ "${OUTPUT}" != "${GOLDEN}" ]]; then
+        fail "$_TEST_CASE: 重命名后$_PARAM内容不正确, 应该为: $GOLDEN"
+        return 1
+    fi
+    return 0
+}
+
+function check_mv_over () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    echo "old" > "${MNTPOINT}"/dir1/file2
+    if ! mv -f "${MNTPOINT}"/dir0/file1 "${MNTPOINT}"/dir1/file2; then
+        fail "$_TEST_CASE: 覆盖已存在的${MNTPOINT}/dir1/file2失败"
+        return 1
+    fi
+    OUTPUT=$(cat "${MNTPOINT}"/dir1/file2)
+    if [[ "${OUTPUT}" != "${GOLDEN}" ]]; then
+        fail "$_TEST_CASE: 覆盖后${MNTPOINT}/dir1/file2内容不正确, 应该为: $GOLDEN"
+        return 1
+    fi
+    if stat "${MNTPOINT}"/dir0/file1 > /dev/null 2>&1; then
+        fail "$_TEST_CASE: 覆盖后${MNTPOINT}/dir0/file1仍然存在"
+        return 1
+    fi
+    return 0
+}
+
+function check_mv_subtree () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    if mv "${MNTPOINT}"/dir0 "${MNTPOINT}"/dir0/dir3/dir0 2>/dev/null; then
+        fail "$_TEST_CASE: 目录${MNTPOINT}/dir0被移动到了自己的子目录下"
+        return 1
+    fi
+    if ! stat "${MNTPOINT}"/dir0/dir3 > /dev/null; then
+        fail "$_TEST_CASE: 移动失败后${MNTPOINT}/dir0/dir3不见了"
+        return 1
+    fi
+    return 0
+}
+
+function check_mv_notempty () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    # 目标是非空目录时rename(2)失败，用python直接调用以免mv把源移进目标目录
+    if python3 -c "import os, sys; os.rename(sys.argv[1], sys.argv[2])" \
+        "${MNTPOINT}"/dir0/dir3 "${MNTPOINT}"/dir1 2>/dev/null; then
+        fail "$_TEST_CASE: 覆盖了非空目录${MNTPOINT}/dir1"
+        return 1
+    fi
+    if ! stat "${MNTPOINT}"/dir1/file2 > /dev/null || ! stat "${MNTPOINT}"/dir0/dir3 > /dev/null; then
+        fail "$_TEST_CASE: 重命名失败后原有的文件或目录不见了"
+        return 1
+    fi
+    return 0
+}
+
+try_mount_or_fail
+
+mkdir_and_check "${MNTPOINT}"/dir0
+mkdir_and_check "${MNTPOINT}"/dir0/dir3
+mkdir_and_check "${MNTPOINT}"/dir1
+echo "$GOLDEN" > "${MNTPOINT}"/file0
+
+TEST_CASE="case 10.1 - mv ${MNTPOINT}/file0 to ${MNTPOINT}/dir0/file1"
+core_tester echo "${MNTPOINT}"/dir0/file1 check_moved "$TEST_CASE"
+
+TEST_CASE="case 10.2 - mv ${MNTPOINT}/dir0/file1 over ${MNTPOINT}/dir1/file2"
+core_tester echo "$TEST_CASE" check_mv_over "$TEST_CASE"
+
+TEST_CASE="case 10.3 - mv ${MNTPOINT}/dir0 into its own subtree"
+core_tester echo "$TEST_CASE" check_mv_subtree "$TEST_CASE"
+
+TEST_CASE="case 10.4 - mv ${MNTPOINT}/dir0/dir3 over non-empty ${MNTPOINT}/dir1"
+core_tester echo "$TEST_CASE" check_mv_notempty "$TEST_CASE"
@@ -0,0 +1,78 @@
+#!/bin/bash
+
+TEST_CASE="case 9 - rm"
+
+GOLDEN="Lorem ipsum dolor sit amet, consectetur adipisicing elit, sed do eiusmod tempor incididunt ut labore et dolore magna aliqua."
+
+function check_gone () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    if stat "$_PARAM" > /dev/null 2>&1; then
+        fail "$_TEST_CASE: 删除后$_PARAM仍然存在"
+        return 1
+    fi
+    return 0
+}
+
+function check_rmdir_notempty () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    if rmdir "$_PARAM" 2>/dev/null; then
+        fail "$_TEST_CASE: 非空目录$_PARAM被rmdir删除"
+        return 1
+    fi
+    if ! stat "$_PARAM" > /dev/null; then
+        fail "$_TEST_CASE: rmdir失败后目录$_PARAM不见了"
+        return 1
+    fi
+    return 0
+}
+
+function check_open_unlink () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    if ! echo "$_PARAM" | tee "${MNTPOINT}"/dir0/file1 > /dev/null; then
+        fail "$_TEST_CASE: 写入文件${MNTPOINT}/dir0/file1失败"
+        return 1
+    fi
+    # 打开期间删除，已打开的描述符仍能读出原内容
+    exec 3< "${MNTPOINT}"/dir0/file1
+    if ! rm "${MNTPOINT}"/dir0/file1; then
+        exec 3<&-
+        fail "$_TEST_CASE: 删除已打开的文件${MNTPOINT}/dir0/file1失败"
+        return 1
+    fi
+    OUTPUT=$(cat <&3)
+    exec 3<&-
+    if [[ "${OUTPUT}" != "${_PARAM}" ]]; then
+        fail "$_TEST_CASE: 删除后从已打开的描述符读到的内容不正确, 应该为: $_PARAM"
+        return 1
+    fi
+    if ls -A "${MNTPOINT}"/dir0 | grep -q file1; then
+        fail "$_TEST_CASE: 删除后${MNTPOINT}/dir0中仍能看到file1"
+        return 1
+    fi
+    return 0
+}
+
+try_mount_or_fail
+
+mkdir_and_check "${MNTPOINT}"/dir0
+mkdir_and_check "${MNTPOINT}"/dir0/dir1
+touch_and_check "${MNTPOINT}"/file0
+touch_and_check "${MNTPOINT}"/dir0/dir1/file2
+
+TEST_CASE="case 9.1 - rm ${MNTPOINT}/file0"
+core_tester rm "${MNTPOINT}"/file0 check_gone "$TEST_CASE"
+
+TEST_CASE="case 9.2 - rmdir non-empty ${MNTPOINT}/dir0/dir1"
+core_tester echo "${MNTPOINT}"/dir0/dir1 check_rmdir_notempty "$TEST_CASE"
+
+TEST_CASE="case 9.3 - rm ${MNTPOINT}/dir0/dir1/file2"
+core_tester rm "${MNTPOINT}"/dir0/dir1/file2 check_gone "$TEST_CASE"
+
+TEST_CASE="case 9.4 - rmdir ${MNTPOINT}/dir0/dir1"
+core_tester rmdir "${MNTPOINT}"/dir0/dir1 check_gone "$TEST_CASE"
+
+TEST_CASE="case 9.5 - read ${MNTPOINT}/dir0/file1 after rm while open"
+core_tester echo "$GOLDEN" check_open_unlink "$TEST_CASE"
@@ -0,0 +1,90 @@
+#include "../include/hitszfs.h"
+#include <fcntl.h>
+#include <sys/ioctl.h>
+
+/******************************************************************************
+* SECTION: hitszfs-defrag
+* 
+* 用法: hitszfs-defrag [--device=<path>] [<path>]
+* 给出已挂载的hitszfs中的路径时通过HITSZFS_IOC_DEFRAG在线整理该文件(目录时为整棵子树)；
+* 否则直接打开未挂载的磁盘，离线整理整个文件系统
+*******************************************************************************/
+static void usage(const char* prog) 
+{
+    fprintf(stderr, "usage: %s [--device=<path>] [<path in mounted hitszfs>]\n", prog);
+}
+
+static void report(const struct hitszfs_defrag_report* rep)
+{
+    printf("files: %u, fragmented: %u, moved: %u (%u blocks)\n",
+           rep->files, rep->fragmented, rep->moved, rep->blocks);
+    printf("fragments: %u -> %u\n", rep->frags_before, rep->frags_after);
+    printf("seeks of moved files: %u -> %u, saved %d\n", rep->seeks_before, rep->seeks_after,
+           (int)rep->seeks_before - (int)rep->seeks_after);
+}
+
+int main(int argc, char **argv)
+{
+    struct hitszfs_defrag_report rep;
+    const char*                  path = NULL;
+    int                          ret;
+    int                          fd;
+    int                          i;
+
+    hitszfs_options.device          = strdup("/home/students/200111205/ddriver");
+    hitszfs_options.format          = FALSE;
+    hitszfs_options.no_format       = TRUE;         /* 主超级块无效时用备份，不格式化 */
+    hitszfs_options.blk_sz          = HITSZFS_DEFAULT_BLK_SZ;
+    hitszfs_options.bytes_per_inode = HITSZFS_DEFAULT_BPI;
+    hitszfs_options.journal_blks    = HITSZFS_DEFAULT_JOURNAL_BLKS;
+    hitszfs_options.dirty_age       = 0;
+    hitszfs_options.dirty_ratio     = HITSZFS_DEFAULT_DIRTY_RATIO;
+    hitszfs_options.inode_cache     = HITSZFS_DEFAULT_INODE_CACHE;
+
+    for (i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--device=", 9) == 0) {
+            free(hitszfs_options.device);
+            hitszfs_options.device = strdup(argv[i] + 9);
+        }
+        else if (argv[i][0] != '-' && path == NULL) {
+            path = argv[i];
+        }
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    memset(&rep, 0, sizeof(struct hitszfs_defrag_report));
+    if (path != NULL) {
+        fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            fprintf(stderr, "hitszfs-defrag: open %s: %s\n", path, strerror(errno));
+            return 1;
+        }
+        ret = ioctl(fd, HITSZFS_IOC_DEFRAG, &rep);
+        close(fd);
+        if (ret < 0) {
+            fprintf(stderr, "hitszfs-defrag: %s: %s\n", path, strerror(errno));
+            return 1;
+        }
+        report(&rep);
+        return 0;
+    }
+
+    ret = hitszfs_mount(hitszfs_options);
+    if (ret != HITSZFS_ERROR_NONE) {
+        fprintf(stderr, "hitszfs-defrag: mount %s failed (%d)\n", hitszfs_options.device, ret);
+        return 1;
+    }
+    HITSZFS_LOCK();
+    ret = hitszfs_defrag_tree(hitszfs_super.root_dentry->inode, &rep);
+    HITSZFS_UNLOCK();
+    hitszfs_umount();
+    if (ret != HITSZFS_ERROR_NONE) {
+        fprintf(stderr, "hitszfs-defrag: defrag failed (%d)\n", ret);
+        return 1;
+    }
+    report(&rep);
+    return 0;
+}
@@ -0,0 +1,91 @@
+#include "../include/hitszfs.h"
+
+/******************************************************************************
+* SECTION: fsck.hitszfs
+* 
+* 用法: fsck.hitszfs [--device=<path>] [--jobs=<n>] [--repair]
+* 离线检查目录树与inode/data位图、空闲计数是否一致，--repair时修复位图与计数。
+* 主超级块无效时由块组中的超级块备份挂载，--repair时重写主超级块；没有有效的备份时返回8。
+* 返回值同e2fsck: 0一致，1已修复，4仍有未修复的问题，8检查失败
+*******************************************************************************/
+static void usage(const char* prog) 
+{
+    fprintf(stderr, "usage: %s [--device=<path>] [--jobs=<n>] [--repair]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    struct hitszfs_fsck_report rep;
+    boolean                    repair = FALSE;
+    int                        jobs   = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int                        fixable, unfixable;
+    int                        ret;
+    int                        i;
+
+    hitszfs_options.device          = strdup("/home/students/200111205/ddriver");
+    hitszfs_options.format          = FALSE;
+    hitszfs_options.no_format       = TRUE;         /* 主超级块无效时用备份，不格式化 */
+    hitszfs_options.blk_sz          = HITSZFS_DEFAULT_BLK_SZ;
+    hitszfs_options.bytes_per_inode = HITSZFS_DEFAULT_BPI;
+    hitszfs_options.journal_blks    = HITSZFS_DEFAULT_JOURNAL_BLKS;
+    hitszfs_options.dirty_age       = 0;
+    hitszfs_options.dirty_ratio     = HITSZFS_DEFAULT_DIRTY_RATIO;
+    hitszfs_options.inode_cache     = HITSZFS_DEFAULT_INODE_CACHE;
+
+    for (i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--device=", 9) == 0) {
+            free(hitszfs_options.device);
+            hitszfs_options.device = strdup(argv[i] + 9);
+        }
+        else if (strncmp(argv[i], "--jobs=", 7) == 0) {
+            jobs = atoi(argv[i] + 7);
+        }
+        else if (strcmp(argv[i], "--repair") == 0) {
+            repair = TRUE;
+        }
+        else {
+            usage(argv[0]);
+            return 8;
+        }
+    }
+
+    ret = hitszfs_mount(hitszfs_options);
+    if (ret != HITSZFS_ERROR_NONE) {
+        fprintf(stderr, "fsck.hitszfs: open %s failed (%d)\n", hitszfs_options.device, ret);
+        return 8;
+    }
+    ret = hitszfs_fsck(jobs, repair, &rep);
+    if (ret != HITSZFS_ERROR_NONE) {
+        fprintf(stderr, "fsck.hitszfs: check failed (%d)\n", ret);
+        ddriver_close(HITSZFS_DRIVER());
+        return 8;
+    }
+    printf("%d directories, %d files\n", rep.dirs, rep.files);
+    printf("inodes: %d referenced but free, %d orphaned\n", rep.inode_missing, rep.inode_leaked);
+    printf("data blocks: %d referenced but free, %d leaked, %d multiply referenced\n",
+           rep.data_missing, rep.data_leaked, rep.dup_blocks);
+    printf("bad entries %d, bad inodes %d, multiply referenced inodes %d, stale counts %d\n",
+           rep.bad_entries, rep.bad_inodes, rep.dup_inodes, rep.bad_counts);
+    if (rep.bad_super) {
+        printf("primary super block invalid, mounted from backup in group %d\n", hitszfs_super.super_backup);
+    }
+
+    fixable   = rep.inode_missing + rep.inode_leaked + rep.data_missing + rep.data_leaked + rep.bad_counts +
+                rep.bad_super;
+    unfixable = rep.bad_entries + rep.bad_inodes + rep.dup_inodes + rep.dup_blocks;
+    if (rep.repaired) {                               /* 卸载写回修复后的位图与超级块 */
+        if (hitszfs_umount() != HITSZFS_ERROR_NONE) {
+            fprintf(stderr, "fsck.hitszfs: write back failed\n");
+            return 8;
+        }
+        printf(rep.bad_super ? "bitmaps, free counts and primary super block repaired\n" 
+                             : "bitmaps and free counts repaired\n");
+    }
+    else {                                            /* 只检查时不写盘 */
+        ddriver_close(HITSZFS_DRIVER());
+    }
+    if (unfixable != 0 || (fixable != 0 && !rep.repaired)) {
+        return 4;
+    }
+    return fixable != 0 ? 1 : 0;
+}
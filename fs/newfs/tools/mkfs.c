@@ -0,0 +1,67 @@
+#include "../include/hitszfs.h"
+
+/******************************************************************************
+* SECTION: mkfs.hitszfs
+* 
+* 用法: mkfs.hitszfs [--device=<path>] [--blk_sz=1024|4096] [--bytes_per_inode=<n>] [--dir_index] [--var_dentry]
+*                    [--journal_blks=<n>]
+* 按磁盘大小规划块组布局并写入根目录，与首次挂载时的格式化流程相同。
+* --journal_blks为0时不带日志，默认(-1)按磁盘大小确定日志区
+*******************************************************************************/
+static void usage(const char* prog) 
+{
+    fprintf(stderr, "usage: %s [--device=<path>] [--blk_sz=1024|4096] "
+                    "[--bytes_per_inode=<n>] [--dir_index] [--var_dentry] [--journal_blks=<n>]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    int ret;
+    int i;
+
+    hitszfs_options.device          = strdup("/home/students/200111205/ddriver");
+    hitszfs_options.format          = TRUE;
+    hitszfs_options.blk_sz          = HITSZFS_DEFAULT_BLK_SZ;
+    hitszfs_options.bytes_per_inode = HITSZFS_DEFAULT_BPI;
+    hitszfs_options.dir_index       = FALSE;
+    hitszfs_options.var_dentry      = FALSE;
+    hitszfs_options.journal_blks    = HITSZFS_DEFAULT_JOURNAL_BLKS;
+    hitszfs_options.dirty_age       = 0;
+    hitszfs_options.dirty_ratio     = HITSZFS_DEFAULT_DIRTY_RATIO;
+    hitszfs_options.inode_cache     = HITSZFS_DEFAULT_INODE_CACHE;
+
+    for (i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--device=", 9) == 0) {
+            free(hitszfs_options.device);
+            hitszfs_options.device = strdup(argv[i] + 9);
+        }
+        else if (strncmp(argv[i], "--blk_sz=", 9) == 0) {
+            hitszfs_options.blk_sz = atoi(argv[i] + 9);
+        }
+        else if (strncmp(argv[i], "--bytes_per_inode=", 18) == 0) {
+            hitszfs_options.bytes_per_inode = atoi(argv[i] + 18);
+        }
+        else if (strncmp(argv[i], "--journal_blks=", 15) == 0) {
+            hitszfs_options.journal_blks = atoi(argv[i] + 15);
+        }
+        else if (strcmp(argv[i], "--dir_index") == 0) {
+            hitszfs_options.dir_index = TRUE;
+        }
+        else if (strcmp(argv[i], "--var_dentry") == 0) {
+            hitszfs_options.var_dentry = TRUE;
+        }
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    ret = hitszfs_mount(hitszfs_options);
+    if (ret != HITSZFS_ERROR_NONE) {
+        fprintf(stderr, "mkfs.hitszfs: format %s failed (%d)\n", hitszfs_options.device, ret);
+        return 1;
+    }
+    hitszfs_dump_layout();
+    hitszfs_umount();
+    return 0;
+}